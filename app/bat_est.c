@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bat_est.h"
+
+#define BAT_EST_EMA_SHIFT           2   // weight 1/4 for a new median
+#define BAT_EST_VALID_MIN_MV        2000
+#define BAT_EST_VALID_MAX_MV        3600
+#define BAT_EST_LOW_MV              3000 // below this the discharge curve is steep, follow the voltage both ways
+#define BAT_EST_CHARGE_OFFSET_MV    100  // voltage added by the charger
+#define BAT_EST_CHARGE_START_OFF_MV 168  // extra margin for the first estimate made on charge
+
+// Lowest voltage of levels 1..4.
+static uint16_t const m_level_mv[BAT_EST_LEVEL_MAX] = {2841, 2916, 3107, 3253};
+
+static bool mv_valid(uint16_t mv)
+{
+    return (mv > BAT_EST_VALID_MIN_MV) && (mv <= BAT_EST_VALID_MAX_MV);
+}
+
+static uint16_t charge_step(uint8_t level)
+{
+    if(level == 0)
+    {
+        return BAT_EST_CHARGE_STEP_L0;
+    }
+    if(level == 1)
+    {
+        return BAT_EST_CHARGE_STEP_L1;
+    }
+    return BAT_EST_CHARGE_STEP_L2;
+}
+
+/**@brief Function for filtering a sample, median of the last three then exponential average.
+ *
+ * @return Filtered voltage in mV.
+ */
+static uint16_t filter_update(bat_est_t* p_est, uint16_t mv)
+{
+    uint16_t a, b, c, med;
+
+    p_est->window[2] = p_est->window[1];
+    p_est->window[1] = p_est->window[0];
+    p_est->window[0] = mv;
+    if(p_est->window_len < 3)
+    {
+        p_est->window_len++;
+    }
+    if(p_est->window_len == 1)
+    {
+        p_est->filt_mv_q4 = (uint32_t)mv << 4;
+        return mv;
+    }
+
+    med = mv;
+    if(p_est->window_len == 3)
+    {
+        a = p_est->window[0];
+        b = p_est->window[1];
+        c = p_est->window[2];
+        med = (a > b) ? ((b > c) ? b : ((a > c) ? c : a)) : ((a > c) ? a : ((b > c) ? c : b));
+    }
+    p_est->filt_mv_q4 = p_est->filt_mv_q4 - (p_est->filt_mv_q4 >> BAT_EST_EMA_SHIFT) +
+                        (((uint32_t)med << 4) >> BAT_EST_EMA_SHIFT);
+    return (uint16_t)(p_est->filt_mv_q4 >> 4);
+}
+
+void bat_est_init(bat_est_t* p_est)
+{
+    memset(p_est, 0, sizeof(bat_est_t));
+    p_est->level = BAT_EST_LEVEL_UNKNOWN;
+    p_est->reported = BAT_EST_LEVEL_UNKNOWN;
+}
+
+uint8_t bat_est_level_from_mv(uint16_t mv)
+{
+    uint8_t level = 0;
+
+    while((level < BAT_EST_LEVEL_MAX) && (mv >= m_level_mv[level]))
+    {
+        level++;
+    }
+    return level;
+}
+
+/**@brief Function for updating the estimate with a battery voltage sample.
+ *
+ * @details On charge the voltage reads high, the level is only estimated from it once and then
+ *          steps up with the time spent charging. Off charge the level follows the voltage,
+ *          which may only fall above BAT_EST_LOW_MV; right after the charger is removed the
+ *          level stays until the voltage shows a lower one.
+ *
+ * @param[in] mv      Battery voltage.
+ * @param[in] usb_in  Charger connected.
+ */
+void bat_est_sample(bat_est_t* p_est, uint16_t mv, bool usb_in)
+{
+    uint16_t filt;
+    uint16_t charge_mv;
+    uint8_t level;
+
+    if(usb_in != p_est->charging)
+    {
+        // The charger shifts the voltage, do not average across the switch.
+        p_est->charging = usb_in;
+        p_est->window_len = 0;
+    }
+    filt = filter_update(p_est, mv);
+
+    if((p_est->last_mv == 0) && mv_valid(filt))
+    {
+        p_est->last_mv = filt;
+    }
+
+    if(usb_in)
+    {
+        charge_mv = mv_valid(filt) ? (filt - BAT_EST_CHARGE_OFFSET_MV) : p_est->last_mv;
+        if(charge_mv > p_est->last_mv)
+        {
+            p_est->last_mv = charge_mv;
+        }
+        if(p_est->level == BAT_EST_LEVEL_UNKNOWN)
+        {
+            if(p_est->last_mv <= BAT_EST_CHARGE_START_OFF_MV)
+            {
+                // No valid sample yet, estimate once there is one.
+                return;
+            }
+            p_est->last_mv -= BAT_EST_CHARGE_START_OFF_MV;
+            p_est->level = bat_est_level_from_mv(p_est->last_mv);
+        }
+        p_est->power_change = true;
+
+        p_est->charge_count++;
+        if(p_est->charge_count > charge_step(p_est->level))
+        {
+            p_est->charge_count = 0;
+            if(p_est->level < BAT_EST_LEVEL_MAX)
+            {
+                p_est->level++;
+            }
+        }
+        return;
+    }
+
+    p_est->charge_count = 0;
+    if(p_est->power_change)
+    {
+        p_est->last_mv = filt;
+        level = bat_est_level_from_mv(filt);
+        if(level < p_est->level)
+        {
+            p_est->level = level;
+            p_est->power_change = false;
+        }
+        return;
+    }
+    if((filt < BAT_EST_LOW_MV) || (filt < p_est->last_mv))
+    {
+        p_est->last_mv = filt;
+    }
+    p_est->level = bat_est_level_from_mv(p_est->last_mv);
+}
+
+/**@brief Function for moving the reported level toward the estimate.
+ *
+ * @details The reported level moves one step per call, except a rise of two or more levels off
+ *          charge which is taken at once. A single level rise off charge is not believed and
+ *          the estimate is pulled back to the reported level.
+ *
+ * @return Level to report.
+ */
+uint8_t bat_est_report(bat_est_t* p_est, bool usb_in)
+{
+    uint8_t level = p_est->level;
+    uint8_t reported = p_est->reported;
+
+    if(usb_in)
+    {
+        if((reported != BAT_EST_LEVEL_UNKNOWN) && (level != BAT_EST_LEVEL_UNKNOWN))
+        {
+            reported = ((int)level - reported > 1) ? (reported + 1) : level;
+        }
+        else if(level == BAT_EST_LEVEL_UNKNOWN)
+        {
+            p_est->level = reported;
+        }
+        else
+        {
+            reported = level;
+        }
+    }
+    else if(reported == BAT_EST_LEVEL_UNKNOWN)
+    {
+        reported = level;
+    }
+    else if(reported > level)
+    {
+        reported = (reported - level > 1) ? (reported - 1) : level;
+    }
+    else if(reported < level)
+    {
+        if(level - reported >= 2)
+        {
+            reported = level;
+        }
+        else
+        {
+            p_est->level = reported;
+        }
+    }
+
+    p_est->reported = reported;
+    return reported;
+}
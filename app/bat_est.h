@@ -0,0 +1,35 @@
+#ifndef __NORDIC_52832_BAT_EST_
+#define __NORDIC_52832_BAT_EST_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BAT_EST_LEVEL_MAX     4
+#define BAT_EST_LEVEL_UNKNOWN 0xFF
+
+// Samples on charge before the level steps up, by current level. Sampled every 5 s that is
+// 5, 20 and 25 minutes.
+#define BAT_EST_CHARGE_STEP_L0 60
+#define BAT_EST_CHARGE_STEP_L1 240
+#define BAT_EST_CHARGE_STEP_L2 300
+
+/* The state holds no pointer and the functions touch nothing else, so a recorded trace can be
+ * replayed on the host to tune the filter. */
+typedef struct
+{
+    uint16_t window[3];    // last samples for the median, mV
+    uint8_t window_len;
+    uint32_t filt_mv_q4;   // exponential average of the medians, mV * 16
+    uint16_t last_mv;      // voltage the level is derived from, 0 until a valid sample
+    uint16_t charge_count; // samples on charge since the last level step
+    uint8_t level;         // estimated level, 0..BAT_EST_LEVEL_MAX
+    uint8_t reported;      // level reported to the ST, follows level one step at a time
+    bool charging;
+    bool power_change;     // charger was connected, the level may only drop until the voltage agrees
+} bat_est_t;
+
+void bat_est_init(bat_est_t* p_est);
+uint8_t bat_est_level_from_mv(uint16_t mv);
+void bat_est_sample(bat_est_t* p_est, uint16_t mv, bool usb_in);
+uint8_t bat_est_report(bat_est_t* p_est, bool usb_in);
+#endif
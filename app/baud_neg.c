@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "baud_neg.h"
+
+void baud_neg_init(baud_neg_t* p_neg, bool hwfc)
+{
+    memset(p_neg, 0, sizeof(baud_neg_t));
+    p_neg->code = UART_BAUD_115200;
+    p_neg->hwfc = hwfc;
+}
+
+/**@brief Function for handling one UART_CMD_BAUD frame.
+ *
+ * @details The request is cmd | code. The ST proposes a rate code, the reply (status, code)
+ *          goes out at the current rate, then both sides switch and the ST repeats the command
+ *          at the new rate to confirm it. A frame without exactly one data byte is answered
+ *          with a single CTL_FAILED status byte.
+ *
+ * @param[in]  p_frame    Whole frame, tag to xor.
+ * @param[in]  lenth      Frame length field minus the xor byte.
+ * @param[out] p_rsp      Reply, BAUD_NEG_RSP_MAX bytes.
+ * @param[out] p_rsp_len  Length of the reply.
+ *
+ * @return What the caller has to do besides sending the reply.
+ */
+baud_neg_act_t baud_neg_request(baud_neg_t* p_neg, uint8_t const* p_frame, uint32_t lenth, uint8_t* p_rsp, uint8_t* p_rsp_len)
+{
+    uint8_t code;
+
+    if(lenth != 2)
+    {
+        p_rsp[0] = BAUD_NEG_STATUS_FAILED;
+        *p_rsp_len = 1;
+        return BAUD_NEG_ACT_REPLY;
+    }
+
+    code = p_frame[5];
+    p_rsp[0] = BAUD_NEG_STATUS_OK;
+    p_rsp[1] = code;
+    *p_rsp_len = 2;
+
+    if((code >= UART_BAUD_COUNT) || ((code > UART_BAUD_460800) && !p_neg->hwfc))
+    {
+        p_rsp[0] = BAUD_NEG_STATUS_FAILED;
+        return BAUD_NEG_ACT_REPLY;
+    }
+    if(p_neg->pending && (code == p_neg->code))
+    {
+        // Confirmation received at the new rate.
+        p_neg->pending = false;
+        return BAUD_NEG_ACT_REPLY;
+    }
+
+    p_neg->code = code;
+    p_neg->pending = (code != UART_BAUD_115200);
+    return BAUD_NEG_ACT_SWITCH;
+}
+
+/**@brief Function for going back to 115200, on a missing confirmation or a line error.
+ *
+ * @return true if the port has to be restarted.
+ */
+bool baud_neg_fallback(baud_neg_t* p_neg)
+{
+    p_neg->pending = false;
+    if(p_neg->code == UART_BAUD_115200)
+    {
+        return false;
+    }
+    p_neg->code = UART_BAUD_115200;
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __NORDIC_52832_BAUD_NEG_
+#define __NORDIC_52832_BAUD_NEG_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Link speed the ST can negotiate with UART_CMD_BAUD, the code is the command's data byte.
+typedef enum
+{
+    UART_BAUD_115200,
+    UART_BAUD_460800,
+    UART_BAUD_921600,
+    UART_BAUD_1000000,
+    UART_BAUD_COUNT
+} uart_baud_code_t;
+
+#define BAUD_NEG_STATUS_OK     0x01 // same values as CTL_SUCCESSS and CTL_FAILED
+#define BAUD_NEG_STATUS_FAILED 0x02
+#define BAUD_NEG_RSP_MAX       2
+
+typedef enum
+{
+    BAUD_NEG_ACT_REPLY,  // send the reply, the rate stays
+    BAUD_NEG_ACT_SWITCH, // send the reply at the current rate, then restart the port at code
+} baud_neg_act_t;
+
+/* Rate negotiation without the port: the caller sends the replies, restarts the UARTE and
+ * runs the confirmation timer, so the exchange can be replayed over a host loopback. */
+typedef struct
+{
+    uint8_t code; // rate the port runs at, uart_baud_code_t
+    bool pending; // switched away from 115200, the ST has not confirmed the new rate yet
+    bool hwfc;    // RTS/CTS connected, needed above 460800
+} baud_neg_t;
+
+void baud_neg_init(baud_neg_t* p_neg, bool hwfc);
+baud_neg_act_t baud_neg_request(baud_neg_t* p_neg, uint8_t const* p_frame, uint32_t lenth, uint8_t* p_rsp, uint8_t* p_rsp_len);
+bool baud_neg_fallback(baud_neg_t* p_neg);
+#endif
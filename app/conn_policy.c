@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "app_error.h"
+#include "app_timer.h"
+#include "ble_conn_params.h"
+#include "ble_gap.h"
+#include "sdk_config.h"
+
+#include "nrf_log_default_backends.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log.h"
+
+#include "conn_policy.h"
+
+#define FAST_MIN_CONN_INTERVAL MSEC_TO_UNITS(7.5, UNIT_1_25_MS)
+#define FAST_MAX_CONN_INTERVAL MSEC_TO_UNITS(15, UNIT_1_25_MS)
+#define FAST_SLAVE_LATENCY     0
+#define IDLE_MIN_CONN_INTERVAL MSEC_TO_UNITS(30, UNIT_1_25_MS)
+#define IDLE_MAX_CONN_INTERVAL MSEC_TO_UNITS(50, UNIT_1_25_MS)
+#define IDLE_SLAVE_LATENCY     4
+#define POLICY_SUP_TIMEOUT     MSEC_TO_UNITS(4000, UNIT_10_MS)
+
+#define IDLE_CHECK_INTERVAL APP_TIMER_TICKS(CONN_POLICY_IDLE_TIMEOUT_MS)
+
+APP_TIMER_DEF(m_idle_timer_id);
+
+static ble_gap_conn_params_t const m_profile_params[CONN_PROFILE_COUNT] =
+    {
+        [CONN_PROFILE_FAST] =
+            {
+                .min_conn_interval = FAST_MIN_CONN_INTERVAL,
+                .max_conn_interval = FAST_MAX_CONN_INTERVAL,
+                .slave_latency = FAST_SLAVE_LATENCY,
+                .conn_sup_timeout = POLICY_SUP_TIMEOUT,
+            },
+        [CONN_PROFILE_IDLE] =
+            {
+                .min_conn_interval = IDLE_MIN_CONN_INTERVAL,
+                .max_conn_interval = IDLE_MAX_CONN_INTERVAL,
+                .slave_latency = IDLE_SLAVE_LATENCY,
+                .conn_sup_timeout = POLICY_SUP_TIMEOUT,
+            },
+};
+
+static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;
+static volatile conn_profile_t m_profile = CONN_PROFILE_DEFAULT;   // accepted by the central
+static volatile conn_profile_t m_requested = CONN_PROFILE_DEFAULT; // outstanding request, DEFAULT for none
+static volatile bool m_traffic_seen = false;
+static uint32_t m_profile_since; // app_timer counter when the time in m_profile was last counted
+static conn_policy_stats_t m_stats;
+
+/**@brief Function for adding the time since the last call to the current profile.
+ *
+ * @details Called at least once per idle check, well within the 512 s the 24 bit RTC counter
+ *          takes to wrap.
+ */
+static void profile_time_update(void)
+{
+    uint32_t now = app_timer_cnt_get();
+
+    m_stats.time_ticks[m_profile] += app_timer_cnt_diff_compute(now, m_profile_since);
+    m_profile_since = now;
+}
+
+static void profile_request(conn_profile_t profile)
+{
+    ret_code_t err_code;
+
+    if(m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+    if((m_requested == profile) || ((m_requested == CONN_PROFILE_DEFAULT) && (m_profile == profile)))
+    {
+        // Already asked for, or already in use with nothing else pending.
+        return;
+    }
+
+    // Copy since ble_conn_params takes a non-const pointer.
+    ble_gap_conn_params_t params = m_profile_params[profile];
+    err_code = ble_conn_params_change_conn_params(m_conn_handle, &params);
+    if(err_code == NRF_SUCCESS)
+    {
+        m_requested = profile;
+        m_stats.requested[profile]++;
+        NRF_LOG_INFO("Conn profile %d requested", profile);
+    }
+    else
+    {
+        // Typically NRF_ERROR_BUSY while another procedure runs, retried on the next call.
+        NRF_LOG_DEBUG("Conn profile %d request failed: 0x%x", profile, err_code);
+    }
+}
+
+static void idle_timeout_handler(void* p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    profile_time_update();
+    if(m_traffic_seen)
+    {
+        m_traffic_seen = false;
+        return;
+    }
+    profile_request(CONN_PROFILE_IDLE);
+}
+
+void conn_policy_init(void)
+{
+    ret_code_t err_code = app_timer_create(&m_idle_timer_id,
+                                           APP_TIMER_MODE_REPEATED,
+                                           idle_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+void conn_policy_on_connected(uint16_t conn_handle)
+{
+    m_conn_handle = conn_handle;
+    m_profile = CONN_PROFILE_DEFAULT;
+    m_requested = CONN_PROFILE_DEFAULT;
+    m_traffic_seen = false;
+    m_profile_since = app_timer_cnt_get();
+
+    ret_code_t err_code = app_timer_start(m_idle_timer_id, IDLE_CHECK_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+void conn_policy_on_disconnected(void)
+{
+    if(m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        profile_time_update();
+    }
+    m_conn_handle = BLE_CONN_HANDLE_INVALID;
+    m_profile = CONN_PROFILE_DEFAULT;
+    m_requested = CONN_PROFILE_DEFAULT;
+
+    ret_code_t err_code = app_timer_stop(m_idle_timer_id);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for reporting a multi-packet NUS or FIDO transfer.
+ *
+ * @details Moves the link to the fast profile and keeps it there until no traffic has been
+ *          reported for CONN_POLICY_IDLE_TIMEOUT_MS (detected with one timer period of slack).
+ */
+void conn_policy_traffic(void)
+{
+    m_traffic_seen = true;
+    profile_request(CONN_PROFILE_FAST);
+}
+
+/**@brief Function for handling the Connection Parameters events of the policy requests.
+ *
+ * @details The profile only changes once the central accepted it. Events while no policy
+ *          request is outstanding, such as the outcome of the negotiation of the preferred
+ *          parameters after connecting, are left to the caller.
+ *
+ * @return true if the event answered a policy request and was handled here. A profile the
+ *         central refuses is not a reason to drop the link, so failures are only logged.
+ */
+bool conn_policy_on_conn_params_evt(ble_conn_params_evt_t const* p_evt)
+{
+    if(m_requested == CONN_PROFILE_DEFAULT)
+    {
+        return false;
+    }
+
+    if(p_evt->evt_type == BLE_CONN_PARAMS_EVT_SUCCEEDED)
+    {
+        profile_time_update();
+        m_profile = m_requested;
+        m_stats.applied[m_profile]++;
+    }
+    else if(p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    {
+        m_stats.refused[m_requested]++;
+        NRF_LOG_WARNING("Central refused conn profile %d", m_requested);
+    }
+    m_requested = CONN_PROFILE_DEFAULT;
+    return true;
+}
+
+conn_profile_t conn_policy_profile_get(void)
+{
+    return m_profile;
+}
+
+conn_policy_stats_t const* conn_policy_stats_get(void)
+{
+    return &m_stats;
+}
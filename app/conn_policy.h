@@ -0,0 +1,36 @@
+#ifndef __NORDIC_52832_CONN_POLICY_
+#define __NORDIC_52832_CONN_POLICY_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ble_conn_params.h"
+
+// Time without multi-packet traffic before the link steps back to the idle profile.
+#ifndef CONN_POLICY_IDLE_TIMEOUT_MS
+#define CONN_POLICY_IDLE_TIMEOUT_MS 3000
+#endif
+
+typedef enum
+{
+    CONN_PROFILE_DEFAULT, // preferred parameters negotiated by ble_conn_params on connection
+    CONN_PROFILE_FAST,    // short interval while NUS/FIDO messages are moving
+    CONN_PROFILE_IDLE,    // long interval with slave latency once the link is idle
+    CONN_PROFILE_COUNT
+} conn_profile_t;
+
+typedef struct
+{
+    uint32_t requested[CONN_PROFILE_COUNT];  // number of times each profile was requested from the central
+    uint32_t applied[CONN_PROFILE_COUNT];    // number of times each profile was accepted by the central
+    uint32_t refused[CONN_PROFILE_COUNT];    // number of times each profile was refused by the central
+    uint64_t time_ticks[CONN_PROFILE_COUNT]; // app_timer ticks spent in each profile while connected
+} conn_policy_stats_t;
+
+void conn_policy_init(void);
+void conn_policy_on_connected(uint16_t conn_handle);
+void conn_policy_on_disconnected(void);
+void conn_policy_traffic(void);
+bool conn_policy_on_conn_params_evt(ble_conn_params_evt_t const* p_evt);
+conn_profile_t conn_policy_profile_get(void);
+conn_policy_stats_t const* conn_policy_stats_get(void);
+#endif
@@ -5,6 +5,22 @@
 #include "nrf_crypto_ecc.h"
 #include "nrf_crypto_error.h"
 #include "nrf_crypto_ecdsa.h"
+#include "ecdsa.h"
+
+/* Device key parsed once at boot, so a signature request needs neither a flash read nor
+ * nrf_crypto_ecc_private_key_from_raw. Only this file sees the private key object. */
+typedef struct {
+    bool valid;
+    bool locked;
+    nrf_crypto_ecc_private_key_t private_key;
+    uint8_t public_key[64];
+} ecdsa_key_cache_t;
+
+static ecdsa_key_cache_t m_key_cache;
+
+/* Message of a streamed signature, hashed as it arrives so its length is not bounded by RAM. */
+static nrf_crypto_hash_context_t m_sign_hash_context;
+static bool m_sign_session = false;
 
 ret_code_t generate_ecdsa_keypair(uint8_t *pri_key, uint8_t *pubkey){
     ret_code_t  err_code = NRF_SUCCESS;
@@ -45,57 +61,190 @@ ret_code_t generate_ecdsa_keypair(uint8_t *pri_key, uint8_t *pubkey){
 
 }
 
-ret_code_t sign_ecdsa(uint8_t *pri_key, uint8_t *hash, uint8_t *signature){
+static ret_code_t ecdsa_sign_hash(nrf_crypto_ecc_private_key_t const *p_private_key, uint8_t const *hash, uint8_t *signature){
     ret_code_t  err_code = NRF_SUCCESS;
     nrf_crypto_ecdsa_sign_context_t context;
     size_t signature_size = 64;
+
+    uint8_t sign[64],hash1[32];
+
+    nrf_crypto_internal_swap_endian(hash1,hash,32);
+
+    err_code = nrf_crypto_ecdsa_sign(&context,
+                                     p_private_key,
+                                     hash1,
+                                     32,
+                                     sign,
+                                     &signature_size);
+    if(err_code != NRF_SUCCESS){
+        return err_code;
+    }
+    nrf_crypto_internal_double_swap_endian(signature,sign,32);
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ecdsa_hash_msg(uint8_t const *msg, uint32_t msg_len, uint8_t *hash){
+    nrf_crypto_hash_context_t hash_context = {0};
+    size_t hash_len = 32;
+
+    return nrf_crypto_hash_calculate(&hash_context,
+                                     &g_nrf_crypto_hash_sha256_info,
+                                     msg,
+                                     msg_len,
+                                     hash,
+                                     &hash_len);
+}
+
+ret_code_t sign_ecdsa(uint8_t *pri_key, uint8_t *hash, uint8_t *signature){
+    ret_code_t  err_code = NRF_SUCCESS;
     nrf_crypto_ecc_private_key_t private_key;
-    
-    uint8_t sk[32],sign[64],hash1[32];
-    
+
+    uint8_t sk[32];
+
     nrf_crypto_internal_swap_endian(sk,pri_key,32);
-    nrf_crypto_internal_swap_endian(hash1,hash,32);
 
     err_code = nrf_crypto_ecc_private_key_from_raw(&g_nrf_crypto_ecc_secp256k1_curve_info,
                                                    &private_key,
                                                    sk,
                                                    32);
+    memset(sk,0,sizeof(sk));
     if(err_code != NRF_SUCCESS){
         return err_code;
     }
 
-    err_code = nrf_crypto_ecdsa_sign(&context,
-                                     &private_key,
-                                     hash1,
-                                     32,
-                                     sign,
-                                     &signature_size);
+    err_code = ecdsa_sign_hash(&private_key,hash,signature);
+    nrf_crypto_ecc_private_key_free(&private_key);
+    return err_code;
+}
+
+ret_code_t sign_ecdsa_msg(uint8_t *pri_key, uint8_t *msg, uint32_t msg_len, uint8_t *signature){
+    ret_code_t  err_code = NRF_SUCCESS;
+    uint8_t hash[32];
+
+    err_code = ecdsa_hash_msg(msg,msg_len,hash);
+    if(err_code != NRF_SUCCESS){
+        return err_code;
+    }
+
+    err_code = sign_ecdsa(pri_key,hash,signature);
     if(err_code != NRF_SUCCESS){
         return err_code;
     }
-    nrf_crypto_internal_double_swap_endian(signature,sign,32);
     return NRF_SUCCESS;
 }
 
-ret_code_t sign_ecdsa_msg(uint8_t *pri_key, uint8_t *msg, uint32_t msg_len, uint8_t *signature){
+/* Parses the stored key pair (big endian, as kept in flash) into the cache. Called once at
+ * boot, the raw private key is not kept. */
+ret_code_t ecdsa_key_cache_load(uint8_t const *pri_key, uint8_t const *pubkey, bool locked){
+    ret_code_t  err_code = NRF_SUCCESS;
+    uint8_t sk[32];
+
+    if(m_key_cache.valid){
+        nrf_crypto_ecc_private_key_free(&m_key_cache.private_key);
+    }
+    memset(&m_key_cache,0,sizeof(m_key_cache));
+
+    nrf_crypto_internal_swap_endian(sk,pri_key,32);
+    err_code = nrf_crypto_ecc_private_key_from_raw(&g_nrf_crypto_ecc_secp256k1_curve_info,
+                                                   &m_key_cache.private_key,
+                                                   sk,
+                                                   32);
+    memset(sk,0,sizeof(sk));
+    if(err_code != NRF_SUCCESS){
+        return err_code;
+    }
+
+    memcpy(m_key_cache.public_key,pubkey,sizeof(m_key_cache.public_key));
+    m_key_cache.locked = locked;
+    m_key_cache.valid = true;
+    return NRF_SUCCESS;
+}
+
+/* Mirrors a key_lock_flag written to flash, the key itself does not change. */
+void ecdsa_key_cache_lock(void){
+    m_key_cache.locked = true;
+}
+
+bool ecdsa_key_cache_valid(void){
+    return m_key_cache.valid;
+}
+
+bool ecdsa_key_cache_locked(void){
+    return m_key_cache.locked;
+}
+
+uint8_t const *ecdsa_key_cache_pubkey(void){
+    return m_key_cache.public_key;
+}
+
+ret_code_t ecdsa_key_cache_sign_msg(uint8_t const *msg, uint32_t msg_len, uint8_t *signature){
     ret_code_t  err_code = NRF_SUCCESS;
-    nrf_crypto_hash_context_t hash_context = {0};
     uint8_t hash[32];
-    size_t hash_len = 32;
 
-    err_code = nrf_crypto_hash_calculate(&hash_context,
-                                         &g_nrf_crypto_hash_sha256_info,
-                                         msg,
-                                         msg_len,
-                                         hash,
-                                         &hash_len);
+    if(!m_key_cache.valid){
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    err_code = ecdsa_hash_msg(msg,msg_len,hash);
     if(err_code != NRF_SUCCESS){
         return err_code;
     }
+    return ecdsa_sign_hash(&m_key_cache.private_key,hash,signature);
+}
 
-    err_code = sign_ecdsa(pri_key,hash,signature);
+/* Signs a 32 byte digest (big endian, as output by SHA-256) with the cached key. */
+ret_code_t ecdsa_key_cache_sign_hash(uint8_t const *hash, uint8_t *signature){
+    if(!m_key_cache.valid){
+        return NRF_ERROR_INVALID_STATE;
+    }
+    return ecdsa_sign_hash(&m_key_cache.private_key,hash,signature);
+}
+
+/* Starts a streamed signature with the cached key, dropping one left unfinished. */
+ret_code_t ecdsa_key_cache_sign_begin(void){
+    ret_code_t  err_code = NRF_SUCCESS;
+
+    m_sign_session = false;
+    if(!m_key_cache.valid){
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    err_code = nrf_crypto_hash_init(&m_sign_hash_context,&g_nrf_crypto_hash_sha256_info);
     if(err_code != NRF_SUCCESS){
         return err_code;
     }
+    m_sign_session = true;
     return NRF_SUCCESS;
 }
+
+ret_code_t ecdsa_key_cache_sign_update(uint8_t const *msg, uint32_t msg_len){
+    ret_code_t  err_code = NRF_SUCCESS;
+
+    if(!m_sign_session){
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    err_code = nrf_crypto_hash_update(&m_sign_hash_context,msg,msg_len);
+    if(err_code != NRF_SUCCESS){
+        m_sign_session = false;
+    }
+    return err_code;
+}
+
+/* Signs everything fed since ecdsa_key_cache_sign_begin and closes the session. */
+ret_code_t ecdsa_key_cache_sign_finalize(uint8_t *signature){
+    ret_code_t  err_code = NRF_SUCCESS;
+    uint8_t hash[32];
+    size_t hash_len = 32;
+
+    if(!m_sign_session){
+        return NRF_ERROR_INVALID_STATE;
+    }
+    m_sign_session = false;
+
+    err_code = nrf_crypto_hash_finalize(&m_sign_hash_context,hash,&hash_len);
+    if(err_code != NRF_SUCCESS){
+        return err_code;
+    }
+    return ecdsa_sign_hash(&m_key_cache.private_key,hash,signature);
+}
@@ -12,4 +12,15 @@ ret_code_t generate_ecdsa_keypair(uint8_t *pri_key, uint8_t *pubkey);
 ret_code_t sign_ecdsa(uint8_t *pri_key, uint8_t *hash, uint8_t *signature);
 ret_code_t sign_ecdsa_msg(uint8_t *pri_key, uint8_t *msg, uint32_t msg_len, uint8_t *signature);
 
+ret_code_t ecdsa_key_cache_load(uint8_t const *pri_key, uint8_t const *pubkey, bool locked);
+void ecdsa_key_cache_lock(void);
+bool ecdsa_key_cache_valid(void);
+bool ecdsa_key_cache_locked(void);
+uint8_t const *ecdsa_key_cache_pubkey(void);
+ret_code_t ecdsa_key_cache_sign_msg(uint8_t const *msg, uint32_t msg_len, uint8_t *signature);
+ret_code_t ecdsa_key_cache_sign_hash(uint8_t const *hash, uint8_t *signature);
+ret_code_t ecdsa_key_cache_sign_begin(void);
+ret_code_t ecdsa_key_cache_sign_update(uint8_t const *msg, uint32_t msg_len);
+ret_code_t ecdsa_key_cache_sign_finalize(uint8_t *signature);
+
 #endif
@@ -4,6 +4,8 @@
 static uint8_t* ble_fido_send_buf;
 static uint16_t ble_fido_send_len, ble_fido_send_offset;
 static uint8_t fido_sequence_number;
+static bool ble_fido_send_head; // first packet of the response not queued yet, TX_RDY waits for it
+static uint8_t fido_recv_sequence_number; // not the TX one, an idle TX_RDY resets that mid-request
 
 static uint8_t fido_recv_buf[1024];
 static uint8_t fido_data_state = FIDO_DATA_STATE_IDLE;
@@ -36,7 +38,14 @@ static void fido_data_handler(ble_fido_evt_t* p_evt)
     {
         if(fido_data_state == FIDO_DATA_STATE_IDLE)
         {
-            fido_sequence_number = 0;
+            // fido_recv_buf is read in place by the TWI, refuse a new message while the last one
+            // is still queued. The client retries once it gets no response.
+            if(i2c_tx_busy(fido_recv_buf))
+            {
+                NRF_LOG_WARNING("FIDO rx buffer busy, drop message");
+                return;
+            }
+            fido_recv_sequence_number = 0;
             fido_recv_len = rcv_data[1] << 8 | rcv_data[2];
             if(fido_recv_len > rcv_len - 3)
             {
@@ -47,20 +56,24 @@ static void fido_data_handler(ble_fido_evt_t* p_evt)
                 memcpy(fido_recv_buf, rcv_data, rcv_len);
                 fido_recv_offset = rcv_len;
                 fido_data_state = FIDO_DATA_STATE_RECV;
+                conn_policy_traffic();
             }
             else
             {
-                i2c_master_write_fido(rcv_data, rcv_len);
+                // rcv_data belongs to the SoftDevice event, the TWI needs a buffer that outlives it.
+                memcpy(fido_recv_buf, rcv_data, rcv_len);
+                i2c_master_write_fido(fido_recv_buf, rcv_len);
             }
         }
         else if(fido_data_state == FIDO_DATA_STATE_RECV)
         {
-            if(rcv_data[0] == fido_sequence_number)
+            conn_policy_traffic();
+            if(rcv_data[0] == fido_recv_sequence_number)
             {
-                fido_sequence_number++;
+                fido_recv_sequence_number++;
                 memcpy(fido_recv_buf + fido_recv_offset, rcv_data + 1, rcv_len - 1);
                 fido_recv_offset += rcv_len - 1;
-                if(fido_recv_offset >= fido_recv_len - 3)
+                if(fido_recv_offset >= fido_recv_len + 3)
                 {
                     fido_data_state = FIDO_DATA_STATE_IDLE;
                     i2c_master_write_fido(fido_recv_buf, fido_recv_len + 3);
@@ -72,7 +85,7 @@ static void fido_data_handler(ble_fido_evt_t* p_evt)
             }
         }
     }
-    else if(p_evt->type == BLE_FIDO_EVT_TX_RDY)
+    else if((p_evt->type == BLE_FIDO_EVT_TX_RDY) && !ble_fido_send_head)
     {
         uint8_t fido_packet[BLE_FIDO_MAX_DATA_LEN];
         uint16_t length = ble_fido_send_len - ble_fido_send_offset;
@@ -83,6 +96,11 @@ static void fido_data_handler(ble_fido_evt_t* p_evt)
             memcpy(fido_packet + 1, ble_fido_send_buf + ble_fido_send_offset, length);
             ble_fido_send_packet(fido_packet, length + 1);
             ble_fido_send_offset += length;
+            if(ble_fido_send_offset >= ble_fido_send_len)
+            {
+                // Everything is in SoftDevice buffers, the source can be reused.
+                i2c_rx_release(ble_fido_send_buf);
+            }
         }
         else
         {
@@ -95,15 +113,26 @@ static void fido_data_handler(ble_fido_evt_t* p_evt)
 
 void ble_fido_send(uint8_t* data, uint16_t data_len)
 {
-    ret_code_t err_code;
     uint16_t length = 0;
-    uint16_t offset = 0;
 
     if(data_len == 0)
     {
         return;
     }
 
+    if(data_len > m_ble_gatt_max_data_len)
+    {
+        conn_policy_traffic();
+    }
+
+    if(ble_fido_send_offset < ble_fido_send_len)
+    {
+        // A new response replaces one still being sent.
+        i2c_rx_release(ble_fido_send_buf);
+    }
+    // ble_fido_send_packet() lets SoftDevice events in while it waits for a buffer, a TX_RDY of
+    // another notification must not send the next packet ahead of the first one.
+    ble_fido_send_head = true;
     ble_fido_send_buf = data;
     ble_fido_send_len = data_len;
     fido_sequence_number = 0;
@@ -111,4 +140,20 @@ void ble_fido_send(uint8_t* data, uint16_t data_len)
     length = ble_fido_send_len > m_ble_gatt_max_data_len ? m_ble_gatt_max_data_len : ble_fido_send_len;
     ble_fido_send_offset = length;
     ble_fido_send_packet(ble_fido_send_buf, length);
+    ble_fido_send_head = false;
+    if(ble_fido_send_offset >= ble_fido_send_len)
+    {
+        i2c_rx_release(ble_fido_send_buf);
+    }
+}
+
+void ble_fido_tx_reset(void)
+{
+    if(ble_fido_send_offset < ble_fido_send_len)
+    {
+        i2c_rx_release(ble_fido_send_buf);
+    }
+    ble_fido_send_len = 0;
+    ble_fido_send_offset = 0;
+    fido_sequence_number = 0;
 }
\ No newline at end of file
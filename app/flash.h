@@ -3,12 +3,77 @@ static uint32_t m_data2 = 0xBADC0FFE;
 static uint32_t m_data = 0xABABABAB;
 #define STORAGE_TRUE_FLAG 0xa55aa55a
 
-#define BLE_CTL_ADDR         0x6f000
-#define BAT_LVL_ADDR         0x70000
 #define DEVICE_KEY_INFO_ADDR 0x71000
 
+static void fstorage_evt_handler(nrf_fstorage_evt_t* p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t fstorage) =
+{
+    /* Set a handler for fstorage events. */
+    .evt_handler = fstorage_evt_handler,
+
+    /* These below are the boundaries of the flash space assigned to this instance of fstorage.
+     * You must set these manually, even at runtime, before nrf_fstorage_init() is called.
+     * The function nrf5_flash_end_addr_get() can be used to retrieve the last address on the
+     * last page of flash available to write data. */
+    .start_addr = 0x71000,
+    .end_addr   = 0x72000,
+};
+
+// Page image written by device_key_lock(), it is the source of the write until it completes.
+static ecdsa_key_info_t device_key_lock_info;
+static app_sched_event_handler_t device_key_lock_done = NULL;
+static bool device_key_lock_success;
+
+/**@brief Function for advancing the key page rewrite started by device_key_lock().
+ *
+ * @details The write is issued once the erase has completed. The result is handed over through
+ *          main_evt, which keeps the request should the scheduler be full.
+ */
+static void device_key_lock_evt(nrf_fstorage_evt_t* p_evt)
+{
+    ret_code_t rc;
+
+    if((p_evt->result == NRF_SUCCESS) && (p_evt->id == NRF_FSTORAGE_EVT_ERASE_RESULT))
+    {
+        rc = nrf_fstorage_write(&fstorage, DEVICE_KEY_INFO_ADDR, &device_key_lock_info, sizeof(ecdsa_key_info_t), NULL);
+        if(rc == NRF_SUCCESS)
+        {
+            return;
+        }
+    }
+
+    device_key_lock_success = (p_evt->result == NRF_SUCCESS) && (p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT);
+    memset(&device_key_lock_info, 0, sizeof(device_key_lock_info));
+    main_evt_post(MAIN_EVT_KEY_LOCK);
+}
+
+/**@brief Function for running the done handler of device_key_lock(), from the scheduler.
+ *
+ * @details The lock stays busy until now, so a new one cannot overwrite the result.
+ */
+static void device_key_lock_finish(void* p_event_data, uint16_t event_size)
+{
+    app_sched_event_handler_t done = device_key_lock_done;
+    bool success = device_key_lock_success;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    if(done != NULL)
+    {
+        device_key_lock_done = NULL;
+        done(&success, sizeof(success));
+    }
+}
+
 static void fstorage_evt_handler(nrf_fstorage_evt_t* p_evt)
 {
+    if((device_key_lock_done != NULL) && (p_evt->addr == DEVICE_KEY_INFO_ADDR))
+    {
+        device_key_lock_evt(p_evt);
+    }
+
     if(p_evt->result != NRF_SUCCESS)
     {
         NRF_LOG_INFO("--> Event received: ERROR while executing an fstorage operation.");
@@ -36,19 +101,6 @@ static void fstorage_evt_handler(nrf_fstorage_evt_t* p_evt)
     }
 }
 
-NRF_FSTORAGE_DEF(nrf_fstorage_t fstorage) =
-{
-    /* Set a handler for fstorage events. */
-    .evt_handler = fstorage_evt_handler,
-
-    /* These below are the boundaries of the flash space assigned to this instance of fstorage.
-     * You must set these manually, even at runtime, before nrf_fstorage_init() is called.
-     * The function nrf5_flash_end_addr_get() can be used to retrieve the last address on the
-     * last page of flash available to write data. */
-    .start_addr = 0x6f000,
-    .end_addr   = 0x72000,
-};
-
 /**@brief   Helper function to obtain the last address on the last page of the on-chip flash that
  *          can be used to write user data.
  */
@@ -69,18 +121,6 @@ void wait_for_flash_ready(nrf_fstorage_t const* p_fstorage)
     }
 }
 
-static void flash_data_write(uint32_t address, uint32_t data)
-{
-    ret_code_t rc;
-
-    nrf_fstorage_erase(&fstorage, address, FDS_PHY_PAGES_IN_VPAGE, NULL);
-
-    rc = nrf_fstorage_write(&fstorage, address, &data, sizeof(m_data), NULL);
-    APP_ERROR_CHECK(rc);
-
-    wait_for_flash_ready(&fstorage);
-}
-
 static void device_key_info_init(void)
 {
     ret_code_t rc;
@@ -99,6 +139,33 @@ static void device_key_info_init(void)
 
         wait_for_flash_ready(&fstorage);
     }
+
+    rc = ecdsa_key_cache_load(key_info.private_key, key_info.public_key,
+                              key_info.key_lock_flag == STORAGE_TRUE_FLAG);
+    APP_ERROR_CHECK(rc);
+    memset(&key_info, 0, sizeof(key_info));
+}
+
+static bool device_key_lock_busy(void)
+{
+    return device_key_lock_done != NULL;
+}
+
+/**@brief Function for setting the lock flag of the device key page without waiting for flash.
+ *
+ * @details The page is read back, erased and rewritten in the background. done is run from
+ *          the scheduler with a bool telling whether the flag reached flash.
+ */
+static void device_key_lock(app_sched_event_handler_t done)
+{
+    ret_code_t rc;
+
+    nrf_fstorage_read(&fstorage, DEVICE_KEY_INFO_ADDR, &device_key_lock_info, sizeof(ecdsa_key_info_t));
+    device_key_lock_info.key_lock_flag = STORAGE_TRUE_FLAG;
+    device_key_lock_done = done;
+
+    rc = nrf_fstorage_erase(&fstorage, DEVICE_KEY_INFO_ADDR, FDS_PHY_PAGES_IN_VPAGE, NULL);
+    APP_ERROR_CHECK(rc);
 }
 
 static void fs_init(void)
@@ -117,20 +184,18 @@ static void fs_init(void)
      * store data. */
     (void)nrf5_flash_end_addr_get();
 
-    // flash_data_write(BLE_CTL_FLAG,m_data);
+    // BLE control flag and battery level live in the settings log.
+    settings_init();
 }
 
 uint8_t get_ble_ctl_flag(void)
 {
-    uint32_t len = 4;
-    uint8_t data[4];
-    nrf_fstorage_read(&fstorage, BLE_CTL_ADDR, data, len);
-    if(((0xFF == data[0]) && (0xFF == data[1]) && (0xFF == data[2]) && (0xFF == data[3])) ||
-       ((0xFE == data[0]) && (0x0F == data[1]) && (0xDC == data[2]) && (0xBA == data[3])))
+    uint32_t value;
+    if(!settings_get(SETTINGS_KEY_BLE_CTL, &value) || (value == m_data2))
     {
         return BLE_ON_ALWAYS;
     }
-    else if((0xAB == data[0]) && (0xAB == data[1]) && (0xAB == data[2]) && (0xAB == data[3]))
+    else if(value == m_data)
     {
         return BLE_OFF_ALWAYS;
     }
@@ -142,5 +207,5 @@ uint8_t get_ble_ctl_flag(void)
 
 void set_ble_ctl_flag(bool flag)
 {
-    flash_data_write(BLE_CTL_ADDR, flag ? m_data2 : m_data);
+    settings_set(SETTINGS_KEY_BLE_CTL, flag ? m_data2 : m_data);
 }
@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_timer.h"
+#include "nrf_crypto.h"
+#include "sdk_config.h"
+
+#include "nrf_log_default_backends.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log.h"
+
+#include "fw_hash.h"
+
+#define FW_HASH_STEP_INTERVAL APP_TIMER_TICKS(FW_HASH_STEP_MS)
+
+APP_TIMER_DEF(m_hash_timer_id);
+
+static nrf_crypto_hash_context_t m_hash_context;
+static uint8_t m_hash[32];
+static uint32_t m_key;    // bootloader settings crc the digest belongs to
+static uint32_t m_size;   // application image size
+static uint32_t m_offset; // bytes hashed so far
+static bool m_running = false;
+static bool m_ready = false;
+
+static uint32_t settings_crc_get(void)
+{
+    return *(uint32_t const*)FW_HASH_SETTINGS_ADDR;
+}
+
+static void hash_begin(void)
+{
+    ret_code_t err_code;
+    uint8_t const* code_len = (uint8_t const*)FW_HASH_APP_SIZE_ADDR;
+
+    m_key = settings_crc_get();
+    m_size = code_len[0] + code_len[1] * 256 + code_len[2] * 256 * 256;
+    m_offset = 0;
+    m_ready = false;
+    m_running = true;
+
+    err_code = nrf_crypto_hash_init(&m_hash_context, &g_nrf_crypto_hash_sha256_info);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for hashing the next chunk of the image.
+ *
+ * @return true once the digest is complete.
+ */
+static bool hash_step(void)
+{
+    ret_code_t err_code;
+    uint32_t len = m_size - m_offset;
+    size_t hash_len = sizeof(m_hash);
+
+    if(len > FW_HASH_CHUNK_SIZE)
+    {
+        len = FW_HASH_CHUNK_SIZE;
+    }
+    if(len > 0)
+    {
+        err_code = nrf_crypto_hash_update(&m_hash_context, (uint8_t const*)FW_HASH_APP_ADDR + m_offset, len);
+        APP_ERROR_CHECK(err_code);
+        m_offset += len;
+    }
+    if(m_offset < m_size)
+    {
+        return false;
+    }
+
+    err_code = nrf_crypto_hash_finalize(&m_hash_context, m_hash, &hash_len);
+    APP_ERROR_CHECK(err_code);
+    m_running = false;
+    m_ready = true;
+    NRF_LOG_INFO("Firmware hash ready, %d bytes", m_size);
+    return true;
+}
+
+static void hash_timer_start(void)
+{
+    ret_code_t err_code = app_timer_start(m_hash_timer_id, FW_HASH_STEP_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void hash_sched_handler(void* p_event_data, uint16_t event_size)
+{
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    // A request may have finished the digest synchronously in the meantime.
+    if(!m_running || hash_step())
+    {
+        return;
+    }
+    hash_timer_start();
+}
+
+// Runs in the RTC1 interrupt, the chunk is hashed from the scheduler.
+static void hash_timeout_handler(void* p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if(app_sched_event_put(NULL, 0, hash_sched_handler) != NRF_SUCCESS)
+    {
+        // Queue full, try again after another interval.
+        hash_timer_start();
+    }
+}
+
+/**@brief Function for starting the background computation of the application digest.
+ *
+ * @details One chunk is hashed every FW_HASH_STEP_MS from a single shot timer, so the
+ *          scheduler passes in between run the other events and the CPU sleeps between chunks.
+ *          Must be called after nrf_crypto_init() and timers_init().
+ */
+void fw_hash_start(void)
+{
+    ret_code_t err_code;
+
+    err_code = app_timer_create(&m_hash_timer_id, APP_TIMER_MODE_SINGLE_SHOT, hash_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    hash_begin();
+    hash_timer_start();
+}
+
+/**@brief Function for getting the SHA-256 digest of the application image.
+ *
+ * @details Answers from RAM when the cached digest still matches the bootloader settings,
+ *          otherwise the remaining work is done here before returning.
+ *
+ * @param[out] hash  32 bytes digest.
+ */
+void fw_hash_get(uint8_t* hash)
+{
+    if((m_ready || m_running) && (m_key != settings_crc_get()))
+    {
+        m_ready = false;
+        m_running = false;
+    }
+    if(!m_ready)
+    {
+        if(!m_running)
+        {
+            hash_begin();
+        }
+        while(!hash_step())
+        {
+        }
+    }
+    memcpy(hash, m_hash, sizeof(m_hash));
+}
+
+bool fw_hash_ready(void)
+{
+    return m_ready;
+}
@@ -0,0 +1,24 @@
+#ifndef __NORDIC_52832_FW_HASH_
+#define __NORDIC_52832_FW_HASH_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FW_HASH_APP_ADDR      0x26000 // application start
+#define FW_HASH_SETTINGS_ADDR 0x7F000 // bootloader settings, crc first
+#define FW_HASH_APP_SIZE_ADDR 0x7F018 // bank0 image size in the bootloader settings
+
+// Bytes hashed per step while the digest is computed in the background.
+#ifndef FW_HASH_CHUNK_SIZE
+#define FW_HASH_CHUNK_SIZE 4096
+#endif
+
+// Time between two steps, a 320 KB image takes 80 steps, well under a second.
+#ifndef FW_HASH_STEP_MS
+#define FW_HASH_STEP_MS 5
+#endif
+
+void fw_hash_start(void);
+void fw_hash_get(uint8_t* hash);
+bool fw_hash_ready(void);
+#endif
@@ -4,6 +4,8 @@
 #include "app_error.h"
 #include "app_fifo.h"
 #include "app_uart.h"
+#include "app_scheduler.h"
+#include "app_util_platform.h"
 #include "boards.h"
 #include "nrf_drv_twi.h"
 #include "sdk_config.h"
@@ -12,10 +14,12 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log.h"
 
-#include "nrf_delay.h"
-
 #include "i2c.h"
 
+// nus.h and fido.h, built into main.c.
+void ble_nus_send(uint8_t* data, uint16_t data_len);
+void ble_fido_send(uint8_t* data, uint16_t data_len);
+
 enum
 {
     READSTATE_IDLE,
@@ -26,17 +30,41 @@ enum
     READSTATE_READ_FIDO_DATA,
 };
 
+#define I2C_RX_BUF_NUM 2 // one slot draining over BLE while the next response is read
+
 typedef struct
 {
     bool flag;
+    bool in_use; // handed to ble_nus_send/ble_fido_send, owned by BLE until i2c_rx_release()
+    bool post;   // complete, the scheduler was full and the hand over to BLE is still to be posted
     uint8_t data_type;
     uint8_t data[1024 * 3];
     uint16_t len;
 } i2c_data_buffer_t;
 
-static i2c_data_buffer_t i2c_data_buf = {false, {0}, 0, 0};
+static i2c_data_buffer_t i2c_data_buf[I2C_RX_BUF_NUM];
+static i2c_data_buffer_t* volatile i2c_rx_fill = &i2c_data_buf[0]; // slot the running read writes to
+static i2c_data_buffer_t* volatile i2c_rx_done = &i2c_data_buf[0]; // slot of the last completed read
+static volatile bool i2c_rx_wait_slot = false;
 
-static uint8_t i2c_buf_dma[255];
+#define I2C_TX_CHUNK_MAX 255 // TWIM EasyDMA MAXCNT is 8 bits
+#define I2C_TX_DESC_NUM  40  // a full NUS receive ring, or a 3 KB message, and a few small ones
+
+// One TWIM transfer of a queued message. The source stays owned by the caller and must be
+// RAM resident and unchanged until i2c_tx_busy() reports the message's buffer as free.
+typedef struct
+{
+    uint8_t const* p_data;
+    uint8_t const* p_msg; // caller's buffer the chunk belongs to, header chunks included
+    uint8_t len;
+    bool no_stop; // false on the last chunk of a message
+} i2c_tx_desc_t;
+
+static i2c_tx_desc_t i2c_tx_desc[I2C_TX_DESC_NUM];
+static volatile uint8_t i2c_tx_head, i2c_tx_count;
+static volatile bool i2c_rx_pending = false;
+static volatile bool i2c_rx_to_ble = false; // read started by twi_read_data, forward the response over BLE
+static uint8_t i2c_fido_tag[3] = {'f', 'i', 'd'}; // not const, EasyDMA can only read RAM
 
 // TWI driver
 static volatile bool twi_xfer_done = false;
@@ -44,18 +72,18 @@ static uint8_t twi_xfer_dir = 0; // 0-write 1-read
 
 void get_i2c_data(uint8_t** data, uint16_t* len)
 {
-    *data = i2c_data_buf.data;
-    *len = i2c_data_buf.len;
+    *data = i2c_rx_done->data;
+    *len = i2c_rx_done->len;
 }
 
 bool get_i2c_data_flag(void)
 {
-    return i2c_data_buf.flag;
+    return i2c_rx_done->flag;
 }
 
 void set_i2c_data_flag(bool flag)
 {
-    i2c_data_buf.flag = flag;
+    i2c_rx_done->flag = flag;
 }
 
 /**
@@ -66,12 +94,21 @@ void set_i2c_data_flag(bool flag)
  */
 static const nrf_drv_twi_t m_twi_master = NRF_DRV_TWI_INSTANCE(MASTER_TWI_INST);
 
+static void i2c_read_done(uint8_t data_type);
+static void i2c_read_abort(void);
+static bool i2c_rx_start(void);
+static void i2c_tx_start(void);
+static void i2c_tx_retire(bool success);
+static void i2c_tx_complete(bool success);
+
 static void twi_handler(nrf_drv_twi_evt_t const* p_event, void* p_context)
 {
     static uint8_t read_state = READSTATE_IDLE;
     static uint32_t data_len = 0;
     uint32_t len;
 
+    UNUSED_PARAMETER(p_context);
+
     switch(p_event->type)
     {
         case NRF_DRV_TWI_EVT_DONE:
@@ -80,39 +117,43 @@ static void twi_handler(nrf_drv_twi_evt_t const* p_event, void* p_context)
             {
                 if(read_state == READSTATE_IDLE)
                 {
-                    if(i2c_data_buf.data[0] == '?' && i2c_data_buf.data[1] == '#' && i2c_data_buf.data[2] == '#')
+                    if(i2c_rx_fill->data[0] == '?' && i2c_rx_fill->data[1] == '#' && i2c_rx_fill->data[2] == '#')
                     {
                         read_state = READSTATE_READ_INFO;
-                        i2c_data_buf.len = 3;
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, 6); // read id+len bytes len
+                        i2c_rx_fill->len = 3;
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, 6); // read id+len bytes len
                     }
-                    else if(i2c_data_buf.data[0] == 'f' && i2c_data_buf.data[1] == 'i' && i2c_data_buf.data[2] == 'd')
+                    else if(i2c_rx_fill->data[0] == 'f' && i2c_rx_fill->data[1] == 'i' && i2c_rx_fill->data[2] == 'd')
                     {
                         read_state = READSTATE_READ_FIDO_STATUS;
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data, 1); // read status
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data, 1); // read status
+                    }
+                    else
+                    {
+                        i2c_read_abort();
                     }
                 }
                 else if(read_state == READSTATE_READ_INFO)
                 {
-                    i2c_data_buf.len += 6;
-                    data_len = ((uint32_t)i2c_data_buf.data[5] << 24) + (i2c_data_buf.data[6] << 16) + (i2c_data_buf.data[7] << 8) + i2c_data_buf.data[8];
-                    if(data_len > sizeof(i2c_data_buf.data))
+                    i2c_rx_fill->len += 6;
+                    data_len = ((uint32_t)i2c_rx_fill->data[5] << 24) + (i2c_rx_fill->data[6] << 16) + (i2c_rx_fill->data[7] << 8) + i2c_rx_fill->data[8];
+                    if(data_len > sizeof(i2c_rx_fill->data) - i2c_rx_fill->len) // after the header
                     {
+                        i2c_read_abort();
                         read_state = READSTATE_IDLE;
-                        return;
+                        break;
                     }
                     len = data_len > 255 ? 255 : data_len;
                     if(len > 0)
                     {
                         read_state = READSTATE_READ_DATA;
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, len); // read id+len bytes len
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, len); // read id+len bytes len
                         data_len -= len;
-                        i2c_data_buf.len += len;
+                        i2c_rx_fill->len += len;
                     }
                     else
                     {
-                        i2c_data_buf.flag = true;
-                        i2c_data_buf.data_type = DATA_TYPE_NUS;
+                        i2c_read_done(DATA_TYPE_NUS);
                         read_state = READSTATE_IDLE;
                     }
                 }
@@ -121,44 +162,43 @@ static void twi_handler(nrf_drv_twi_evt_t const* p_event, void* p_context)
                     len = data_len > 255 ? 255 : data_len;
                     if(len > 0)
                     {
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, len); // read id+len bytes len
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, len); // read id+len bytes len
                         data_len -= len;
-                        i2c_data_buf.len += len;
+                        i2c_rx_fill->len += len;
                     }
                     else
                     {
-                        i2c_data_buf.flag = true;
-                        i2c_data_buf.data_type = DATA_TYPE_NUS;
+                        i2c_read_done(DATA_TYPE_NUS);
                         read_state = READSTATE_IDLE;
                     }
                 }
                 else if(read_state == READSTATE_READ_FIDO_STATUS)
                 {
-                    i2c_data_buf.len = 1;
+                    i2c_rx_fill->len = 1;
                     read_state = READSTATE_READ_FIDO_LEN;
-                    nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, 2); // read len
+                    nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, 2); // read len
                 }
                 else if(read_state == READSTATE_READ_FIDO_LEN)
                 {
-                    i2c_data_buf.len += 2;
-                    data_len = ((uint32_t)i2c_data_buf.data[1] << 8) + i2c_data_buf.data[2];
-                    if(data_len > sizeof(i2c_data_buf.data))
+                    i2c_rx_fill->len += 2;
+                    data_len = ((uint32_t)i2c_rx_fill->data[1] << 8) + i2c_rx_fill->data[2];
+                    if(data_len > sizeof(i2c_rx_fill->data) - i2c_rx_fill->len) // after the header
                     {
+                        i2c_read_abort();
                         read_state = READSTATE_IDLE;
-                        return;
+                        break;
                     }
                     len = data_len > 255 ? 255 : data_len;
                     if(len > 0)
                     {
                         read_state = READSTATE_READ_FIDO_DATA;
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, len);
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, len);
                         data_len -= len;
-                        i2c_data_buf.len += len;
+                        i2c_rx_fill->len += len;
                     }
                     else
                     {
-                        i2c_data_buf.flag = true;
-                        i2c_data_buf.data_type = DATA_TYPE_FIDO;
+                        i2c_read_done(DATA_TYPE_FIDO);
                         read_state = READSTATE_IDLE;
                     }
                 }
@@ -167,29 +207,43 @@ static void twi_handler(nrf_drv_twi_evt_t const* p_event, void* p_context)
                     len = data_len > 255 ? 255 : data_len;
                     if(len > 0)
                     {
-                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + i2c_data_buf.len, len);
+                        nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_rx_fill->data + i2c_rx_fill->len, len);
                         data_len -= len;
-                        i2c_data_buf.len += len;
+                        i2c_rx_fill->len += len;
                     }
                     else
                     {
-                        i2c_data_buf.flag = true;
-                        i2c_data_buf.data_type = DATA_TYPE_FIDO;
+                        i2c_read_done(DATA_TYPE_FIDO);
                         read_state = READSTATE_IDLE;
                     }
                 }
             }
             else
             {
+                i2c_tx_complete(true);
             }
             break;
         case NRF_DRV_TWI_EVT_ADDRESS_NACK:
-            break;
         case NRF_DRV_TWI_EVT_DATA_NACK:
+            if(twi_xfer_dir == 0)
+            {
+                i2c_tx_complete(false);
+            }
+            else
+            {
+                i2c_read_abort();
+                read_state = READSTATE_IDLE;
+            }
             break;
         default:
             break;
     }
+
+    // Writes queued, or a read requested, while a read was running go out once it is over.
+    if((twi_xfer_dir == 1) && (read_state == READSTATE_IDLE) && ((i2c_tx_count > 0) || i2c_rx_pending))
+    {
+        i2c_tx_start();
+    }
 }
 
 /**
@@ -220,145 +274,373 @@ int twi_master_init(void)
     return ret;
 }
 
-bool i2c_master_write(uint8_t* buf, uint32_t len)
+/**@brief Function for starting the transfer at the head of the TX queue.
+ *
+ * @details Called with the queue protected, either from a critical region or from twi_handler.
+ *          A read requested while writes were queued is started once the queue is empty.
+ */
+static void i2c_tx_start(void)
 {
     ret_code_t err_code;
-    uint32_t offset = 0;
+    i2c_tx_desc_t const* p_desc;
 
-    twi_xfer_dir = 0;
-    twi_xfer_done = false;
+    while(i2c_tx_count > 0)
+    {
+        p_desc = &i2c_tx_desc[i2c_tx_head];
+        twi_xfer_dir = 0;
+        twi_xfer_done = false;
+        err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, p_desc->p_data, p_desc->len, p_desc->no_stop);
+        if(err_code == NRF_SUCCESS)
+        {
+            return;
+        }
+        NRF_LOG_INFO("twi send error %d", err_code);
+        i2c_tx_retire(false);
+    }
+    if(i2c_rx_pending)
+    {
+        i2c_rx_pending = false;
+        if(!i2c_rx_start())
+        {
+            i2c_read_abort();
+        }
+    }
+}
 
-    NRF_LOG_INFO("twi send data len =%d", len);
-    while(len > 255)
+/**@brief Function for starting a read into a receive slot not owned by BLE.
+ *
+ * @details Called with the TWI idle and the state protected. When every slot is still draining
+ *          over BLE the read is parked and restarted by i2c_rx_release().
+ */
+static bool i2c_rx_start(void)
+{
+    i2c_data_buffer_t* p_slot = NULL;
+
+    // Prefer a slot other than the last completed one, its data may not be consumed yet.
+    for(uint8_t i = 0; i < I2C_RX_BUF_NUM; i++)
     {
-        while(nrf_drv_twi_is_busy(&m_twi_master))
-            ;
-        memcpy(i2c_buf_dma, buf + offset, 255);
-        err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, i2c_buf_dma, 255, true);
-        offset += 255;
-        len -= 255;
+        if(!i2c_data_buf[i].in_use && (p_slot == NULL || p_slot == i2c_rx_done))
+        {
+            p_slot = &i2c_data_buf[i];
+        }
     }
-    if(len)
+    if(p_slot == NULL)
     {
-        while(nrf_drv_twi_is_busy(&m_twi_master))
-            ;
-        memcpy(i2c_buf_dma, buf + offset, len);
-        err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, i2c_buf_dma, len, false);
+        i2c_rx_wait_slot = true;
+        return true;
     }
-    NRF_LOG_INFO("twi send data finish");
-    if(NRF_SUCCESS != err_code)
+
+    i2c_rx_fill = p_slot;
+    twi_xfer_dir = 1;
+    p_slot->len = 0;
+    return nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, p_slot->data, 3) == NRF_SUCCESS;
+}
+
+/**@brief Function for retiring the transfer at the head of the TX queue.
+ *
+ * @details On failure the remaining chunks of the same message are dropped, the slave would
+ *          otherwise see a truncated frame followed by unrelated data.
+ */
+static void i2c_tx_retire(bool success)
+{
+    bool last;
+
+    do
     {
-        return false;
+        last = !i2c_tx_desc[i2c_tx_head].no_stop;
+        i2c_tx_head = (i2c_tx_head + 1) % I2C_TX_DESC_NUM;
+        i2c_tx_count--;
+    } while(!success && !last && i2c_tx_count > 0);
+}
+
+static void i2c_tx_complete(bool success)
+{
+    i2c_tx_retire(success);
+    if(i2c_tx_count > 0 || i2c_rx_pending)
+    {
+        i2c_tx_start();
+    }
+}
+
+static bool i2c_tx_enqueue(uint8_t const* p_msg, uint8_t const* p_data, uint32_t len, bool last)
+{
+    i2c_tx_desc_t* p_desc;
+    uint32_t chunk;
+
+    while(len > 0)
+    {
+        if(i2c_tx_count >= I2C_TX_DESC_NUM)
+        {
+            return false;
+        }
+        chunk = len > I2C_TX_CHUNK_MAX ? I2C_TX_CHUNK_MAX : len;
+        len -= chunk;
+        p_desc = &i2c_tx_desc[(i2c_tx_head + i2c_tx_count) % I2C_TX_DESC_NUM];
+        p_desc->p_data = p_data;
+        p_desc->p_msg = p_msg;
+        p_desc->len = chunk;
+        p_desc->no_stop = (len > 0) || !last;
+        p_data += chunk;
+        i2c_tx_count++;
     }
     return true;
 }
 
+/**@brief Function for queueing one message, optionally preceded by a header, for the slave.
+ *
+ * @details Nothing is copied, the TWIM reads the chunks straight from the caller's buffers.
+ */
+static bool i2c_tx_queue(uint8_t const* p_head, uint32_t head_len, uint8_t const* buf, uint32_t len)
+{
+    bool result = false;
+    bool idle;
+    uint8_t count;
+
+    if(len == 0)
+    {
+        return false;
+    }
+
+    CRITICAL_REGION_ENTER();
+    count = i2c_tx_count;
+    idle = (count == 0) && !nrf_drv_twi_is_busy(&m_twi_master);
+    if(i2c_tx_enqueue(buf, p_head, head_len, false) && i2c_tx_enqueue(buf, buf, len, true))
+    {
+        result = true;
+        if(idle)
+        {
+            i2c_tx_start();
+        }
+    }
+    else
+    {
+        // Roll back a partially queued message.
+        i2c_tx_count = count;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if(!result)
+    {
+        NRF_LOG_INFO("twi tx queue full, drop %d bytes", len);
+    }
+    return result;
+}
+
+/**@brief Function for checking whether the TWI still has to read from a caller's buffer.
+ *
+ * @details A buffer is busy while any chunk of a message queued from it, the header included,
+ *          is not written out yet. It must not be refilled before this returns false.
+ */
+bool i2c_tx_busy(uint8_t const* p_buf)
+{
+    bool busy = false;
+
+    CRITICAL_REGION_ENTER();
+    for(uint8_t i = 0; i < i2c_tx_count; i++)
+    {
+        if(i2c_tx_desc[(i2c_tx_head + i) % I2C_TX_DESC_NUM].p_msg == p_buf)
+        {
+            busy = true;
+            break;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return busy;
+}
+
+bool i2c_master_write(uint8_t* buf, uint32_t len)
+{
+    NRF_LOG_INFO("twi send data len =%d", len);
+    return i2c_tx_queue(NULL, 0, buf, len);
+}
+
 bool i2c_master_write_ex(uint8_t* buf, uint8_t len, bool no_stop)
 {
-    ret_code_t err_code;
+    bool result = false;
+    uint8_t count;
 
-    twi_xfer_dir = 0;
-    twi_xfer_done = false;
     NRF_LOG_INFO("twi send data len =%d ,%d", len, no_stop);
-    while(nrf_drv_twi_is_busy(&m_twi_master))
-        ;
-    err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, buf, len, no_stop);
-    NRF_LOG_INFO("twi send data finish");
-    if(NRF_SUCCESS != err_code)
+    CRITICAL_REGION_ENTER();
+    count = i2c_tx_count;
+    if(i2c_tx_enqueue(buf, buf, len, !no_stop))
+    {
+        result = true;
+        if((count == 0) && !nrf_drv_twi_is_busy(&m_twi_master))
+        {
+            i2c_tx_start();
+        }
+    }
+    CRITICAL_REGION_EXIT();
+    if(!result)
     {
         NRF_LOG_INFO("twi send error");
-        return false;
     }
-    return true;
+    return result;
 }
 
 bool i2c_master_read(void)
 {
-    uint32_t offset = 0;
-    ret_code_t err_code;
+    bool result = true;
 
-    twi_xfer_dir = 1;
-    i2c_data_buf.len = 0;
-
-    err_code = nrf_drv_twi_rx(&m_twi_master, SLAVE_ADDR, i2c_data_buf.data + offset, 3);
-    if(NRF_SUCCESS != err_code)
+    CRITICAL_REGION_ENTER();
+    if((i2c_tx_count > 0) || nrf_drv_twi_is_busy(&m_twi_master))
     {
-        return false;
+        // Started by twi_handler once the queued writes are out.
+        i2c_rx_pending = true;
     }
-    return true;
+    else
+    {
+        result = i2c_rx_start();
+    }
+    CRITICAL_REGION_EXIT();
+
+    return result;
 }
 
 bool i2c_master_write_fido(uint8_t* buf, uint32_t len)
 {
-    ret_code_t err_code;
-    uint32_t offset = 0;
+    NRF_LOG_INFO("twi send fido data len =%d", len);
+    return i2c_tx_queue(i2c_fido_tag, sizeof(i2c_fido_tag), buf, len);
+}
 
-    twi_xfer_dir = 0;
-    twi_xfer_done = false;
+/**@brief Function for forwarding a completed response of the slave over BLE.
+ *
+ * @details Runs from the main loop, the SoftDevice can not be called at the TWI interrupt
+ *          priority.
+ */
+static void i2c_read_sched_handler(void* p_event_data, uint16_t event_size)
+{
+    i2c_data_buffer_t* p_slot = *(i2c_data_buffer_t**)p_event_data;
 
-    NRF_LOG_INFO("twi send fido data len =%d", len);
+    UNUSED_PARAMETER(event_size);
 
-    while(nrf_drv_twi_is_busy(&m_twi_master))
-        ;
-    memcpy(i2c_buf_dma, "fid", 3);
-    err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, i2c_buf_dma, 3, true);
-    if(NRF_SUCCESS != err_code)
+    p_slot->flag = false;
+    // response data, the slot comes back through i2c_rx_release() once it left the radio
+    if(p_slot->data_type == DATA_TYPE_FIDO)
     {
-        return false;
+        NRF_LOG_INFO("twi read fido data");
+        ble_fido_send(p_slot->data, p_slot->len);
     }
-
-    while(len > 255)
+    else
     {
-        while(nrf_drv_twi_is_busy(&m_twi_master))
-            ;
-        memcpy(i2c_buf_dma, buf + offset, 255);
-        err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, i2c_buf_dma, 255, true);
-        offset += 255;
-        len -= 255;
+        ble_nus_send(p_slot->data, p_slot->len);
     }
-    if(len)
+}
+
+static bool i2c_rx_post_slot(i2c_data_buffer_t* p_slot)
+{
+    if(p_slot->post)
     {
-        while(nrf_drv_twi_is_busy(&m_twi_master))
-            ;
-        memcpy(i2c_buf_dma, buf + offset, len);
-        err_code = nrf_drv_twi_tx(&m_twi_master, SLAVE_ADDR, i2c_buf_dma, len, false);
+        if(app_sched_event_put(&p_slot, sizeof(p_slot), i2c_read_sched_handler) != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING("twi read schedule full, retry later");
+            return false;
+        }
+        p_slot->post = false;
     }
-    if(NRF_SUCCESS != err_code)
+    return true;
+}
+
+/**@brief Function for posting the hand over of completed slots to BLE.
+ *
+ * @details Called with the slots protected. A slot other than the last completed one is older,
+ *          it is posted first so responses keep their order.
+ */
+static void i2c_rx_post(void)
+{
+    for(uint8_t i = 0; i < I2C_RX_BUF_NUM; i++)
     {
-        return false;
+        if((&i2c_data_buf[i] != i2c_rx_done) && !i2c_rx_post_slot(&i2c_data_buf[i]))
+        {
+            return;
+        }
     }
-    NRF_LOG_INFO("twi send fido data finish");
-    return true;
+    (void)i2c_rx_post_slot(i2c_rx_done);
 }
 
-void twi_read_data(void)
+/**@brief Function for retrying the hand over of responses the scheduler had no room for.
+ *
+ * @details Called from the main loop before the scheduler is drained, the queue has room again
+ *          by then.
+ */
+void i2c_rx_post_retry(void)
 {
-    uint32_t counter = 0;
-    uint8_t* data;
-    uint16_t len = 0;
+    CRITICAL_REGION_ENTER();
+    i2c_rx_post();
+    CRITICAL_REGION_EXIT();
+}
 
-    if(!i2c_master_read())
+/**@brief Function for completing a read, called from twi_handler once the last chunk landed.
+ *
+ * @details A response for BLE keeps its slot until it has been sent, also when the scheduler
+ *          is full and the post has to be retried.
+ */
+static void i2c_read_done(uint8_t data_type)
+{
+    i2c_data_buffer_t* p_slot = i2c_rx_fill;
+
+    p_slot->flag = true;
+    p_slot->data_type = data_type;
+    i2c_rx_done = p_slot;
+    if(i2c_rx_to_ble)
     {
-        NRF_LOG_INFO("twi read data error");
-        return;
+        i2c_rx_to_ble = false;
+        p_slot->in_use = true;
+        p_slot->post = true;
+        i2c_rx_post();
     }
-    while(false == get_i2c_data_flag())
+}
+
+/**@brief Function for ending a read that produced no response, called from twi_handler.
+ *
+ * @details Forgets where the response was meant to go, so a later read started for NFC is not
+ *          sent over BLE.
+ */
+static void i2c_read_abort(void)
+{
+    i2c_rx_to_ble = false;
+    NRF_LOG_INFO("twi read aborted");
+}
+
+/**@brief Function for giving a receive slot back once BLE no longer references it.
+ *
+ * @details Buffers that are not receive slots are ignored, so BLE senders can release every
+ *          buffer they are done with. A read parked for want of a slot is started here.
+ */
+void i2c_rx_release(uint8_t const* p_data)
+{
+    bool restart = false;
+
+    for(uint8_t i = 0; i < I2C_RX_BUF_NUM; i++)
     {
-        counter++;
-        nrf_delay_ms(1);
-        if(counter > 500)
-            return;
+        if(p_data == i2c_data_buf[i].data)
+        {
+            CRITICAL_REGION_ENTER();
+            i2c_data_buf[i].in_use = false;
+            restart = i2c_rx_wait_slot;
+            i2c_rx_wait_slot = false;
+            CRITICAL_REGION_EXIT();
+            break;
+        }
     }
-    set_i2c_data_flag(false);
-    // response data
-    get_i2c_data(&data, &len);
-    if(i2c_data_buf.data_type == DATA_TYPE_FIDO)
+    i2c_rx_post_retry();
+    if(restart && !i2c_master_read())
     {
-        NRF_LOG_INFO("twi read fido data");
-        ble_fido_send(data, len);
+        i2c_read_abort();
     }
-    else
+}
+
+/**@brief Function for reading the response the slave signalled on TWI_STATUS_GPIO.
+ *
+ * @details Only starts the read, the response is handed to BLE by i2c_read_sched_handler.
+ */
+void twi_read_data(void)
+{
+    i2c_rx_to_ble = true;
+    if(!i2c_master_read())
     {
-        ble_nus_send(data, len);
+        i2c_rx_to_ble = false;
+        NRF_LOG_INFO("twi read data error");
     }
 }
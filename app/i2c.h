@@ -16,5 +16,9 @@ void get_i2c_data(uint8_t** data, uint16_t* len);
 bool get_i2c_data_flag(void);
 void set_i2c_data_flag(bool flag);
 bool i2c_master_write_fido(uint8_t* buf, uint32_t len);
+bool i2c_master_write_ex(uint8_t* buf, uint8_t len, bool no_stop);
+bool i2c_tx_busy(uint8_t const* p_buf);
+void i2c_rx_release(uint8_t const* p_data);
+void i2c_rx_post_retry(void);
 void twi_read_data(void);
 #endif
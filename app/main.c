@@ -78,9 +78,12 @@
 #include "ble_bas.h"
 #include "app_error.h"
 #include "nrf_drv_saadc.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_rtc.h"
 #include "sdk_macros.h"
 #include "app_timer.h"
 #include "app_uart.h"
+#include "nrf_libuarte_async.h"
 #include "app_scheduler.h"
 #include "ble_dfu.h"
 #include "nrf_delay.h"
@@ -106,6 +109,13 @@
 
 #include "i2c.h"
 #include "nfc.h"
+#include "conn_policy.h"
+#include "fw_hash.h"
+#include "settings.h"
+#include "bat_est.h"
+#include "ntc.h"
+#include "baud_neg.h"
+#include "main_evt.h"
 
 #define BLE_DEFAULT      0
 #define BLE_CONNECT      1
@@ -146,7 +156,10 @@
 
 // SCHEDULER CONFIGS
 #define SCHED_MAX_EVENT_DATA_SIZE 64 //!< Maximum size of the scheduler event data.
-#define SCHED_QUEUE_SIZE          5  //!< Size of the scheduler queue.
+// Events that can be queued at once: MAIN_EVT_COUNT main_evt sources, one per TWI read slot
+// (I2C_RX_BUF_NUM), the firmware hash step, the baud fallback from the UARTE error and from
+// the confirmation timer and send_service_changed. 11, with room to spare.
+#define SCHED_QUEUE_SIZE          16 //!< Size of the scheduler queue.
 
 #define RCV_DATA_TIMEOUT_INTERVAL   APP_TIMER_TICKS(2000)
 #define BATTERY_LEVEL_MEAS_INTERVAL APP_TIMER_TICKS(1000) /**< Battery level measurement interval (ticks). */
@@ -162,6 +175,7 @@
 #define FIRST_CONN_PARAMS_UPDATE_DELAY APP_TIMER_TICKS(100)            /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(30000)          /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define ONE_SECOND_INTERVAL            APP_TIMER_TICKS(1000)
+#define LINK_PHY_RETRY_DELAY           APP_TIMER_TICKS(50) /**< Time before a PHY update refused as busy is requested again. */
 
 #define TWI_TIMEOUT_COUNTER 10
 
@@ -186,7 +200,7 @@
 #define DEAD_BEEF 0xDEADBEEF /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
 
 #define BLE_GAP_DATA_LENGTH_DEFAULT 27  //!< The stack's default data length.
-#define BLE_GAP_DATA_LENGTH_MAX     251 //!< Maximum data length.
+#define BLE_GAP_PHY_PREFERRED       (BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_2MBPS) //!< PHYs offered to the central, 2M is picked when supported.
 
 BLE_NUS_DEF(m_nus, NRF_SDH_BLE_TOTAL_LINK_COUNT); /**< BLE NUS service instance. */
 BLE_BAS_DEF(m_bas);
@@ -213,6 +227,11 @@ static pm_peer_id_t m_peer_to_be_deleted = PM_PEER_ID_INVALID;
 static bool request_service_changed = false;
 #endif
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID; /**< Handle of the current connection. */
+static uint16_t m_ble_gatt_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3; /**< Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module. */
+static uint8_t m_link_data_length = BLE_GAP_DATA_LENGTH_DEFAULT;         /**< Negotiated link layer payload length of the current connection. */
+static uint8_t m_link_tx_phy = BLE_GAP_PHY_1MBPS;                        /**< TX PHY of the current connection. */
+static uint8_t m_link_rx_phy = BLE_GAP_PHY_1MBPS;                        /**< RX PHY of the current connection. */
+APP_TIMER_DEF(m_link_phy_timer_id);                                      /**< Retries a PHY update the SoftDevice refused as busy. */
 static ble_uuid_t m_adv_uuids[] =                        /**< Universally unique service identifiers. */
     {
 #if BLE_DIS_ENABLED
@@ -223,6 +242,7 @@ static ble_uuid_t m_adv_uuids[] =                        /**< Universally unique
         {BLE_UUID_NUS_SERVICE, BLE_UUID_TYPE_BLE}};
 
 static void idle_state_handle(void);
+static void ble_link_phy_retry_handler(void* p_context);
 
 static uint8_t bond_check_key_flag = INIT_VALUE;
 static uint8_t ble_status_flag = 0;
@@ -249,6 +269,9 @@ static bool app_shutdown_handler(nrf_pwr_mgmt_evt_t event)
     {
         case NRF_PWR_MGMT_EVT_PREPARE_DFU:
             NRF_LOG_INFO("Power management wants to reset to DFU mode.");
+            // Let the DFU status frames reach the ST before the reset.
+            uart_tx_flush();
+            settings_flush();
             // YOUR_JOB: Get ready to reset into DFU mode
             //
             // If you aren't finished with any ongoing tasks, return "false" to
@@ -412,7 +435,6 @@ static void pm_evt_handler(pm_evt_t const* p_evt)
                     {
                         send_ble_data_to_st_byte(UART_CMD_BLE_PAIR_STA, VALUE_SECCESS);
                     }
-                    nrf_ble_gatt_data_length_set(&m_gatt, m_conn_handle, BLE_GAP_DATA_LENGTH_MAX);
                     NRF_LOG_INFO("Link secured. Role: %d. conn_handle: %d, Procedure: %d",
                                  ble_conn_state_role(p_evt->conn_handle),
                                  p_evt->conn_handle,
@@ -535,7 +557,49 @@ static void gap_params_init(void)
 
 static void send_service_changed(void* p_event_data, uint16_t event_size);
 
-static uint16_t m_ble_gatt_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3; /**< Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module. */
+/**@brief Function for asking the central to move the connection to the 2M PHY.
+ *
+ * @details The central picks 1M if it does not support 2M, the outcome is reported by
+ *          BLE_GAP_EVT_PHY_UPDATE. While the data length or MTU procedure started by
+ *          nrf_ble_gatt is pending the SoftDevice answers NRF_ERROR_BUSY, the request is then
+ *          repeated after LINK_PHY_RETRY_DELAY, until a PHY update completes or the link drops.
+ */
+static void ble_link_phy_request(uint16_t conn_handle)
+{
+    ble_gap_phys_t const phys =
+        {
+            .rx_phys = BLE_GAP_PHY_PREFERRED,
+            .tx_phys = BLE_GAP_PHY_PREFERRED,
+        };
+    ret_code_t err_code = sd_ble_gap_phy_update(conn_handle, &phys);
+    if(err_code == NRF_ERROR_BUSY)
+    {
+        err_code = app_timer_start(m_link_phy_timer_id, LINK_PHY_RETRY_DELAY, NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+    else if(err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("PHY update request failed: 0x%x", err_code);
+    }
+}
+
+static void ble_link_phy_retry_handler(void* p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    if(m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        ble_link_phy_request(m_conn_handle);
+    }
+}
+
+static void ble_link_params_reset(void)
+{
+    m_ble_gatt_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+    m_link_data_length = BLE_GAP_DATA_LENGTH_DEFAULT;
+    m_link_tx_phy = BLE_GAP_PHY_1MBPS;
+    m_link_rx_phy = BLE_GAP_PHY_1MBPS;
+    (void)app_timer_stop(m_link_phy_timer_id);
+}
 
 /**@brief Function for handling events from the GATT library. */
 void gatt_evt_handler(nrf_ble_gatt_t* p_gatt, nrf_ble_gatt_evt_t const* p_evt)
@@ -545,6 +609,11 @@ void gatt_evt_handler(nrf_ble_gatt_t* p_gatt, nrf_ble_gatt_evt_t const* p_evt)
         m_ble_gatt_max_data_len = p_evt->params.att_mtu_effective - OPCODE_LENGTH - HANDLE_LENGTH;
         NRF_LOG_INFO("Data len is set to 0x%X(%d)", m_ble_gatt_max_data_len, m_ble_gatt_max_data_len);
     }
+    else if((m_conn_handle == p_evt->conn_handle) && (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED))
+    {
+        m_link_data_length = p_evt->params.data_length;
+        NRF_LOG_INFO("LL data length is set to %d", m_link_data_length);
+    }
     NRF_LOG_DEBUG("ATT MTU exchange completed. central 0x%x peripheral 0x%x",
                   p_gatt->att_mtu_desired_central,
                   p_gatt->att_mtu_desired_periph);
@@ -673,6 +742,10 @@ static void on_conn_params_evt(ble_conn_params_evt_t* p_evt)
 {
     ret_code_t err_code;
 
+    if(conn_policy_on_conn_params_evt(p_evt))
+    {
+        return;
+    }
     if(p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
     {
         err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
@@ -709,6 +782,8 @@ static void conn_params_init(void)
 
     err_code = ble_conn_params_init(&cp_init);
     APP_ERROR_CHECK(err_code);
+
+    conn_policy_init();
 }
 
 /**@brief Function for handling advertising events.
@@ -779,6 +854,10 @@ static void ble_evt_handler(ble_evt_t const* p_ble_evt, void* p_context)
                 ble_evt_flag = BLE_DISCONNECT;
                 bond_check_key_flag = INIT_VALUE;
                 m_conn_handle = BLE_CONN_HANDLE_INVALID;
+                ble_nus_tx_reset();
+                ble_fido_tx_reset();
+                ble_link_params_reset();
+                conn_policy_on_disconnected();
                 send_ble_data_to_st_byte(UART_CMD_BLE_CON_STA, VALUE_DISCONNECT);
                 // Check if the last connected peer had not used MITM, if so, delete its bond information.
                 if(m_peer_to_be_deleted != PM_PEER_ID_INVALID)
@@ -801,11 +880,27 @@ static void ble_evt_handler(ble_evt_t const* p_ble_evt, void* p_context)
                 m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
                 err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
                 APP_ERROR_CHECK(err_code);
-                nrf_ble_gatt_data_length_set(&m_gatt, m_conn_handle, BLE_GAP_DATA_LENGTH_DEFAULT);
+                // The GATT module requests NRF_SDH_BLE_GAP_DATA_LENGTH on connection.
+                ble_link_phy_request(m_conn_handle);
+                conn_policy_on_connected(m_conn_handle);
                 // Start Security Request timer.
             }
             break;
 
+        case BLE_GAP_EVT_PHY_UPDATE:
+            {
+                ble_gap_evt_phy_update_t const* p_phy_update = &p_ble_evt->evt.gap_evt.params.phy_update;
+                // Also the outcome of a procedure the central started, no need to ask again.
+                (void)app_timer_stop(m_link_phy_timer_id);
+                if(p_phy_update->status == BLE_HCI_STATUS_CODE_SUCCESS)
+                {
+                    m_link_tx_phy = p_phy_update->tx_phy;
+                    m_link_rx_phy = p_phy_update->rx_phy;
+                }
+                NRF_LOG_INFO("PHY update status 0x%x, tx %d rx %d", p_phy_update->status, m_link_tx_phy, m_link_rx_phy);
+            }
+            break;
+
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
             {
                 NRF_LOG_DEBUG("PHY update request.");
@@ -908,6 +1003,8 @@ static void ble_evt_handler(ble_evt_t const* p_ble_evt, void* p_context)
             NRF_LOG_INFO("Disconnected");
             // LED indication will be changed when advertising starts.
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            ble_nus_tx_reset();
+            ble_fido_tx_reset();
             break;
 
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
@@ -977,6 +1074,14 @@ static void ble_stack_init(void)
     err_code = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(err_code);
 
+    // Connection events may run past NRF_SDH_BLE_GAP_EVENT_LENGTH, up to the connection
+    // interval, while both sides have data and nothing else needs the radio.
+    ble_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+
     // Register a handler for BLE events.
     NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
 }
@@ -1087,7 +1192,8 @@ static void power_management_init(void)
 
 /**@brief Function for handling the idle state (main loop).
  *
- * @details If there is no pending log operation, then sleep until next the next event occurs.
+ * @details If there is no pending log operation and no main_evt request waiting for room in
+ *          the scheduler, then sleep until next the next event occurs.
  */
 static void idle_state_handle(void)
 {
@@ -1101,7 +1207,7 @@ static void idle_state_handle(void)
             APP_ERROR_CHECK(err_code);
         }
     }
-    if(NRF_LOG_PROCESS() == false)
+    if((NRF_LOG_PROCESS() == false) && !main_evt_deferred())
     {
         nrf_pwr_mgmt_run();
     }
@@ -1132,26 +1238,23 @@ static void wdt_init(void)
 static void manage_bat_level(void* p_event_data, uint16_t event_size)
 {
     static bool first_read = false;
-    uint32_t len = 4;
-    uint8_t data[4];
+    uint32_t level;
 
     if(first_read == false)
     {
         first_read = true;
-        nrf_fstorage_read(&fstorage, BAT_LVL_ADDR, data, len);
-        if(data[0] <= 4)
+        if(settings_get(SETTINGS_KEY_BAT_LVL, &level) && (level <= 4))
         {
-            set_backup_bat_level(data[0]);
-            NRF_LOG_INFO("read storrage level is %d", data[0]);
+            set_backup_bat_level(level);
+            NRF_LOG_INFO("read storrage level is %d", level);
         }
     }
     if(bat_level_flag == 2)
     {
         bat_level_flag = 1;
-        uint32_t m_data3 = (uint32_t)get_backup_bat_level();
-        flash_data_write(BAT_LVL_ADDR, m_data3);
-        nrf_fstorage_read(&fstorage, BAT_LVL_ADDR, data, len);
-        NRF_LOG_INFO("buff0- %d,buff1- %d,buff2- %d,buff3- %d", data[0], data[1], data[2], data[3]);
+        level = (uint32_t)get_backup_bat_level();
+        settings_set(SETTINGS_KEY_BAT_LVL, level);
+        NRF_LOG_INFO("stored level is %d", level);
     }
 }
 static void check_advertising_stop(void)
@@ -1242,21 +1345,19 @@ static void scheduler_init(void)
 {
     APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
 }
-static void main_loop(void)
-{
-    // app_sched_event_put(NULL,NULL,ble_ctl_process);
-    // app_sched_event_put(NULL,NULL,rsp_st_uart_cmd);
-    // app_sched_event_put(NULL,NULL,manage_bat_level);
-    // app_sched_event_put(NULL,NULL,nfc_poll);
-
-    ble_ctl_process(NULL, 0);
-    manage_bat_level(NULL, 0);
-    rsp_st_uart_cmd(NULL, 0);
-
+// Handlers of the main_evt sources, they run only once their flag has been set.
+static app_sched_event_handler_t const main_evt_handlers[MAIN_EVT_COUNT] =
+    {
+        [MAIN_EVT_BLE_CTL] = ble_ctl_process,
+        [MAIN_EVT_BAT_LEVEL] = manage_bat_level,
+        [MAIN_EVT_UART_RX] = uart_frame_poll,
 #if NRFX_NFCT_ENABLED
-    nfc_poll(NULL, 0);
+        [MAIN_EVT_NFC] = nfc_poll,
+#else
+        [MAIN_EVT_NFC] = NULL,
 #endif
-}
+        [MAIN_EVT_KEY_LOCK] = device_key_lock_finish,
+};
 
 int main(void)
 {
@@ -1266,8 +1367,10 @@ int main(void)
     APP_ERROR_CHECK(err_code);
 #endif
     // Initialize.
-    system_init();
+    // The UART posts main_evt events as soon as it is up.
     scheduler_init();
+    main_evt_init(main_evt_handlers);
+    system_init();
     log_init();
 
     fs_init();
@@ -1276,6 +1379,7 @@ int main(void)
 
     adc_get_hw_ver();
     timers_init();
+    fw_hash_start();
     power_management_init();
     ble_stack_init();
     mac_address_get();
@@ -1300,10 +1404,18 @@ int main(void)
 #endif
 
     wdt_init();
+
+    // One pass of each, as the first polling round did: the stored battery level is read and
+    // flags set during the init are handled.
+    main_evt_post(MAIN_EVT_BLE_CTL);
+    main_evt_post(MAIN_EVT_BAT_LEVEL);
+    main_evt_post(MAIN_EVT_UART_RX);
+
     // Enter main loop.
     for(;;)
     {
-        main_loop();
+        i2c_rx_post_retry();
+        main_evt_retry();
         app_sched_execute();
         idle_state_handle();
     }
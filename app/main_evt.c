@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_util_platform.h"
+#include "sdk_config.h"
+
+#include "nrf_log_default_backends.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log.h"
+
+#include "main_evt.h"
+
+static app_sched_event_handler_t const* m_handlers;
+static volatile bool m_pending[MAIN_EVT_COUNT];
+static volatile bool m_deferred[MAIN_EVT_COUNT]; // the scheduler was full, posted by main_evt_retry()
+static main_evt_stats_t m_stats;
+
+static void main_evt_dispatch(void* p_event_data, uint16_t event_size)
+{
+    main_evt_src_t src = *(main_evt_src_t*)p_event_data;
+
+    UNUSED_PARAMETER(event_size);
+
+    // Cleared first, a post made while the handler runs queues it again.
+    m_pending[src] = false;
+    if(m_handlers[src] != NULL)
+    {
+        m_handlers[src](NULL, 0);
+    }
+}
+
+/**@brief Function for setting the handler run for each source.
+ *
+ * @param[in] p_handlers  MAIN_EVT_COUNT handlers, indexed by main_evt_src_t. NULL for a source
+ *                        not built in, its events are then dropped.
+ */
+void main_evt_init(app_sched_event_handler_t const* p_handlers)
+{
+    m_handlers = p_handlers;
+    memset((void*)m_pending, 0, sizeof(m_pending));
+    memset((void*)m_deferred, 0, sizeof(m_deferred));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// Called with interrupts disabled.
+static void main_evt_put(main_evt_src_t src)
+{
+    if(app_sched_event_put(&src, sizeof(src), main_evt_dispatch) != NRF_SUCCESS)
+    {
+        m_deferred[src] = true;
+        m_stats.deferred[src]++;
+        return;
+    }
+    m_deferred[src] = false;
+    m_pending[src] = true;
+    m_stats.posted[src]++;
+}
+
+/**@brief Function for requesting a run of the handler of a source.
+ *
+ * @details Safe from interrupts. At most one event per source is queued, so the scheduler
+ *          queue only needs room for MAIN_EVT_COUNT events besides its other users. Should it
+ *          be full anyway, the request is kept and posted again by main_evt_retry().
+ */
+void main_evt_post(main_evt_src_t src)
+{
+    CRITICAL_REGION_ENTER();
+    if(m_pending[src] || m_deferred[src])
+    {
+        m_stats.coalesced[src]++;
+    }
+    else
+    {
+        main_evt_put(src);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for posting the requests the scheduler had no room for.
+ *
+ * @details Called from the main loop before the scheduler is drained.
+ */
+void main_evt_retry(void)
+{
+    CRITICAL_REGION_ENTER();
+    for(uint8_t src = 0; src < MAIN_EVT_COUNT; src++)
+    {
+        if(m_deferred[src])
+        {
+            main_evt_put((main_evt_src_t)src);
+        }
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for checking whether a request still waits for room in the scheduler.
+ *
+ * @details A source deferred while the scheduler was drained is only posted again by the
+ *          next main_evt_retry(), the main loop must not sleep before that.
+ */
+bool main_evt_deferred(void)
+{
+    for(uint8_t src = 0; src < MAIN_EVT_COUNT; src++)
+    {
+        if(m_deferred[src])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+main_evt_stats_t const* main_evt_stats_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,31 @@
+#ifndef __NORDIC_52832_MAIN_EVT_
+#define __NORDIC_52832_MAIN_EVT_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "app_scheduler.h"
+
+// Work the main loop used to poll for, each runs from the scheduler once posted.
+typedef enum
+{
+    MAIN_EVT_BLE_CTL,   // ble_adv_switch_flag or ble_conn_flag set
+    MAIN_EVT_BAT_LEVEL, // bat_level_flag set, battery level to store
+    MAIN_EVT_UART_RX,   // UART frame queued, or room again to answer the queued ones
+    MAIN_EVT_NFC,       // NFC APDU to forward
+    MAIN_EVT_KEY_LOCK,  // device key page rewrite completed
+    MAIN_EVT_COUNT
+} main_evt_src_t;
+
+typedef struct
+{
+    uint32_t posted[MAIN_EVT_COUNT];    // scheduler events queued per source
+    uint32_t coalesced[MAIN_EVT_COUNT]; // posts merged into an event still queued
+    uint32_t deferred[MAIN_EVT_COUNT];  // posts the scheduler had no room for, retried later
+} main_evt_stats_t;
+
+void main_evt_init(app_sched_event_handler_t const* p_handlers);
+void main_evt_post(main_evt_src_t src);
+void main_evt_retry(void);
+bool main_evt_deferred(void);
+main_evt_stats_t const* main_evt_stats_get(void);
+#endif
@@ -62,6 +62,8 @@
 #include "nrf_delay.h"
 
 #include "nfc.h"
+#include "i2c.h"
+#include "main_evt.h"
 
 #define MAX_APDU_LEN 1024 /**< Maximal APDU length, Adafruit limitation. */
 // #define HEADER_FIELD_SIZE 1      /**< Header field size. */
@@ -80,6 +82,40 @@ extern uint8_t ble_adv_switch_flag;
 
 static void apdu_command(const uint8_t* p_buf, uint32_t data_len);
 bool apdu_cmd = false;
+static bool apdu_drop = false; // command refused, its remaining fragments are not forwarded
+
+/**@brief Function for handing a frame of a command to nfc_poll() for the slave.
+ *
+ * @details nfc_apdu is read in place by the TWI. While the last frame is not handed over or not
+ *          written out yet, the frame is refused and so is the rest of its command. The library
+ *          acknowledges chained fragments itself, the refusal is the answer to the last one.
+ *
+ * @return false if the command is refused.
+ */
+static bool apdu_forward(const uint8_t* p_buf, uint32_t data_len, bool more)
+{
+    bool result;
+
+    if(!apdu_drop && (apdu_cmd || i2c_tx_busy(nfc_apdu)))
+    {
+        NRF_LOG_WARNING("NFC apdu buffer busy, drop command");
+        apdu_drop = true;
+    }
+    result = !apdu_drop;
+    if(result)
+    {
+        memcpy(nfc_apdu, p_buf, data_len);
+        nfc_apdu_len = data_len;
+        nfc_multi_packet = more;
+        apdu_cmd = true;
+        main_evt_post(MAIN_EVT_NFC);
+    }
+    if(!more)
+    {
+        apdu_drop = false;
+    }
+    return result;
+}
 
 /**
  * @brief Callback function for handling NFC events.
@@ -98,11 +134,13 @@ static void nfc_callback(void* context,
     {
         case NFC_T4T_EVENT_FIELD_ON:
             multi_package = false;
+            apdu_drop = false;
             NRF_LOG_INFO("NFC Tag has been selected. UART transmission can start...");
             break;
 
         case NFC_T4T_EVENT_FIELD_OFF:
             multi_package = false;
+            apdu_drop = false;
             NRF_LOG_INFO("NFC field lost. Data from UART will be discarded...");
             break;
         case NFC_T4T_EVENT_DATA_IND:
@@ -113,9 +151,6 @@ static void nfc_callback(void* context,
 
             if(flags != NFC_T4T_DI_FLAG_MORE)
             {
-                memcpy(nfc_apdu, data, dataLength);
-                nfc_apdu_len = dataLength;
-                nfc_multi_packet = false;
                 NRF_LOG_INFO("NFC RX data length: %d", dataLength);
                 // NRF_LOG_HEXDUMP_INFO(data,dataLength);
                 apdu_command(data, dataLength);
@@ -130,10 +165,7 @@ static void nfc_callback(void* context,
             else
             {
                 multi_package = true;
-                memcpy(nfc_apdu, data, dataLength);
-                nfc_apdu_len = dataLength;
-                apdu_cmd = true;
-                nfc_multi_packet = true;
+                (void)apdu_forward(data, dataLength, true);
                 // i2c_master_write_ex((uint8_t*)data,dataLength,true);
             }
             break;
@@ -167,21 +199,19 @@ static void apdu_command(const uint8_t* p_buf, uint32_t data_len)
     if(multi_package) // multi_package end
     {
         multi_package = false;
-        apdu_cmd = true;
         // i2c_master_write_ex((uint8_t*)p_buf,data_len,false);
         nfc_data_out_len = 2;
-        memcpy(nfc_data_out_buf, "\x90\x00", nfc_data_out_len);
+        memcpy(nfc_data_out_buf, apdu_forward(p_buf, data_len, false) ? "\x90\x00" : "\x6D\x00", nfc_data_out_len);
     }
     else
     {
         if(p_buf[0] == '?')
         {
             set_i2c_data_flag(false);
-            apdu_cmd = true;
             reading = false;
             // i2c_master_write_ex((uint8_t*)p_buf,data_len,false);
             nfc_data_out_len = 2;
-            memcpy(nfc_data_out_buf, "\x90\x00", nfc_data_out_len);
+            memcpy(nfc_data_out_buf, apdu_forward(p_buf, data_len, false) ? "\x90\x00" : "\x6D\x00", nfc_data_out_len);
         }
         else if(p_buf[0] == '#' && p_buf[1] == '*' && p_buf[2] == '*')
         {
@@ -206,9 +236,11 @@ static void apdu_command(const uint8_t* p_buf, uint32_t data_len)
                 else
                 {
                     uint8_t* data;
+                    uint16_t len;
                     set_i2c_data_flag(false);
                     reading = false;
-                    get_i2c_data(&data, &nfc_data_out_len);
+                    get_i2c_data(&data, &len);
+                    nfc_data_out_len = len;
                     memcpy(nfc_data_out_buf, data, nfc_data_out_len);
                 }
             }
@@ -225,6 +257,7 @@ static void apdu_command(const uint8_t* p_buf, uint32_t data_len)
                 {
                     ble_adv_switch_flag = 2;
                 }
+                main_evt_post(MAIN_EVT_BLE_CTL);
                 nfc_data_out_len = 3;
                 memcpy(nfc_data_out_buf, "\xA5\x5\01", nfc_data_out_len);
             }
@@ -239,10 +272,17 @@ static void apdu_command(const uint8_t* p_buf, uint32_t data_len)
 
 void nfc_poll(void* p_event_data, uint16_t event_size)
 {
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
     if(apdu_cmd == true)
     {
+        // Queued before apdu_cmd is cleared, nfc_apdu must not look free to nfc_callback() in between.
+        if(!i2c_master_write_ex(nfc_apdu, nfc_apdu_len, nfc_multi_packet))
+        {
+            NRF_LOG_WARNING("NFC apdu not queued");
+        }
         apdu_cmd = false;
-        i2c_master_write_ex(nfc_apdu, nfc_apdu_len, nfc_multi_packet);
     }
 }
 /** @} */
@@ -0,0 +1,43 @@
+#include <stdint.h>
+
+#include "ntc.h"
+
+#define NTC_TABLE_CODE_MIN  128
+#define NTC_TABLE_CODE_STEP 16
+#define NTC_TABLE_LEN       (sizeof(ntc_table) / sizeof(ntc_table[0]))
+
+/* Temperature in 0.1 degree Celsius at the ADC codes 128, 144, ... 832, that is 83 C down to -21 C.
+ * Computed offline from T = NTC_B_VALUE / (ln(R / NTC_R_NTC) + NTC_B_VALUE / 298.15) - 273.15,
+ * with R = NTC_R_FIXED * mv / (3300 - mv) and mv = ADC_RESULT_IN_MILLI_VOLTS(code) without
+ * rounding. */
+static int16_t const ntc_table[] = {
+    830, 779, 734, 693, 656, 622, 590, 560, 532, 506, 481, 457,
+    434, 412, 391, 370, 350, 330, 311, 293, 274, 256, 238, 220,
+    203, 185, 168, 151, 133, 116, 98, 80, 62, 44, 25, 6,
+    -13, -34, -55, -76, -99, -123, -149, -177, -207,
+};
+
+/**@brief Function for converting a temperature channel sample to 0.1 degree Celsius.
+ *
+ * @details Linear interpolation between the table entries, samples outside the table are
+ *          clamped to its ends and so still read as too hot or too cold to charge.
+ *
+ * @param[in] code  Raw 10 bit SAADC result.
+ */
+int ntc_code_to_decidegree(int code)
+{
+    uint32_t idx;
+    int frac;
+
+    if(code <= NTC_TABLE_CODE_MIN)
+    {
+        return ntc_table[0];
+    }
+    idx = (code - NTC_TABLE_CODE_MIN) / NTC_TABLE_CODE_STEP;
+    if(idx >= NTC_TABLE_LEN - 1)
+    {
+        return ntc_table[NTC_TABLE_LEN - 1];
+    }
+    frac = (code - NTC_TABLE_CODE_MIN) % NTC_TABLE_CODE_STEP;
+    return ntc_table[idx] + (ntc_table[idx + 1] - ntc_table[idx]) * frac / NTC_TABLE_CODE_STEP;
+}
@@ -0,0 +1,12 @@
+#ifndef __NORDIC_52832_NTC_
+#define __NORDIC_52832_NTC_
+
+#include <stdint.h>
+
+// Thermistor on the temperature channel, against R_FIXED to the 3.3 V rail.
+#define NTC_R_NTC   10000
+#define NTC_R_FIXED 10000
+#define NTC_B_VALUE 3380
+
+int ntc_code_to_decidegree(int code);
+#endif
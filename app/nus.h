@@ -1,27 +1,115 @@
+#define NUS_RX_BUF_NUM 16 /**< Number of received fragments that can be queued towards the TWI, about a 3 KB message. */
 
-static uint8_t nus_recv_data_buff[NRF_SDH_BLE_GATT_MAX_MTU_SIZE - OPCODE_LENGTH - HANDLE_LENGTH];
+static uint8_t nus_recv_data_buff[NUS_RX_BUF_NUM][NRF_SDH_BLE_GATT_MAX_MTU_SIZE - OPCODE_LENGTH - HANDLE_LENGTH];
+static uint8_t nus_recv_buf_idx = 0;
 static uint16_t nus_recv_data_len = 0;
 static uint8_t rcv_head_flag = 0;
 
-static uint8_t* ble_nus_send_buf;
-static uint16_t ble_nus_send_len, ble_nus_send_offset;
+#define BLE_NUS_TX_QUEUE_SIZE 4 /**< Number of responses that can be pending for transmission. */
 
-static void ble_nus_send_packet(uint8_t* data, uint16_t data_len)
+typedef struct
+{
+    uint8_t* p_data;
+    uint16_t len;
+    uint16_t offset;
+} ble_nus_tx_item_t;
+
+static ble_nus_tx_item_t ble_nus_tx_queue[BLE_NUS_TX_QUEUE_SIZE];
+static uint8_t ble_nus_tx_head, ble_nus_tx_count;
+static bool ble_nus_tx_active;   // a context is sending from the queue
+static bool ble_nus_tx_again;    // TX_RDY or a response came in while it was
+static uint8_t ble_nus_tx_epoch; // bumped by ble_nus_tx_reset(), the items taken before are gone
+
+/**@brief Function for filling the free SoftDevice notification buffers from the TX queue.
+ *
+ * @details Fragments are sent in order until the SoftDevice runs out of buffers, transmission
+ *          then continues on the next BLE_NUS_EVT_TX_RDY. A response that can not be sent
+ *          because the link or the notifications are gone is dropped.
+ *
+ *          Runs from the main loop and from BLE_NUS_EVT_TX_RDY. Only the queue indexes are
+ *          taken under the critical region, the SoftDevice and i2c_rx_release() are called
+ *          outside it. One context sends at a time, a call that finds another one sending only
+ *          flags it to go round again, so fragments leave in order.
+ */
+static void ble_nus_tx_process(void)
 {
     ret_code_t err_code;
-    uint16_t length = 0;
+    uint16_t length;
+    ble_nus_tx_item_t* p_item;
+    uint8_t* p_done;
+    uint8_t epoch;
+    bool owner;
+
+    CRITICAL_REGION_ENTER();
+    owner = !ble_nus_tx_active;
+    ble_nus_tx_again = !owner;
+    ble_nus_tx_active = true;
+    CRITICAL_REGION_EXIT();
+    if(!owner)
+    {
+        return;
+    }
 
-    do
+    for(;;)
     {
-        length = data_len > m_ble_gatt_max_data_len ? m_ble_gatt_max_data_len : data_len;
-        err_code = ble_nus_data_send(&m_nus, data, &length, m_conn_handle);
-        if((err_code != NRF_ERROR_INVALID_STATE) &&
-           (err_code != NRF_ERROR_RESOURCES) &&
-           (err_code != NRF_ERROR_NOT_FOUND))
+        CRITICAL_REGION_ENTER();
+        p_item = (ble_nus_tx_count > 0) ? &ble_nus_tx_queue[ble_nus_tx_head] : NULL;
+        epoch = ble_nus_tx_epoch;
+        ble_nus_tx_active = (p_item != NULL);
+        CRITICAL_REGION_EXIT();
+        if(p_item == NULL)
+        {
+            return;
+        }
+
+        length = p_item->len - p_item->offset;
+        length = length > m_ble_gatt_max_data_len ? m_ble_gatt_max_data_len : length;
+
+        err_code = ble_nus_data_send(&m_nus, p_item->p_data + p_item->offset, &length, m_conn_handle);
+        if(err_code == NRF_ERROR_RESOURCES)
+        {
+            // Stop, unless a buffer was freed since the call.
+            CRITICAL_REGION_ENTER();
+            owner = ble_nus_tx_again;
+            ble_nus_tx_again = false;
+            ble_nus_tx_active = owner;
+            CRITICAL_REGION_EXIT();
+            if(!owner)
+            {
+                return;
+            }
+            continue;
+        }
+        if(err_code == NRF_SUCCESS)
+        {
+            p_item->offset += length;
+        }
+        else if((err_code == NRF_ERROR_INVALID_STATE) || (err_code == NRF_ERROR_NOT_FOUND))
+        {
+            p_item->offset = p_item->len;
+        }
+        else
         {
             APP_ERROR_CHECK(err_code);
         }
-    } while(err_code == NRF_ERROR_RESOURCES);
+
+        if(p_item->offset >= p_item->len)
+        {
+            p_done = NULL;
+            CRITICAL_REGION_ENTER();
+            if(epoch == ble_nus_tx_epoch)
+            {
+                p_done = p_item->p_data;
+                ble_nus_tx_head = (ble_nus_tx_head + 1) % BLE_NUS_TX_QUEUE_SIZE;
+                ble_nus_tx_count--;
+            }
+            CRITICAL_REGION_EXIT();
+            if(p_done != NULL)
+            {
+                i2c_rx_release(p_done);
+            }
+        }
+    }
 }
 
 /**@brief Function for handling the data from the Nordic UART Service.
@@ -35,7 +123,10 @@ static void ble_nus_send_packet(uint8_t* data, uint16_t data_len)
 static void nus_data_handler(ble_nus_evt_t* p_evt)
 {
     static uint32_t msg_len;
+    static bool msg_drop;
     uint32_t pad;
+    uint8_t const* p_data = p_evt->params.rx_data.p_data;
+    uint8_t* p_buf;
     // uint8_t *rcv_data=(uint8_t *)p_evt->params.rx_data.p_data;
     // uint32_t rcv_len=p_evt->params.rx_data.length;
 
@@ -44,11 +135,11 @@ static void nus_data_handler(ble_nus_evt_t* p_evt)
         // NRF_LOG_INFO("Received data from BLE NUS.");
         // NRF_LOG_HEXDUMP_DEBUG(p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
         nus_recv_data_len = p_evt->params.rx_data.length;
-        memcpy(nus_recv_data_buff, (uint8_t*)p_evt->params.rx_data.p_data, nus_recv_data_len);
 
         if(rcv_head_flag == DATA_INIT)
         {
-            if(nus_recv_data_buff[0] == '?' && nus_recv_data_buff[1] == '#' && nus_recv_data_buff[2] == '#')
+            msg_drop = false;
+            if(p_data[0] == '?' && p_data[1] == '#' && p_data[2] == '#')
             {
                 set_i2c_data_flag(false);
                 if(nus_recv_data_len < 9)
@@ -57,31 +148,34 @@ static void nus_data_handler(ble_nus_evt_t* p_evt)
                 }
                 else
                 {
-                    msg_len = (uint32_t)((nus_recv_data_buff[5] << 24) +
-                                         (nus_recv_data_buff[6] << 16) +
-                                         (nus_recv_data_buff[7] << 8) +
-                                         (nus_recv_data_buff[8]));
+                    msg_len = (uint32_t)((p_data[5] << 24) +
+                                         (p_data[6] << 16) +
+                                         (p_data[7] << 8) +
+                                         (p_data[8]));
                     pad = ((nus_recv_data_len + 63) / 64) + 8;
                     if(msg_len > nus_recv_data_len - pad)
                     {
                         msg_len -= nus_recv_data_len - pad;
                         rcv_head_flag = DATA_DATA;
                         start_data_out_timer();
+                        conn_policy_traffic();
                     }
                 }
             }
-            else if(nus_recv_data_buff[0] == 0x5A && nus_recv_data_buff[1] == 0xA5 && nus_recv_data_buff[2] == 0x07 && nus_recv_data_buff[3] == 0x1 && nus_recv_data_buff[4] == 0x03)
+            else if(p_data[0] == 0x5A && p_data[1] == 0xA5 && p_data[2] == 0x07 && p_data[3] == 0x1 && p_data[4] == 0x03)
             {
                 ble_adv_switch_flag = BLE_OFF_ALWAYS;
+                main_evt_post(MAIN_EVT_BLE_CTL);
                 return;
             }
         }
         else
         {
-            if(nus_recv_data_buff[0] == '?')
+            conn_policy_traffic();
+            if(p_data[0] == '?')
             {
                 pad = (nus_recv_data_len + 63) / 64;
-                if(nus_recv_data_len - pad > msg_len)
+                if(nus_recv_data_len - pad >= msg_len)
                 {
                     rcv_head_flag = DATA_INIT;
                     nus_recv_data_len = msg_len + (msg_len + 62) / 63;
@@ -98,44 +192,85 @@ static void nus_data_handler(ble_nus_evt_t* p_evt)
                 rcv_head_flag = DATA_INIT;
             }
         }
-        i2c_master_write(nus_recv_data_buff, nus_recv_data_len);
-    }
-    else if(p_evt->type == BLE_NUS_EVT_TX_RDY)
-    {
-        uint32_t length = 0;
 
-        length = ble_nus_send_len - ble_nus_send_offset;
-        if(length > 0)
+        // The TWI reads the slot in place. When the slave is that far behind, the fragment is
+        // refused and the rest of its message is not forwarded either, the slave resyncs on
+        // the next header.
+        p_buf = nus_recv_data_buff[nus_recv_buf_idx];
+        if(!msg_drop && i2c_tx_busy(p_buf))
         {
-            length = length > m_ble_gatt_max_data_len ? m_ble_gatt_max_data_len : length;
-            ble_nus_send_packet(ble_nus_send_buf + ble_nus_send_offset, length);
-            ble_nus_send_offset += length;
+            NRF_LOG_WARNING("NUS rx ring full, drop message");
+            msg_drop = true;
         }
-        else
+        if(msg_drop)
         {
-            ble_nus_send_len = 0;
-            ble_nus_send_offset = 0;
+            return;
         }
+        memcpy(p_buf, p_data, nus_recv_data_len);
+        i2c_master_write(p_buf, nus_recv_data_len);
+        nus_recv_buf_idx = (nus_recv_buf_idx + 1) % NUS_RX_BUF_NUM;
+    }
+    else if(p_evt->type == BLE_NUS_EVT_TX_RDY)
+    {
+        ble_nus_tx_process();
     }
 }
 
 void ble_nus_send(uint8_t* data, uint16_t data_len)
 {
-    ret_code_t err_code;
-    uint16_t length = 0;
-    uint16_t offset = 0;
+    ble_nus_tx_item_t* p_item;
+    bool queued = false;
 
     if(data_len == 0)
     {
         return;
     }
+    if(data_len > m_ble_gatt_max_data_len)
+    {
+        conn_policy_traffic();
+    }
+
+    CRITICAL_REGION_ENTER();
+    if(ble_nus_tx_count < BLE_NUS_TX_QUEUE_SIZE)
+    {
+        p_item = &ble_nus_tx_queue[(ble_nus_tx_head + ble_nus_tx_count) % BLE_NUS_TX_QUEUE_SIZE];
+        p_item->p_data = data;
+        p_item->len = data_len;
+        p_item->offset = 0;
+        ble_nus_tx_count++;
+        queued = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if(!queued)
+    {
+        NRF_LOG_WARNING("NUS tx queue full, drop %d bytes", data_len);
+        i2c_rx_release(data);
+        return;
+    }
+    ble_nus_tx_process();
+}
 
-    ble_nus_send_buf = data;
-    ble_nus_send_len = data_len;
+void ble_nus_tx_reset(void)
+{
+    uint8_t* p_data[BLE_NUS_TX_QUEUE_SIZE];
+    uint8_t count;
 
-    length = ble_nus_send_len > m_ble_gatt_max_data_len ? m_ble_gatt_max_data_len : ble_nus_send_len;
-    ble_nus_send_offset = length;
-    ble_nus_send_packet(ble_nus_send_buf, length);
+    CRITICAL_REGION_ENTER();
+    count = ble_nus_tx_count;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        p_data[i] = ble_nus_tx_queue[(ble_nus_tx_head + i) % BLE_NUS_TX_QUEUE_SIZE].p_data;
+    }
+    ble_nus_tx_head = 0;
+    ble_nus_tx_count = 0;
+    ble_nus_tx_epoch++;
+    CRITICAL_REGION_EXIT();
+
+    for(uint8_t i = 0; i < count; i++)
+    {
+        i2c_rx_release(p_data[i]);
+    }
 }
 
 void ble_nus_state_reset(void)
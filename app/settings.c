@@ -0,0 +1,395 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "app_error.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "app_util_platform.h"
+#include "sdk_config.h"
+
+#include "nrf_log_default_backends.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log.h"
+
+#include "settings.h"
+
+/* Each page starts with a header and is followed by records appended in write order, the last
+ * record of a key wins. A full page is compacted into the other one: the latest records are
+ * written first and the header last, so a page only counts once it is complete. */
+#define SETTINGS_MAGIC      0x5345544C // "SETL"
+#define SETTINGS_PAGE_COUNT 2
+#define SETTINGS_ERASED     0xFFFFFFFF
+#define SETTINGS_RETRY_MAX  3 // failed operations reissued at once, fstorage has retried each already
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq; // higher sequence is the newer page
+} settings_header_t;
+
+// The value word is programmed before the key word, so a record cut by a reset has no key.
+typedef struct
+{
+    uint32_t value;
+    uint16_t key;
+    uint16_t check; // ~(key ^ value halves)
+} settings_record_t;
+
+#define SETTINGS_RECORDS_PER_PAGE ((SETTINGS_PAGE_SIZE - sizeof(settings_header_t)) / sizeof(settings_record_t))
+
+typedef enum
+{
+    STORE_IDLE,
+    STORE_RECORD,         // appending the record of m_store_key
+    STORE_ERASE,          // compaction, erasing the target page
+    STORE_COMPACT_DATA,   // compaction, writing the records
+    STORE_COMPACT_HEADER, // compaction, writing the header
+} settings_store_state_t;
+
+static void settings_fs_evt_handler(nrf_fstorage_evt_t* p_evt);
+
+NRF_FSTORAGE_DEF(static nrf_fstorage_t m_fs) =
+    {
+        .evt_handler = settings_fs_evt_handler,
+        .start_addr = SETTINGS_PAGE0_ADDR,
+        .end_addr = SETTINGS_PAGE0_ADDR + SETTINGS_PAGE_COUNT * SETTINGS_PAGE_SIZE,
+};
+
+static uint32_t const m_page_addr[SETTINGS_PAGE_COUNT] = {SETTINGS_PAGE0_ADDR, SETTINGS_PAGE1_ADDR};
+// Key each page held as a single word before the log format.
+static settings_key_t const m_legacy_key[SETTINGS_PAGE_COUNT] = {SETTINGS_KEY_BLE_CTL, SETTINGS_KEY_BAT_LVL};
+
+static uint32_t m_value[SETTINGS_KEY_COUNT];
+static bool m_valid[SETTINGS_KEY_COUNT];
+static uint8_t m_page;       // page records are appended to
+static uint32_t m_seq;       // sequence of that page
+static uint32_t m_next;      // index of the next free record slot
+static settings_stats_t m_stats;
+
+// Write-behind state, the buffers are the source of the flash operation in progress.
+static volatile settings_store_state_t m_store_state = STORE_IDLE;
+static volatile uint8_t m_dirty; // keys whose value is not in flash yet, one bit per key
+static uint8_t m_store_key;
+static settings_record_t m_store_record[SETTINGS_KEY_COUNT];
+static settings_header_t m_store_header;
+static uint8_t m_compact_target;
+static uint8_t m_compact_count;
+static uint8_t m_retries; // failed operations reissued since the last one that completed
+
+static uint16_t record_check(uint16_t key, uint32_t value)
+{
+    return (uint16_t)~(key ^ (value & 0xFFFF) ^ (value >> 16));
+}
+
+static settings_header_t const* page_header(uint8_t page)
+{
+    return (settings_header_t const*)m_page_addr[page];
+}
+
+static settings_record_t const* page_records(uint8_t page)
+{
+    return (settings_record_t const*)(m_page_addr[page] + sizeof(settings_header_t));
+}
+
+static bool page_valid(uint8_t page)
+{
+    return (page_header(page)->magic == SETTINGS_MAGIC) && (page_header(page)->seq != SETTINGS_ERASED);
+}
+
+static void flash_erase(uint8_t page)
+{
+    ret_code_t err_code = nrf_fstorage_erase(&m_fs, m_page_addr[page], 1, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void flash_write(uint32_t addr, void const* p_data, uint32_t len)
+{
+    ret_code_t err_code = nrf_fstorage_write(&m_fs, addr, p_data, len, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for loading the latest value of every key from a page.
+ *
+ * @details A write that failed leaves its slot erased with records after it, the whole page
+ *          is read.
+ *
+ * @return Index of the slot after the last one used.
+ */
+static uint32_t page_load(uint8_t page)
+{
+    settings_record_t const* p_rec = page_records(page);
+    uint32_t next = 0;
+    uint32_t i;
+
+    for(i = 0; i < SETTINGS_RECORDS_PER_PAGE; i++)
+    {
+        if((p_rec[i].key == 0xFFFF) && (p_rec[i].check == 0xFFFF) && (p_rec[i].value == SETTINGS_ERASED))
+        {
+            continue;
+        }
+        next = i + 1;
+        // A record cut short is skipped, its slot stays used.
+        if((p_rec[i].key < SETTINGS_KEY_COUNT) && (p_rec[i].check == record_check(p_rec[i].key, p_rec[i].value)))
+        {
+            m_value[p_rec[i].key] = p_rec[i].value;
+            m_valid[p_rec[i].key] = true;
+        }
+    }
+    return next;
+}
+
+/**@brief Function for starting the compaction of the current values into the other page.
+ *
+ * @details The values are copied now, a key changed while the page is rewritten stays dirty
+ *          and is appended once the compaction is done.
+ */
+static void store_compact_start(void)
+{
+    m_compact_target = m_page ^ 1;
+    m_compact_count = 0;
+    m_dirty = 0;
+    for(uint8_t key = 0; key < SETTINGS_KEY_COUNT; key++)
+    {
+        if(m_valid[key])
+        {
+            m_store_record[m_compact_count].key = key;
+            m_store_record[m_compact_count].value = m_value[key];
+            m_store_record[m_compact_count].check = record_check(key, m_value[key]);
+            m_compact_count++;
+        }
+    }
+    m_store_header.magic = SETTINGS_MAGIC;
+    m_store_header.seq = m_seq + 1;
+
+    m_store_state = STORE_ERASE;
+    flash_erase(m_compact_target);
+}
+
+/**@brief Function for issuing the next flash operation, if any key is dirty.
+ *
+ * @details Called with the store idle, from settings_set() inside a critical region or from the
+ *          fstorage event handler. The state is set before the operation is started, since
+ *          without the SoftDevice fstorage reports the result before returning.
+ */
+static void store_next(void)
+{
+    uint8_t key;
+
+    if(m_dirty == 0)
+    {
+        m_store_state = STORE_IDLE;
+        return;
+    }
+    if(m_next >= SETTINGS_RECORDS_PER_PAGE)
+    {
+        store_compact_start();
+        return;
+    }
+
+    for(key = 0; (m_dirty & (1 << key)) == 0; key++)
+    {
+    }
+    m_dirty &= ~(1 << key);
+    m_store_key = key;
+    m_store_record[0].key = key;
+    m_store_record[0].value = m_value[key];
+    m_store_record[0].check = record_check(key, m_value[key]);
+
+    // The slot is used even if the write fails, a partial record is skipped on load.
+    m_store_state = STORE_RECORD;
+    m_next++;
+    flash_write((uint32_t)&page_records(m_page)[m_next - 1], &m_store_record[0], sizeof(settings_record_t));
+}
+
+/**@brief Function for handling a failed flash operation.
+ *
+ * @details A record is written again to the next slot, a compaction restarts from the erase.
+ *          After SETTINGS_RETRY_MAX failures in a row the keys stay dirty for the next
+ *          settings_set() or settings_flush().
+ */
+static void store_failed(void)
+{
+    bool compacting = (m_store_state != STORE_RECORD);
+
+    if(!compacting)
+    {
+        m_dirty |= 1 << m_store_key;
+    }
+    else
+    {
+        for(uint8_t key = 0; key < SETTINGS_KEY_COUNT; key++)
+        {
+            m_dirty |= m_valid[key] ? (1 << key) : 0;
+        }
+        // On the first boot the current page has no header yet, nothing is appended to it
+        // before a compaction has gone through.
+        m_next = SETTINGS_RECORDS_PER_PAGE;
+    }
+    m_store_state = STORE_IDLE;
+
+    if(m_retries < SETTINGS_RETRY_MAX)
+    {
+        m_retries++;
+        store_next();
+    }
+}
+
+/**@brief Function for advancing the store when a flash operation has completed. */
+static void settings_fs_evt_handler(nrf_fstorage_evt_t* p_evt)
+{
+    if(p_evt->result != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Settings flash operation failed: 0x%x", p_evt->result);
+        store_failed();
+        return;
+    }
+    m_retries = 0;
+
+    switch(m_store_state)
+    {
+        case STORE_RECORD:
+            m_stats.writes++;
+            store_next();
+            break;
+
+        case STORE_ERASE:
+            if(m_compact_count > 0)
+            {
+                m_store_state = STORE_COMPACT_DATA;
+                flash_write((uint32_t)page_records(m_compact_target), m_store_record, m_compact_count * sizeof(settings_record_t));
+                break;
+            }
+            // fall through
+
+        case STORE_COMPACT_DATA:
+            // The old page stays valid until the next compaction erases it, the higher seq wins.
+            m_store_state = STORE_COMPACT_HEADER;
+            flash_write(m_page_addr[m_compact_target], &m_store_header, sizeof(settings_header_t));
+            break;
+
+        case STORE_COMPACT_HEADER:
+            m_page = m_compact_target;
+            m_seq = m_store_header.seq;
+            m_next = m_compact_count;
+            m_stats.compactions++;
+            NRF_LOG_INFO("Settings compacted to page %d, seq %d", m_page, m_seq);
+            store_next();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**@brief Function for finding the newest settings page and loading it.
+ *
+ * @details Pages without a header but holding a word at their start come from the firmware
+ *          that stored one value per page (BLE_CTL_ADDR, BAT_LVL_ADDR); those values are moved
+ *          into the log. Must be called before the values are used.
+ */
+void settings_init(void)
+{
+    ret_code_t err_code;
+    bool valid0, valid1;
+
+    err_code = nrf_fstorage_init(&m_fs, &nrf_fstorage_sd, NULL);
+    APP_ERROR_CHECK(err_code);
+
+    valid0 = page_valid(0);
+    valid1 = page_valid(1);
+    if(valid0 || valid1)
+    {
+        m_page = (valid0 && (!valid1 || (page_header(0)->seq > page_header(1)->seq))) ? 0 : 1;
+        m_seq = page_header(m_page)->seq;
+        m_next = page_load(m_page);
+        NRF_LOG_INFO("Settings page %d, %d records", m_page, m_next);
+        return;
+    }
+
+    for(uint8_t page = 0; page < SETTINGS_PAGE_COUNT; page++)
+    {
+        uint32_t legacy = *(uint32_t const*)m_page_addr[page];
+        // A magic without its sequence is a format cut by a reset, not a value.
+        if((legacy != SETTINGS_ERASED) && (legacy != SETTINGS_MAGIC))
+        {
+            m_value[m_legacy_key[page]] = legacy;
+            m_valid[m_legacy_key[page]] = true;
+        }
+    }
+    // Format page 1. A reset before its header is written loses at most the battery level,
+    // which is measured again, the advertising switch stays in page 0 until the next boot.
+    m_seq = 0;
+    m_page = 0;
+    store_compact_start();
+    settings_flush();
+}
+
+bool settings_get(settings_key_t key, uint32_t* p_value)
+{
+    if((key >= SETTINGS_KEY_COUNT) || !m_valid[key])
+    {
+        return false;
+    }
+    *p_value = m_value[key];
+    return true;
+}
+
+/**@brief Function for storing a value.
+ *
+ * @details The RAM copy is updated and the key marked dirty, the record is written in the
+ *          background and completion arrives through the fstorage event handler. Repeated
+ *          updates of a key before its record is written cost a single record.
+ */
+void settings_set(settings_key_t key, uint32_t value)
+{
+    if((key >= SETTINGS_KEY_COUNT) || (m_valid[key] && (m_value[key] == value)))
+    {
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    m_value[key] = value;
+    m_valid[key] = true;
+    m_dirty |= 1 << key;
+    if(m_store_state == STORE_IDLE)
+    {
+        m_retries = 0;
+        store_next();
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+bool settings_busy(void)
+{
+    return (m_store_state != STORE_IDLE) || (m_dirty != 0);
+}
+
+/**@brief Function for waiting until the flash operation in progress has completed.
+ *
+ * @details For a reset or DFU only, the records still dirty afterwards are written as well.
+ */
+void settings_flush(void)
+{
+    bool retried = false;
+
+    while(settings_busy())
+    {
+        if(m_store_state == STORE_IDLE)
+        {
+            // Left dirty by a failed operation, give it one more chance.
+            if(retried)
+            {
+                break;
+            }
+            retried = true;
+            CRITICAL_REGION_ENTER();
+            store_next();
+            CRITICAL_REGION_EXIT();
+        }
+    }
+}
+
+settings_stats_t const* settings_stats_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,30 @@
+#ifndef __NORDIC_52832_SETTINGS_
+#define __NORDIC_52832_SETTINGS_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SETTINGS_PAGE0_ADDR 0x6f000 // former BLE_CTL_ADDR page
+#define SETTINGS_PAGE1_ADDR 0x70000 // former BAT_LVL_ADDR page
+#define SETTINGS_PAGE_SIZE  0x1000
+
+typedef enum
+{
+    SETTINGS_KEY_BLE_CTL, // advertising switch, 0xBADC0FFE on / 0xABABABAB off
+    SETTINGS_KEY_BAT_LVL, // backup battery level, 0..4
+    SETTINGS_KEY_COUNT
+} settings_key_t;
+
+typedef struct
+{
+    uint32_t writes;      // records appended
+    uint32_t compactions; // page erases caused by a full page
+} settings_stats_t;
+
+void settings_init(void);
+bool settings_get(settings_key_t key, uint32_t* p_value);
+void settings_set(settings_key_t key, uint32_t value);
+bool settings_busy(void);
+void settings_flush(void);
+settings_stats_t const* settings_stats_get(void);
+#endif
@@ -0,0 +1,232 @@
+#include "flash_model.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define OP_QUEUE_SIZE 4
+
+typedef struct
+{
+    nrf_fstorage_t const* p_fs;
+    nrf_fstorage_evt_id_t id;
+    uint32_t addr;
+    void const* p_src;
+    uint32_t len;
+    uint64_t done_us;
+} flash_op_t;
+
+nrf_fstorage_api_t nrf_fstorage_sd;
+flash_model_stats_t* flash_model_stats;
+uint64_t flash_model_now_us;
+
+static uint32_t m_start, m_pages;
+static bool m_async;
+static uint32_t m_latency_max_us, m_seed;
+static int32_t m_cut = -1;
+static uint32_t m_fail;
+static flash_op_t m_ops[OP_QUEUE_SIZE];
+static uint32_t m_op_head, m_op_count;
+
+void flash_model_init(uint32_t start_addr, uint32_t pages)
+{
+    void* p = mmap((void*)(uintptr_t)start_addr, pages * FLASH_MODEL_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(p != (void*)(uintptr_t)start_addr)
+    {
+        perror("flash model mmap");
+        exit(1);
+    }
+    flash_model_stats = mmap(NULL, sizeof(flash_model_stats_t), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(flash_model_stats == MAP_FAILED)
+    {
+        perror("flash model stats mmap");
+        exit(1);
+    }
+    m_start = start_addr;
+    m_pages = pages;
+    flash_model_erase_all();
+}
+
+void flash_model_erase_all(void)
+{
+    memset((void*)(uintptr_t)m_start, 0xFF, m_pages * FLASH_MODEL_PAGE_SIZE);
+    memset(flash_model_stats, 0, sizeof(flash_model_stats_t));
+}
+
+void flash_model_sync(void)
+{
+    m_async = false;
+}
+
+void flash_model_async(uint32_t latency_max_us, uint32_t seed)
+{
+    m_async = true;
+    m_latency_max_us = latency_max_us;
+    m_seed = seed;
+}
+
+void flash_model_cut_after(int32_t steps)
+{
+    m_cut = steps;
+}
+
+void flash_model_fail_next(uint32_t count)
+{
+    m_fail = count;
+}
+
+static void cut_step(void)
+{
+    if(m_cut < 0)
+    {
+        return;
+    }
+    if(m_cut == 0)
+    {
+        _exit(FLASH_MODEL_CUT_EXIT);
+    }
+    m_cut--;
+}
+
+static void apply(flash_op_t const* p_op)
+{
+    uint32_t* p_dst = (uint32_t*)(uintptr_t)p_op->addr;
+    uint32_t const* p_src = p_op->p_src;
+    uint32_t i;
+
+    if(p_op->id == NRF_FSTORAGE_EVT_ERASE_RESULT)
+    {
+        if(m_cut == 0)
+        {
+            /* Interrupted erase: only the start of the page is back to 0xFF. */
+            memset(p_dst, 0xFF, FLASH_MODEL_PAGE_SIZE / 2);
+        }
+        cut_step();
+        memset(p_dst, 0xFF, FLASH_MODEL_PAGE_SIZE);
+        flash_model_stats->erases[(p_op->addr - m_start) / FLASH_MODEL_PAGE_SIZE]++;
+        flash_model_stats->busy_us += FLASH_MODEL_ERASE_US;
+        return;
+    }
+    for(i = 0; i < p_op->len / 4; i++)
+    {
+        cut_step();
+        if(p_dst[i] != 0xFFFFFFFF)
+        {
+            flash_model_stats->overwrites++;
+        }
+        p_dst[i] &= p_src[i];
+        flash_model_stats->words++;
+        flash_model_stats->busy_us += FLASH_MODEL_WORD_US;
+    }
+}
+
+static void complete(flash_op_t const* p_op)
+{
+    nrf_fstorage_evt_t evt = {
+        .id = p_op->id,
+        .result = NRF_SUCCESS,
+        .addr = p_op->addr,
+        .p_src = p_op->p_src,
+        .len = p_op->len,
+    };
+    if(m_fail > 0)
+    {
+        m_fail--;
+        evt.result = NRF_ERROR_TIMEOUT;
+    }
+    else
+    {
+        apply(p_op);
+    }
+    p_op->p_fs->evt_handler(&evt);
+}
+
+static ret_code_t submit(nrf_fstorage_t const* p_fs, nrf_fstorage_evt_id_t id, uint32_t addr,
+                         void const* p_src, uint32_t len)
+{
+    flash_op_t op = {p_fs, id, addr, p_src, len, 0};
+    flash_op_t* p_last;
+    uint64_t start;
+
+    if(addr < p_fs->start_addr || addr + len > p_fs->end_addr || (addr & 3) || (len & 3))
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+    if(!m_async)
+    {
+        complete(&op);
+        return NRF_SUCCESS;
+    }
+    if(m_op_count >= OP_QUEUE_SIZE)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    /* Operations run one after the other, each in a timeslot granted after a radio event. */
+    start = flash_model_now_us;
+    if(m_op_count > 0)
+    {
+        p_last = &m_ops[(m_op_head + m_op_count - 1) % OP_QUEUE_SIZE];
+        start = p_last->done_us > start ? p_last->done_us : start;
+    }
+    m_seed = m_seed * 1103515245 + 12345;
+    start += m_latency_max_us ? (m_seed >> 8) % (m_latency_max_us + 1) : 0;
+    op.done_us = start + (id == NRF_FSTORAGE_EVT_ERASE_RESULT ? FLASH_MODEL_ERASE_US : (len / 4) * FLASH_MODEL_WORD_US);
+    m_ops[(m_op_head + m_op_count) % OP_QUEUE_SIZE] = op;
+    m_op_count++;
+    return NRF_SUCCESS;
+}
+
+bool flash_model_pending(void)
+{
+    return m_op_count > 0;
+}
+
+uint64_t flash_model_next_us(void)
+{
+    return m_op_count > 0 ? m_ops[m_op_head].done_us : UINT64_MAX;
+}
+
+void flash_model_run_next(void)
+{
+    flash_op_t op;
+
+    if(m_op_count == 0)
+    {
+        return;
+    }
+    op = m_ops[m_op_head];
+    m_op_head = (m_op_head + 1) % OP_QUEUE_SIZE;
+    m_op_count--;
+    flash_model_now_us = op.done_us;
+    complete(&op);
+}
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t* p_fs, nrf_fstorage_api_t* p_api, void* p_param)
+{
+    (void)p_param;
+    p_fs->p_api = p_api;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const* p_fs, uint32_t dest, void const* p_src, uint32_t len, void* p_param)
+{
+    (void)p_param;
+    return submit(p_fs, NRF_FSTORAGE_EVT_WRITE_RESULT, dest, p_src, len);
+}
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const* p_fs, uint32_t page_addr, uint32_t len, void* p_param)
+{
+    (void)p_param;
+    if(len != 1)
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+    return submit(p_fs, NRF_FSTORAGE_EVT_ERASE_RESULT, page_addr, NULL, FLASH_MODEL_PAGE_SIZE);
+}
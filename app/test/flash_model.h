@@ -0,0 +1,49 @@
+/* Flash of the nRF52832 for host tests: the pages are mapped at their real addresses so the
+   module under test reads them in place, and nrf_fstorage_* program them with NOR rules
+   (a write only clears bits, an erase sets the page to 0xFF). */
+#ifndef FLASH_MODEL_H__
+#define FLASH_MODEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLASH_MODEL_PAGE_SIZE 0x1000
+#define FLASH_MODEL_PAGES_MAX 4
+#define FLASH_MODEL_ERASE_US  85000 /* nRF52832 worst case page erase */
+#define FLASH_MODEL_WORD_US   41    /* nRF52832 worst case word write */
+#define FLASH_MODEL_CUT_EXIT  42    /* exit status of a process stopped by a power cut */
+
+typedef struct
+{
+    uint32_t erases[FLASH_MODEL_PAGES_MAX];
+    uint32_t words;      /* words programmed */
+    uint32_t overwrites; /* words programmed that were not erased, a bug in the caller */
+    uint64_t busy_us;    /* time the flash was erasing or programming */
+} flash_model_stats_t;
+
+/* Shared with forked processes, so a "boot" can run in a child and the parent sees its
+   flash and counters. */
+extern flash_model_stats_t* flash_model_stats;
+extern uint64_t flash_model_now_us;
+
+void flash_model_init(uint32_t start_addr, uint32_t pages);
+void flash_model_erase_all(void);
+
+/* Completes operations inside the nrf_fstorage_* call, as fstorage does without the
+   SoftDevice. This is the default. */
+void flash_model_sync(void);
+/* Queues operations. Each one starts after a random SoftDevice latency of up to
+   latency_max_us and completes from flash_model_run_next(). */
+void flash_model_async(uint32_t latency_max_us, uint32_t seed);
+bool flash_model_pending(void);
+uint64_t flash_model_next_us(void);
+void flash_model_run_next(void);
+
+/* Cuts the power once `steps` more words have been programmed or erases started: the step
+   in progress is left half done and the process exits with FLASH_MODEL_CUT_EXIT. -1 never. */
+void flash_model_cut_after(int32_t steps);
+
+/* The next `count` operations complete with NRF_ERROR_TIMEOUT and leave the flash untouched,
+   as fstorage reports an operation the SoftDevice refused NRF_FSTORAGE_SD_MAX_RETRIES times. */
+void flash_model_fail_next(uint32_t count);
+#endif
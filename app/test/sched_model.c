@@ -0,0 +1,72 @@
+#include "sched_model.h"
+#include "app_scheduler.h"
+
+#include <string.h>
+
+typedef struct
+{
+    app_sched_event_handler_t handler;
+    uint16_t size;
+    uint8_t data[SCHED_MODEL_DATA_MAX];
+} sched_event_t;
+
+sched_model_stats_t sched_model_stats;
+
+static sched_event_t m_queue[SCHED_MODEL_QUEUE_MAX];
+static uint32_t m_size = 16, m_head, m_count;
+
+void sched_model_init(uint32_t queue_size)
+{
+    m_size = queue_size < SCHED_MODEL_QUEUE_MAX ? queue_size : SCHED_MODEL_QUEUE_MAX;
+    m_head = 0;
+    m_count = 0;
+    memset(&sched_model_stats, 0, sizeof(sched_model_stats));
+}
+
+uint32_t sched_model_queued(void)
+{
+    return m_count;
+}
+
+ret_code_t app_sched_event_put(void const* p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+    sched_event_t* p_evt;
+
+    if(event_size > SCHED_MODEL_DATA_MAX)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if(m_count >= m_size)
+    {
+        sched_model_stats.full++;
+        return NRF_ERROR_NO_MEM;
+    }
+    p_evt = &m_queue[(m_head + m_count) % SCHED_MODEL_QUEUE_MAX];
+    p_evt->handler = handler;
+    p_evt->size = event_size;
+    if(p_event_data != NULL)
+    {
+        memcpy(p_evt->data, p_event_data, event_size);
+    }
+    m_count++;
+    if(m_count > sched_model_stats.high_water)
+    {
+        sched_model_stats.high_water = m_count;
+    }
+    return NRF_SUCCESS;
+}
+
+/* Runs the events queued, also those put by the handlers, until the queue is empty. */
+void app_sched_execute(void)
+{
+    sched_event_t evt;
+
+    while(m_count > 0)
+    {
+        evt = m_queue[m_head];
+        m_head = (m_head + 1) % SCHED_MODEL_QUEUE_MAX;
+        m_count--;
+        sched_model_stats.executed++;
+        evt.handler(evt.size ? evt.data : NULL, evt.size);
+    }
+}
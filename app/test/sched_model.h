@@ -0,0 +1,23 @@
+/* app_scheduler for host tests: the same bounded FIFO with event data copied in, plus the
+   counters the tests check. */
+#ifndef SCHED_MODEL_H__
+#define SCHED_MODEL_H__
+
+#include <stdint.h>
+
+#define SCHED_MODEL_DATA_MAX  64 /* SCHED_MAX_EVENT_DATA_SIZE of main.c */
+#define SCHED_MODEL_QUEUE_MAX 32
+
+typedef struct
+{
+    uint32_t executed;   /* events run */
+    uint32_t full;       /* puts refused */
+    uint32_t high_water; /* most events queued at once */
+} sched_model_stats_t;
+
+extern sched_model_stats_t sched_model_stats;
+
+/* Empties the queue, queue_size at most SCHED_MODEL_QUEUE_MAX. */
+void sched_model_init(uint32_t queue_size);
+uint32_t sched_model_queued(void);
+#endif
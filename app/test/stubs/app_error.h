@@ -0,0 +1,26 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef APP_ERROR_H__
+#define APP_ERROR_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+#define APP_ERROR_HANDLER(err_code)                                                   \
+    do                                                                            \
+    {                                                                             \
+        printf("%s:%d: error 0x%x\n", __FILE__, __LINE__, (unsigned)(err_code)); \
+        abort();                                                                  \
+    } while(0)
+
+#define APP_ERROR_CHECK(err_code)                                                 \
+    do                                                                            \
+    {                                                                             \
+        if((err_code) != NRF_SUCCESS)                                             \
+        {                                                                         \
+            printf("%s:%d: error 0x%x\n", __FILE__, __LINE__, (unsigned)(err_code)); \
+            abort();                                                              \
+        }                                                                         \
+    } while(0)
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. The
+   queue is sched_model.c. */
+#ifndef APP_SCHEDULER_H__
+#define APP_SCHEDULER_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+typedef void (*app_sched_event_handler_t)(void* p_event_data, uint16_t event_size);
+
+ret_code_t app_sched_event_put(void const* p_event_data, uint16_t event_size, app_sched_event_handler_t handler);
+void app_sched_execute(void);
+#endif
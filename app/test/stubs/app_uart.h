@@ -0,0 +1,4 @@
+/* Host stand-in for the SDK header of the same name, nothing of it is used by the tested modules. */
+#ifndef APP_UART_H__
+#define APP_UART_H__
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef APP_UTIL_H__
+#define APP_UTIL_H__
+
+enum
+{
+    UNIT_0_625_MS = 625,
+    UNIT_1_25_MS = 1250,
+    UNIT_10_MS = 10000
+};
+
+#define MSEC_TO_UNITS(TIME, RESOLUTION) (((TIME) * 1000) / (RESOLUTION))
+#endif
@@ -0,0 +1,24 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. The
+   test provides ble_conn_params_change_conn_params(). */
+#ifndef BLE_CONN_PARAMS_H__
+#define BLE_CONN_PARAMS_H__
+
+#include <stdint.h>
+#include "app_util.h"
+#include "ble_gap.h"
+#include "sdk_errors.h"
+
+typedef enum
+{
+    BLE_CONN_PARAMS_EVT_FAILED,
+    BLE_CONN_PARAMS_EVT_SUCCEEDED
+} ble_conn_params_evt_type_t;
+
+typedef struct
+{
+    ble_conn_params_evt_type_t evt_type;
+    uint16_t conn_handle;
+} ble_conn_params_evt_t;
+
+ret_code_t ble_conn_params_change_conn_params(uint16_t conn_handle, ble_gap_conn_params_t* p_new_params);
+#endif
@@ -0,0 +1,16 @@
+/* Host stand-in for the SoftDevice header of the same name, only what the tested modules use. */
+#ifndef BLE_GAP_H__
+#define BLE_GAP_H__
+
+#include <stdint.h>
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+
+typedef struct
+{
+    uint16_t min_conn_interval;
+    uint16_t max_conn_interval;
+    uint16_t slave_latency;
+    uint16_t conn_sup_timeout;
+} ble_gap_conn_params_t;
+#endif
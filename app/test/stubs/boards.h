@@ -0,0 +1,15 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef BOARDS_H
+#define BOARDS_H
+
+#include <stdint.h>
+
+// custom_board.h
+#define TWI_STATUS_GPIO 25
+#define MASTER_TWI_INST 0
+#define TWI_SCL_M       27
+#define TWI_SDA_M       26
+#define SLAVE_ADDR      0x48
+
+uint32_t nrf_gpio_pin_read(uint32_t pin_number);
+#endif
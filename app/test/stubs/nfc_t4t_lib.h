@@ -0,0 +1,35 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef NFC_T4T_LIB_H__
+#define NFC_T4T_LIB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+
+typedef enum
+{
+    NFC_T4T_EVENT_NONE,
+    NFC_T4T_EVENT_FIELD_ON,
+    NFC_T4T_EVENT_FIELD_OFF,
+    NFC_T4T_EVENT_NDEF_READ,
+    NFC_T4T_EVENT_NDEF_UPDATED,
+    NFC_T4T_EVENT_DATA_TRANSMITTED,
+    NFC_T4T_EVENT_DATA_IND,
+} nfc_t4t_event_t;
+
+typedef enum
+{
+    NFC_T4T_DI_FLAG_NONE = 0x00,
+    NFC_T4T_DI_FLAG_MORE = 0x01
+} nfc_t4t_data_ind_flags_t;
+
+typedef void (*nfc_t4t_callback_t)(void* p_context,
+                                   nfc_t4t_event_t event,
+                                   const uint8_t* p_data,
+                                   size_t data_length,
+                                   uint32_t flags);
+
+ret_code_t nfc_t4t_setup(nfc_t4t_callback_t callback, void* p_context);
+ret_code_t nfc_t4t_response_pdu_send(const uint8_t* p_pdu, size_t pdu_length);
+ret_code_t nfc_t4t_emulation_start(void);
+#endif
@@ -0,0 +1,6 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef NORDIC_COMMON_H__
+#define NORDIC_COMMON_H__
+
+#define UNUSED_PARAMETER(X) ((void)(X))
+#endif
@@ -0,0 +1,23 @@
+/* Host stand-in for the SDK header of the same name, only the SHA-256 hash the tested modules
+   use. The test links it to the SDK's sha256.c. */
+#ifndef NRF_CRYPTO_H__
+#define NRF_CRYPTO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+#include "sha256.h"
+
+typedef struct
+{
+    int unused;
+} nrf_crypto_hash_info_t;
+
+typedef sha256_context_t nrf_crypto_hash_context_t;
+
+extern const nrf_crypto_hash_info_t g_nrf_crypto_hash_sha256_info;
+
+ret_code_t nrf_crypto_hash_init(nrf_crypto_hash_context_t* p_context, nrf_crypto_hash_info_t const* p_info);
+ret_code_t nrf_crypto_hash_update(nrf_crypto_hash_context_t* p_context, uint8_t const* p_data, size_t data_size);
+ret_code_t nrf_crypto_hash_finalize(nrf_crypto_hash_context_t* p_context, uint8_t* p_digest, size_t* p_digest_size);
+#endif
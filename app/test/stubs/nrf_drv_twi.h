@@ -0,0 +1,63 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. The
+   driver is implemented by the test. */
+#ifndef NRF_DRV_TWI_H__
+#define NRF_DRV_TWI_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdk_errors.h"
+
+typedef struct
+{
+    uint8_t inst_idx;
+} nrf_drv_twi_t;
+
+#define NRF_DRV_TWI_INSTANCE(id) {.inst_idx = (id)}
+
+typedef enum
+{
+    NRF_DRV_TWI_FREQ_100K,
+    NRF_DRV_TWI_FREQ_250K,
+    NRF_DRV_TWI_FREQ_400K
+} nrf_drv_twi_frequency_t;
+
+typedef struct
+{
+    uint32_t scl;
+    uint32_t sda;
+    nrf_drv_twi_frequency_t frequency;
+    uint8_t interrupt_priority;
+    bool clear_bus_init;
+    bool hold_bus_uninit;
+} nrf_drv_twi_config_t;
+
+typedef enum
+{
+    NRF_DRV_TWI_EVT_DONE,
+    NRF_DRV_TWI_EVT_ADDRESS_NACK,
+    NRF_DRV_TWI_EVT_DATA_NACK
+} nrf_drv_twi_evt_type_t;
+
+typedef struct
+{
+    nrf_drv_twi_evt_type_t type;
+} nrf_drv_twi_evt_t;
+
+typedef void (*nrf_drv_twi_evt_handler_t)(nrf_drv_twi_evt_t const* p_event, void* p_context);
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const* p_instance,
+                            nrf_drv_twi_config_t const* p_config,
+                            nrf_drv_twi_evt_handler_t event_handler,
+                            void* p_context);
+void nrf_drv_twi_enable(nrf_drv_twi_t const* p_instance);
+ret_code_t nrf_drv_twi_tx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t const* p_data,
+                          uint8_t length,
+                          bool no_stop);
+ret_code_t nrf_drv_twi_rx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t* p_data,
+                          uint8_t length);
+bool nrf_drv_twi_is_busy(nrf_drv_twi_t const* p_instance);
+#endif
@@ -0,0 +1,8 @@
+/* Host stand-in for the SDK header of the same name. */
+#ifndef NRF_FSTORAGE_SD_H__
+#define NRF_FSTORAGE_SD_H__
+
+#include "nrf_fstorage.h"
+
+extern nrf_fstorage_api_t nrf_fstorage_sd;
+#endif
@@ -0,0 +1,9 @@
+/* Host stand-in for the SDK header of the same name, logging is dropped. */
+#ifndef NRF_LOG_H__
+#define NRF_LOG_H__
+
+#define NRF_LOG_ERROR(...)
+#define NRF_LOG_WARNING(...)
+#define NRF_LOG_INFO(...)
+#define NRF_LOG_DEBUG(...)
+#endif
@@ -0,0 +1 @@
+/* Host stand-in for the SDK header of the same name, see nrf_log.h. */
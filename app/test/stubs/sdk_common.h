@@ -0,0 +1,24 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef SDK_COMMON_H__
+#define SDK_COMMON_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+#define NRF_MODULE_ENABLED(module) ((defined(module##_ENABLED) && (module##_ENABLED)) ? 1 : 0)
+
+#define VERIFY_PARAM_NOT_NULL(param) \
+    do                               \
+    {                                \
+        if((param) == NULL)          \
+        {                            \
+            return NRF_ERROR_NULL;   \
+        }                            \
+    } while(0)
+
+/* cmsis_gcc.h, the hosts the tests run on are little endian like the nRF52. */
+#define __REV(value) __builtin_bswap32(value)
+#endif
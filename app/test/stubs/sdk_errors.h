@@ -0,0 +1,20 @@
+/* Host stand-in for the SDK header of the same name, only what the tested modules use. */
+#ifndef SDK_ERRORS_H__
+#define SDK_ERRORS_H__
+
+#include <stdint.h>
+
+typedef uint32_t ret_code_t;
+
+#define NRF_SUCCESS              0
+#define NRF_ERROR_INTERNAL       3
+#define NRF_ERROR_NO_MEM         4
+#define NRF_ERROR_NOT_FOUND      5
+#define NRF_ERROR_INVALID_PARAM  7
+#define NRF_ERROR_INVALID_STATE  8
+#define NRF_ERROR_INVALID_LENGTH 9
+#define NRF_ERROR_TIMEOUT        13
+#define NRF_ERROR_NULL           14
+#define NRF_ERROR_BUSY           17
+#define NRF_ERROR_RESOURCES      19
+#endif
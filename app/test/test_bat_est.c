@@ -0,0 +1,369 @@
+/* Replays synthetic battery traces through bat_est.c and through the logic it replaced, the
+   saadc_event_handler() filter and the 1 s timer smoothing, and counts the changes of the level
+   reported to the ST. Samples every 5 s as ADC codes, about 8 mV of noise and a load dip of
+   60-200 mV on 1% of the samples. The seed is fixed, the counts are reproducible. Also prints
+   the time per sample of both estimators. */
+
+#include "bat_est.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_S   5
+#define DIP_PERMIL 10
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+static uint32_t m_rand;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+/* Sum of four uniforms in -8..8, close to normal with a deviation of about 8 mV. */
+static int noise_mv(void)
+{
+    int sum = 0;
+    int i;
+
+    for(i = 0; i < 4; i++)
+    {
+        sum += (int)(rand_next() % 17) - 8;
+    }
+    return sum;
+}
+
+/* What the SAADC hands to saadc_event_handler(): the voltage as a 10 bit code converted back
+   with ADC_RESULT_IN_MILLI_VOLTS(). */
+static uint16_t measure(int mv)
+{
+    int code;
+
+    mv += noise_mv();
+    if(rand_next() % 1000 < DIP_PERMIL)
+    {
+        mv -= 60 + (int)(rand_next() % 141);
+    }
+    code = mv * 1024 / 3600;
+    code = code < 0 ? 0 : (code > 1024 ? 1024 : code);
+    return (uint16_t)(((code * 600) / 1024) * 6);
+}
+
+/* The former estimator, as it was in adc.h and timer.h. */
+typedef struct
+{
+    uint16_t last_mv;
+    uint16_t count_usb_ins;
+    uint8_t power_change;
+    uint8_t level;
+    uint8_t reported;
+} old_est_t;
+
+static void old_init(old_est_t* p)
+{
+    memset(p, 0, sizeof(*p));
+    p->level = 0xFF;
+    p->reported = 0xFF;
+}
+
+// Not inlined, so it is timed under the same call overhead as bat_est_sample().
+__attribute__((noinline)) static void old_sample(old_est_t* p, uint16_t mv, int usb_in)
+{
+    uint16_t charge_time = 0;
+    uint8_t level;
+
+    if(p->last_mv == 0)
+    {
+        p->last_mv = (mv > 2000 && mv <= 3600) ? mv : 0;
+        if(usb_in)
+        {
+            mv -= 100;
+        }
+    }
+    if(usb_in)
+    {
+        mv = (mv > 2000 && mv <= 3600) ? mv - 100 : p->last_mv;
+        if(mv > p->last_mv)
+        {
+            p->last_mv = mv;
+        }
+        if(p->level == 0xFF)
+        {
+            p->last_mv -= 168;
+            p->level = bat_est_level_from_mv(p->last_mv);
+        }
+        p->power_change = 1;
+        p->count_usb_ins++;
+        if(p->level == 0)
+        {
+            charge_time = 60;
+        }
+        else if(p->level == 1)
+        {
+            charge_time = 240;
+        }
+        else if(p->level == 2 || p->level == 3)
+        {
+            charge_time = 300;
+        }
+        if(p->count_usb_ins > charge_time)
+        {
+            p->count_usb_ins = 0;
+            if(p->level < 4)
+            {
+                p->level++;
+            }
+        }
+        return;
+    }
+
+    p->count_usb_ins = 0;
+    if(p->power_change)
+    {
+        p->last_mv = mv;
+        level = bat_est_level_from_mv(p->last_mv);
+        if(level < p->level)
+        {
+            p->level = level;
+            p->power_change = 0;
+        }
+        return;
+    }
+    if(mv < 3000)
+    {
+        p->last_mv = mv;
+    }
+    else if(mv < p->last_mv && p->last_mv - mv < 40)
+    {
+        p->last_mv = mv;
+    }
+    p->level = bat_est_level_from_mv(p->last_mv);
+}
+
+static void old_report(old_est_t* p, int usb_in)
+{
+    if(usb_in)
+    {
+        if(p->reported != 0xFF && p->level != 0xFF)
+        {
+            p->reported = (p->level - p->reported > 1) ? p->reported + 1 : p->level;
+        }
+        else if(p->level == 0xFF)
+        {
+            p->level = p->reported;
+        }
+        else
+        {
+            p->reported = p->level;
+        }
+    }
+    else if(p->reported == 0xFF)
+    {
+        p->reported = p->level;
+    }
+    else if(p->reported > p->level)
+    {
+        p->reported = (p->reported - p->level > 1) ? p->reported - 1 : p->level;
+    }
+    else if(p->reported < p->level && p->level - p->reported < 2)
+    {
+        p->level = p->reported;
+    }
+    else if(p->reported < p->level)
+    {
+        p->reported = p->level;
+    }
+}
+
+/* Open circuit voltage of the trace at time t, and whether the charger is in. */
+typedef int (*trace_fn_t)(uint32_t t, int* p_usb_in);
+
+typedef struct
+{
+    uint32_t old_changes;
+    uint32_t new_changes;
+    uint8_t old_level;
+    uint8_t new_level;
+} replay_t;
+
+/* Every sample goes to both estimators, then the 1 s timer runs five times and reports
+   whenever the reported level differs from the estimate. */
+static replay_t replay(trace_fn_t trace, uint32_t duration_s)
+{
+    replay_t r = {0, 0, 0, 0};
+    old_est_t old_est;
+    bat_est_t est;
+    uint8_t old_prev = 0xFF, new_prev = 0xFF;
+    uint32_t t;
+    uint16_t mv;
+    int usb_in;
+    int tick;
+
+    m_rand = 0x2545F491;
+    old_init(&old_est);
+    bat_est_init(&est);
+    for(t = 0; t < duration_s; t += SAMPLE_S)
+    {
+        mv = measure(trace(t, &usb_in));
+        old_sample(&old_est, mv, usb_in);
+        bat_est_sample(&est, mv, usb_in);
+        for(tick = 0; tick < SAMPLE_S; tick++)
+        {
+            if(old_est.reported != old_est.level)
+            {
+                old_report(&old_est, usb_in);
+            }
+            if(est.reported != est.level)
+            {
+                bat_est_report(&est, usb_in);
+            }
+            r.old_changes += old_prev != 0xFF && old_est.reported != old_prev;
+            r.new_changes += new_prev != 0xFF && est.reported != new_prev;
+            old_prev = old_est.reported;
+            new_prev = est.reported;
+        }
+    }
+    r.old_level = old_est.reported;
+    r.new_level = est.reported;
+    return r;
+}
+
+#define DISCHARGE_S (3 * 24 * 3600)
+
+/* 3350 mV down to 2800 mV over three days, level 4 to 0. */
+static int trace_discharge(uint32_t t, int* p_usb_in)
+{
+    *p_usb_in = 0;
+    return 3350 - (int)((uint64_t)t * 550 / DISCHARGE_S);
+}
+
+#define CHARGE_S (2 * 3600)
+#define REST_S   (1 * 3600)
+
+/* 2950 mV at level 2, two hours on the charger, which reads 100 mV above the battery, while
+   the battery rises to 3200 mV, then an hour of rest at level 3. */
+static int trace_charge(uint32_t t, int* p_usb_in)
+{
+    *p_usb_in = t < CHARGE_S;
+    if(*p_usb_in)
+    {
+        return 2950 + (int)(t * 250 / CHARGE_S) + 100;
+    }
+    return 3200;
+}
+
+static int test_discharge(void)
+{
+    replay_t r = replay(trace_discharge, DISCHARGE_S);
+
+    printf("3 day discharge: %u reported level changes before, %u now\n", r.old_changes, r.new_changes);
+    CHECK(r.new_level == 0);
+    /* One step per level, a dip must not show up as a change. */
+    CHECK(r.new_changes == BAT_EST_LEVEL_MAX);
+    CHECK(r.new_changes < r.old_changes);
+    return 0;
+}
+
+static int test_charge(void)
+{
+    replay_t r = replay(trace_charge, CHARGE_S + REST_S);
+
+    printf("2 h charge then rest: %u reported level changes before, %u now, final level %u before, %u now\n",
+           r.old_changes, r.new_changes, r.old_level, r.new_level);
+    CHECK(r.new_level == bat_est_level_from_mv(3200));
+    CHECK(r.new_changes <= r.old_changes);
+    return 0;
+}
+
+/* A charger connected while the first samples are out of range, e.g. the ADC still settling. */
+static int test_charge_invalid_first(void)
+{
+    bat_est_t est;
+
+    bat_est_init(&est);
+    bat_est_sample(&est, 0, true);
+    CHECK(est.last_mv == 0 && est.level == BAT_EST_LEVEL_UNKNOWN);
+    bat_est_sample(&est, 1500, true);
+    CHECK(est.last_mv == 0 && est.level == BAT_EST_LEVEL_UNKNOWN);
+
+    bat_est_init(&est);
+    bat_est_sample(&est, 3150, true);
+    CHECK(est.last_mv == 3150 - 168 && est.level == bat_est_level_from_mv(3150 - 168));
+    return 0;
+}
+
+#define COST_SAMPLES (DISCHARGE_S / SAMPLE_S)
+#define COST_ROUNDS  200
+
+static uint16_t m_cost_mv[COST_SAMPLES];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Time per sample of each estimator over the recorded discharge trace, best of COST_ROUNDS
+   passes. The host figure only compares the two, it is not the Cortex-M4 cost. */
+static void report_cost(void)
+{
+    old_est_t old_est;
+    bat_est_t est;
+    double t0, old_ns = 1e30, new_ns = 1e30;
+    uint32_t i, round;
+    int usb_in;
+
+    m_rand = 0x2545F491;
+    for(i = 0; i < COST_SAMPLES; i++)
+    {
+        m_cost_mv[i] = measure(trace_discharge(i * SAMPLE_S, &usb_in));
+    }
+    for(round = 0; round < COST_ROUNDS; round++)
+    {
+        old_init(&old_est);
+        t0 = now_ns();
+        for(i = 0; i < COST_SAMPLES; i++)
+        {
+            old_sample(&old_est, m_cost_mv[i], 0);
+        }
+        t0 = now_ns() - t0;
+        old_ns = t0 < old_ns ? t0 : old_ns;
+
+        bat_est_init(&est);
+        t0 = now_ns();
+        for(i = 0; i < COST_SAMPLES; i++)
+        {
+            bat_est_sample(&est, m_cost_mv[i], false);
+        }
+        t0 = now_ns() - t0;
+        new_ns = t0 < new_ns ? t0 : new_ns;
+    }
+    printf("per sample on this host: %.2f ns before, %.2f ns now\n",
+           old_ns / COST_SAMPLES, new_ns / COST_SAMPLES);
+}
+
+int main(void)
+{
+    report_cost();
+    if(test_discharge() || test_charge() || test_charge_invalid_first())
+    {
+        return 1;
+    }
+    printf("battery estimate: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,223 @@
+/* Replays the UART_CMD_BAUD negotiation between the ST and baud_neg.c over a simulated
+   loopback. A frame only arrives intact when both ends run at the rate it was sent at, any
+   other frame shows up as a line error on the receiver, like a UARTE framing error. */
+
+#include "baud_neg.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define UART_CMD_BAUD 0x11
+
+#define CONFIRM_MS 500 /* UART_BAUD_CONFIRM_MS */
+
+typedef struct
+{
+    baud_neg_t neg;
+    uint32_t deadline; /* confirmation timer, 0 when stopped */
+    uint8_t rsp[BAUD_NEG_RSP_MAX];
+    uint8_t rsp_len;
+    uint8_t rsp_rate; /* rate the last reply was sent at */
+    int line_errors;
+} nrf_side_t;
+
+static nrf_side_t nrf;
+static uint8_t st_rate;
+static uint32_t now;
+
+static void nrf_reset(int hwfc)
+{
+    memset(&nrf, 0, sizeof(nrf));
+    baud_neg_init(&nrf.neg, hwfc);
+    st_rate = UART_BAUD_115200;
+    now = 0;
+}
+
+/* A5 5A | len(2) | cmd | data | xor, len counts cmd, data and xor. */
+static uint32_t frame_build(uint8_t* frame, const uint8_t* data, uint32_t data_len)
+{
+    uint32_t len = data_len + 2;
+    uint8_t x = 0;
+    uint32_t i;
+
+    frame[0] = 0xA5;
+    frame[1] = 0x5A;
+    frame[2] = (uint8_t)(len >> 8);
+    frame[3] = (uint8_t)len;
+    frame[4] = UART_CMD_BAUD;
+    memcpy(frame + 5, data, data_len);
+    for(i = 0; i < 5 + data_len; ++i)
+    {
+        x ^= frame[i];
+    }
+    frame[5 + data_len] = x;
+    return 6 + data_len;
+}
+
+/* What uart_frame_poll(), uart_cmd_baud() and uart_baud_request() do with a received frame.
+   Returns 1 if a reply was sent. */
+static int nrf_receive(const uint8_t* frame, uint8_t sent_rate)
+{
+    uint32_t lenth;
+
+    nrf.rsp_len = 0;
+    if(sent_rate != nrf.neg.code)
+    {
+        nrf.line_errors++;
+        if(nrf.neg.code != UART_BAUD_115200 && baud_neg_fallback(&nrf.neg))
+        {
+            nrf.deadline = 0;
+        }
+        return 0;
+    }
+
+    lenth = (((uint32_t)frame[2] << 8) + frame[3]) - 1;
+    nrf.rsp_rate = nrf.neg.code;
+    if(baud_neg_request(&nrf.neg, frame, lenth, nrf.rsp, &nrf.rsp_len) == BAUD_NEG_ACT_REPLY)
+    {
+        if(nrf.rsp[0] == BAUD_NEG_STATUS_OK)
+        {
+            nrf.deadline = 0;
+        }
+        return 1;
+    }
+    nrf.deadline = nrf.neg.pending ? now + CONFIRM_MS : 0;
+    return 1;
+}
+
+static void nrf_advance(uint32_t ms)
+{
+    now += ms;
+    if(nrf.deadline != 0 && now >= nrf.deadline)
+    {
+        nrf.deadline = 0;
+        if(nrf.neg.pending)
+        {
+            (void)baud_neg_fallback(&nrf.neg);
+        }
+    }
+}
+
+/* The ST sends a one byte request at its current rate. Returns 1 if it got a reply. */
+static int st_send_code(uint8_t code)
+{
+    uint8_t frame[16];
+
+    frame_build(frame, &code, 1);
+    if(!nrf_receive(frame, st_rate))
+    {
+        return 0;
+    }
+    return nrf.rsp_rate == st_rate;
+}
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+static int test_switch_confirmed(void)
+{
+    nrf_reset(0);
+    CHECK(st_send_code(UART_BAUD_460800));
+    CHECK(nrf.rsp_len == 2 && nrf.rsp[0] == BAUD_NEG_STATUS_OK && nrf.rsp[1] == UART_BAUD_460800);
+    CHECK(nrf.rsp_rate == UART_BAUD_115200);
+    CHECK(nrf.neg.code == UART_BAUD_460800 && nrf.neg.pending);
+
+    st_rate = UART_BAUD_460800;
+    nrf_advance(10);
+    CHECK(st_send_code(UART_BAUD_460800));
+    CHECK(nrf.rsp_len == 2 && nrf.rsp[0] == BAUD_NEG_STATUS_OK);
+    CHECK(nrf.rsp_rate == UART_BAUD_460800);
+    CHECK(!nrf.neg.pending && nrf.deadline == 0);
+
+    nrf_advance(CONFIRM_MS * 2);
+    CHECK(nrf.neg.code == UART_BAUD_460800);
+
+    /* Back down on request, no confirmation needed for the default rate. */
+    CHECK(st_send_code(UART_BAUD_115200));
+    CHECK(nrf.neg.code == UART_BAUD_115200 && !nrf.neg.pending && nrf.deadline == 0);
+    return 0;
+}
+
+static int test_confirm_timeout(void)
+{
+    nrf_reset(0);
+    CHECK(st_send_code(UART_BAUD_460800));
+    nrf_advance(CONFIRM_MS - 1);
+    CHECK(nrf.neg.code == UART_BAUD_460800);
+    nrf_advance(1);
+    CHECK(nrf.neg.code == UART_BAUD_115200 && !nrf.neg.pending);
+
+    /* The ST, still at 115200, is understood again. */
+    CHECK(st_send_code(UART_BAUD_460800));
+    CHECK(nrf.rsp[0] == BAUD_NEG_STATUS_OK);
+    return 0;
+}
+
+static int test_st_did_not_switch(void)
+{
+    nrf_reset(0);
+    CHECK(st_send_code(UART_BAUD_460800));
+    /* The ST missed the reply and repeats at 115200: a line error at 460800. */
+    CHECK(!st_send_code(UART_BAUD_460800));
+    CHECK(nrf.line_errors == 1);
+    CHECK(nrf.neg.code == UART_BAUD_115200 && !nrf.neg.pending && nrf.deadline == 0);
+    return 0;
+}
+
+static int test_refused(void)
+{
+    nrf_reset(0);
+    CHECK(st_send_code(UART_BAUD_921600));
+    CHECK(nrf.rsp_len == 2 && nrf.rsp[0] == BAUD_NEG_STATUS_FAILED && nrf.rsp[1] == UART_BAUD_921600);
+    CHECK(nrf.neg.code == UART_BAUD_115200);
+
+    CHECK(st_send_code(UART_BAUD_COUNT));
+    CHECK(nrf.rsp[0] == BAUD_NEG_STATUS_FAILED);
+
+    nrf_reset(1);
+    CHECK(st_send_code(UART_BAUD_1000000));
+    CHECK(nrf.rsp[0] == BAUD_NEG_STATUS_OK && nrf.neg.code == UART_BAUD_1000000);
+    return 0;
+}
+
+static int test_bad_length(void)
+{
+    uint8_t frame[16];
+    uint8_t data[2] = {UART_BAUD_460800, 0x00};
+
+    nrf_reset(0);
+    /* cmd only */
+    frame_build(frame, data, 0);
+    CHECK(nrf_receive(frame, st_rate));
+    CHECK(nrf.rsp_len == 1 && nrf.rsp[0] == BAUD_NEG_STATUS_FAILED);
+    /* cmd | code | extra */
+    frame_build(frame, data, 2);
+    CHECK(nrf_receive(frame, st_rate));
+    CHECK(nrf.rsp_len == 1 && nrf.rsp[0] == BAUD_NEG_STATUS_FAILED);
+    CHECK(nrf.neg.code == UART_BAUD_115200);
+
+    /* The code is the byte after cmd, not the xor that follows it. */
+    frame_build(frame, data, 1);
+    CHECK(frame[6] != UART_BAUD_460800);
+    CHECK(nrf_receive(frame, st_rate));
+    CHECK(nrf.rsp[1] == UART_BAUD_460800 && nrf.neg.code == UART_BAUD_460800);
+    return 0;
+}
+
+int main(void)
+{
+    if(test_switch_confirmed() || test_confirm_timeout() || test_st_did_not_switch() ||
+        test_refused() || test_bad_length())
+        {
+        return 1;
+    }
+    printf("baud negotiation: all tests passed\n");
+    return 0;
+}
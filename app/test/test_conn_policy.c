@@ -0,0 +1,400 @@
+/* Drives conn_policy.c with traffic traces against a model of ble_conn_params and of centrals
+   that grant different connection intervals, and checks its state machine: a profile is only
+   in use once the central accepted it, a request is not repeated while one is outstanding,
+   events of the negotiation after connecting are left to main.c and the time in each profile
+   adds up to the connection time. */
+
+#include "conn_policy.h"
+#include "app_timer.h"
+#include "timer_model.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define CONN_HANDLE      1
+#define PPCP_INTERVAL    MSEC_TO_UNITS(30, UNIT_1_25_MS) // MIN_CONN_INTERVAL = MAX_CONN_INTERVAL of main.c
+#define FIRST_DELAY_MS   100                             // FIRST_CONN_PARAMS_UPDATE_DELAY of main.c
+#define NEXT_DELAY_MS    30000                           // NEXT_CONN_PARAMS_UPDATE_DELAY of main.c
+#define UPDATE_COUNT_MAX 3                               // MAX_CONN_PARAM_UPDATE_COUNT of main.c
+#define NEVER            UINT64_MAX
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+/* Connection intervals a central grants, in 1.25 ms units, and how long it takes to answer.
+   After move_ms, if not 0, it switches the link to move_interval and grants nothing else. */
+typedef struct
+{
+    char const* p_name;
+    uint16_t interval_min;
+    uint16_t interval_max;
+    uint16_t connect_interval;
+    uint32_t answer_ms;
+    uint32_t move_ms;
+    uint16_t move_interval;
+} central_t;
+
+/* ble_conn_params for one link: the preferred parameters, the update sent to the central and
+   the retry timer. Latency and supervision timeout are within the deviations of sdk_config.h
+   whatever they are, only the interval decides. */
+static struct
+{
+    central_t const* p_central;
+    uint16_t central_min;
+    uint16_t central_max;
+    ble_gap_conn_params_t preferred;
+    uint16_t interval;
+    uint32_t update_count;
+    uint64_t answer_at;
+    uint64_t retry_at;
+    uint32_t disconnects;
+    uint32_t repeats; // requests for the parameters of the request still outstanding
+    bool pending;     // a change is waiting for SUCCEEDED or FAILED
+    bool connected;
+} m_link;
+
+static uint64_t ms_to_ticks(uint32_t ms)
+{
+    return APP_TIMER_TICKS(ms);
+}
+
+static bool interval_ok(void)
+{
+    return (m_link.interval >= m_link.preferred.min_conn_interval) &&
+           (m_link.interval <= m_link.preferred.max_conn_interval);
+}
+
+/* on_conn_params_evt() of main.c. */
+static void conn_params_evt(ble_conn_params_evt_type_t type)
+{
+    ble_conn_params_evt_t evt = {.evt_type = type, .conn_handle = CONN_HANDLE};
+
+    m_link.pending = false;
+    if(conn_policy_on_conn_params_evt(&evt))
+    {
+        return;
+    }
+    if(type == BLE_CONN_PARAMS_EVT_FAILED)
+    {
+        m_link.disconnects++;
+        m_link.connected = false;
+        conn_policy_on_disconnected();
+    }
+}
+
+/* conn_params_negotiation() of ble_conn_params.c. */
+static void negotiation(void)
+{
+    if(!interval_ok())
+    {
+        m_link.retry_at = timer_model_now + ms_to_ticks(m_link.update_count == 0 ? FIRST_DELAY_MS : NEXT_DELAY_MS);
+        return;
+    }
+    m_link.update_count = 0;
+    conn_params_evt(BLE_CONN_PARAMS_EVT_SUCCEEDED);
+}
+
+static bool update_send(void)
+{
+    if(m_link.answer_at != NEVER)
+    {
+        return false; // sd_ble_gap_conn_param_update() busy
+    }
+    m_link.answer_at = timer_model_now + ms_to_ticks(m_link.p_central->answer_ms);
+    return true;
+}
+
+ret_code_t ble_conn_params_change_conn_params(uint16_t conn_handle, ble_gap_conn_params_t* p_new_params)
+{
+    if(!m_link.connected || (conn_handle != CONN_HANDLE))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if(!update_send())
+    {
+        return NRF_ERROR_BUSY;
+    }
+    if(m_link.pending && (memcmp(&m_link.preferred, p_new_params, sizeof(*p_new_params)) == 0))
+    {
+        m_link.repeats++;
+    }
+    m_link.update_count = 1;
+    m_link.preferred = *p_new_params;
+    m_link.pending = true;
+    return NRF_SUCCESS;
+}
+
+/* The central grants the shortest interval both sides allow, or keeps the one in use. */
+static void central_answer(void)
+{
+    uint16_t interval = m_link.preferred.min_conn_interval;
+
+    m_link.answer_at = NEVER;
+    if(interval < m_link.central_min)
+    {
+        interval = m_link.central_min;
+    }
+    if((interval <= m_link.preferred.max_conn_interval) && (interval <= m_link.central_max))
+    {
+        m_link.interval = interval;
+    }
+    negotiation();
+}
+
+/* A connection parameter update the central starts on its own. */
+static void central_move(void)
+{
+    m_link.interval = m_link.p_central->move_interval;
+    m_link.central_min = m_link.p_central->move_interval;
+    m_link.central_max = m_link.p_central->move_interval;
+    negotiation();
+}
+
+/* update_timeout_handler() of ble_conn_params.c. */
+static void retry(void)
+{
+    m_link.retry_at = NEVER;
+    if(m_link.update_count < UPDATE_COUNT_MAX)
+    {
+        if(update_send())
+        {
+            m_link.update_count++;
+        }
+        return;
+    }
+    m_link.update_count = 0;
+    conn_params_evt(BLE_CONN_PARAMS_EVT_FAILED);
+}
+
+static void connect(central_t const* p_central)
+{
+    memset(&m_link, 0, sizeof(m_link));
+    m_link.p_central = p_central;
+    m_link.central_min = p_central->interval_min;
+    m_link.central_max = p_central->interval_max;
+    m_link.preferred.min_conn_interval = PPCP_INTERVAL;
+    m_link.preferred.max_conn_interval = PPCP_INTERVAL;
+    m_link.interval = p_central->connect_interval;
+    m_link.answer_at = NEVER;
+    m_link.retry_at = NEVER;
+    m_link.connected = true;
+
+    conn_policy_on_connected(CONN_HANDLE);
+    negotiation();
+}
+
+/* Multi-packet transfers: `packets` reported `spacing_ms` apart from `start_ms` on. */
+typedef struct
+{
+    uint32_t start_ms;
+    uint32_t packets;
+    uint32_t spacing_ms;
+} burst_t;
+
+typedef struct
+{
+    char const* p_name;
+    burst_t const* p_bursts;
+    uint32_t burst_count;
+    uint32_t duration_ms;
+} trace_t;
+
+static const burst_t m_fido_bursts[] = {
+    {1000, 40, 20},    // a FIDO registration
+    {10000, 200, 10},  // a firmware chunk over NUS
+    {30000, 5, 500},   // slow keep-alive style exchange
+    {100000, 60, 15},  // another transfer after a long idle time
+};
+
+static const trace_t m_fido_trace = {"FIDO and NUS bursts", m_fido_bursts, 4, 300000};
+
+static const central_t m_central_any = {"central granting 7.5 ms", 6, 3200, 24, 60, 0, 0};
+static const central_t m_central_30ms = {"central fixed at 30 ms", 24, 24, 24, 60, 0, 0};
+static const central_t m_central_60ms = {"central fixed at 60 ms", 48, 48, 48, 60, 0, 0};
+static const central_t m_central_move = {"central moving to 60 ms at 60 s", 6, 3200, 24, 60, 60000, 48};
+
+static uint64_t packet_at(trace_t const* p_trace, uint32_t burst, uint32_t packet)
+{
+    return ms_to_ticks(p_trace->p_bursts[burst].start_ms + packet * p_trace->p_bursts[burst].spacing_ms);
+}
+
+static conn_policy_stats_t m_before;
+
+/* Replays the trace from connection on. Returns the stats of this connection alone. */
+static int replay(trace_t const* p_trace, central_t const* p_central, conn_policy_stats_t* p_stats)
+{
+    conn_policy_stats_t const* p_total = conn_policy_stats_get();
+    uint64_t start = timer_model_now;
+    uint64_t end = start + ms_to_ticks(p_trace->duration_ms);
+    uint64_t t_move = p_central->move_ms ? start + ms_to_ticks(p_central->move_ms) : NEVER;
+    uint64_t next, t_packet;
+    uint32_t burst = 0, packet = 0, profile;
+    bool first = true;
+
+    m_before = *p_total;
+    connect(p_central);
+    while(m_link.connected)
+    {
+        t_packet = (burst < p_trace->burst_count) ? start + packet_at(p_trace, burst, packet) : NEVER;
+        next = t_packet;
+        next = m_link.answer_at < next ? m_link.answer_at : next;
+        next = m_link.retry_at < next ? m_link.retry_at : next;
+        next = t_move < next ? t_move : next;
+        if(timer_model_next() <= next)
+        {
+            // A handler may ask for a profile, the answer can come before `next`.
+            if(timer_model_next() > end)
+            {
+                break;
+            }
+            timer_model_run_next();
+            continue;
+        }
+        if(next > end)
+        {
+            break;
+        }
+        timer_model_now = next;
+        if(next == m_link.answer_at)
+        {
+            central_answer();
+        }
+        else if(next == m_link.retry_at)
+        {
+            retry();
+        }
+        else if(next == t_move)
+        {
+            t_move = NEVER;
+            central_move();
+        }
+        else
+        {
+            conn_policy_traffic();
+            if(first)
+            {
+                // Asked for, not in use before the central answers.
+                CHECK(conn_policy_stats_get()->requested[CONN_PROFILE_FAST] == m_before.requested[CONN_PROFILE_FAST] + 1);
+                CHECK(conn_policy_profile_get() == CONN_PROFILE_DEFAULT);
+                first = false;
+            }
+            if(++packet == p_trace->p_bursts[burst].packets)
+            {
+                burst++;
+                packet = 0;
+            }
+        }
+    }
+    if(m_link.connected)
+    {
+        timer_model_now = end;
+        conn_policy_on_disconnected();
+    }
+
+    for(profile = 0; profile < CONN_PROFILE_COUNT; profile++)
+    {
+        p_stats->requested[profile] = p_total->requested[profile] - m_before.requested[profile];
+        p_stats->applied[profile] = p_total->applied[profile] - m_before.applied[profile];
+        p_stats->refused[profile] = p_total->refused[profile] - m_before.refused[profile];
+        p_stats->time_ticks[profile] = p_total->time_ticks[profile] - m_before.time_ticks[profile];
+    }
+    // Every tick of the connection is counted in exactly one profile.
+    CHECK(p_stats->time_ticks[CONN_PROFILE_DEFAULT] + p_stats->time_ticks[CONN_PROFILE_FAST] +
+              p_stats->time_ticks[CONN_PROFILE_IDLE] ==
+          timer_model_now - start);
+    CHECK(timer_model_active() == 0);
+    // Nothing is asked for twice while the central has not answered.
+    CHECK(m_link.repeats == 0);
+
+    printf("%s, %s: %u disconnects\n", p_trace->p_name, p_central->p_name, m_link.disconnects);
+    printf("  fast %u requested %u applied %u refused, idle %u requested %u applied %u refused\n",
+           p_stats->requested[CONN_PROFILE_FAST], p_stats->applied[CONN_PROFILE_FAST], p_stats->refused[CONN_PROFILE_FAST],
+           p_stats->requested[CONN_PROFILE_IDLE], p_stats->applied[CONN_PROFILE_IDLE], p_stats->refused[CONN_PROFILE_IDLE]);
+    printf("  time in default %.1f s, fast %.1f s, idle %.1f s\n",
+           p_stats->time_ticks[CONN_PROFILE_DEFAULT] / (double)APP_TIMER_CLOCK_FREQ,
+           p_stats->time_ticks[CONN_PROFILE_FAST] / (double)APP_TIMER_CLOCK_FREQ,
+           p_stats->time_ticks[CONN_PROFILE_IDLE] / (double)APP_TIMER_CLOCK_FREQ);
+    return 0;
+}
+
+static int test_accepting_central(void)
+{
+    conn_policy_stats_t stats;
+
+    CHECK(replay(&m_fido_trace, &m_central_any, &stats) == 0);
+    CHECK(m_link.disconnects == 0);
+    // Fast for each burst, idle once each burst is over.
+    CHECK(stats.requested[CONN_PROFILE_FAST] == 4 && stats.applied[CONN_PROFILE_FAST] == 4);
+    CHECK(stats.requested[CONN_PROFILE_IDLE] == 4 && stats.applied[CONN_PROFILE_IDLE] == 4);
+    CHECK(stats.refused[CONN_PROFILE_FAST] == 0 && stats.refused[CONN_PROFILE_IDLE] == 0);
+    CHECK(stats.time_ticks[CONN_PROFILE_IDLE] > stats.time_ticks[CONN_PROFILE_FAST]);
+    return 0;
+}
+
+static int test_fixed_central(void)
+{
+    conn_policy_stats_t stats;
+
+    // Never fast. The idle profile allows 30 ms and replaces the outstanding fast request.
+    CHECK(replay(&m_fido_trace, &m_central_30ms, &stats) == 0);
+    CHECK(m_link.disconnects == 0);
+    CHECK(stats.applied[CONN_PROFILE_FAST] == 0 && stats.time_ticks[CONN_PROFILE_FAST] == 0);
+    CHECK(stats.applied[CONN_PROFILE_IDLE] > 0);
+    return 0;
+}
+
+static int test_refusing_central(void)
+{
+    conn_policy_stats_t stats;
+
+    // Neither profile allows 60 ms, the refusals are answered here and keep the link.
+    CHECK(replay(&m_fido_trace, &m_central_60ms, &stats) == 0);
+    CHECK(m_link.disconnects == 0);
+    CHECK(stats.refused[CONN_PROFILE_FAST] + stats.refused[CONN_PROFILE_IDLE] > 0);
+    CHECK(stats.applied[CONN_PROFILE_FAST] + stats.applied[CONN_PROFILE_IDLE] == 0);
+    CHECK(conn_policy_profile_get() == CONN_PROFILE_DEFAULT);
+    return 0;
+}
+
+static const trace_t m_quiet_trace = {"no traffic", m_fido_bursts, 0, 180000};
+
+/* Outcomes of negotiations the policy did not ask for are left to main.c. */
+static int test_unrequested(void)
+{
+    conn_policy_stats_t stats;
+
+    // The parameters of the connection are accepted on connect, that success is not taken
+    // for a policy profile.
+    CHECK(replay(&m_quiet_trace, &m_central_30ms, &stats) == 0);
+    CHECK(m_link.disconnects == 0);
+    CHECK(stats.applied[CONN_PROFILE_IDLE] == stats.requested[CONN_PROFILE_IDLE]);
+    CHECK(stats.applied[CONN_PROFILE_FAST] == 0);
+
+    // The central moves an idle link to 60 ms and keeps it there. ble_conn_params tries to get
+    // the idle profile back on its own and fails, which is not the answer to a policy request,
+    // so main.c drops the link as for its own preferred parameters.
+    CHECK(replay(&m_quiet_trace, &m_central_move, &stats) == 0);
+    CHECK(m_link.disconnects == 1);
+    CHECK(stats.applied[CONN_PROFILE_IDLE] == 1 && stats.refused[CONN_PROFILE_IDLE] == 0);
+    return 0;
+}
+
+int main(void)
+{
+    timer_model_init();
+    conn_policy_init();
+    if(test_accepting_central() || test_fixed_central() || test_refusing_central() ||
+       test_unrequested())
+    {
+        return 1;
+    }
+    printf("conn policy: all tests passed\n");
+    return 0;
+}
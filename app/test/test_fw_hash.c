@@ -0,0 +1,218 @@
+/* Runs fw_hash.c over an application image in a fake flash and checks its digest against
+   utils/hash.py, the tool the release digests come from. Also checks that the background
+   computation hashes one chunk per timer step, so a scheduler pass never runs more than one. */
+
+#include "fw_hash.h"
+#include "app_scheduler.h"
+#include "nrf_crypto.h"
+#include "sched_model.h"
+#include "timer_model.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define FLASH_END  0x80000
+#define IMAGE_SIZE 0x2F1A3 /* not a multiple of FW_HASH_CHUNK_SIZE */
+#define IMAGE_FILE "_build/fw_image.bin"
+#define HASH_PY    "python3 ../../utils/hash.py -t bluetooth -f " IMAGE_FILE
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+const nrf_crypto_hash_info_t g_nrf_crypto_hash_sha256_info;
+
+ret_code_t nrf_crypto_hash_init(nrf_crypto_hash_context_t* p_context, nrf_crypto_hash_info_t const* p_info)
+{
+    (void)p_info;
+    return sha256_init(p_context);
+}
+
+ret_code_t nrf_crypto_hash_update(nrf_crypto_hash_context_t* p_context, uint8_t const* p_data, size_t data_size)
+{
+    return sha256_update(p_context, p_data, data_size);
+}
+
+ret_code_t nrf_crypto_hash_finalize(nrf_crypto_hash_context_t* p_context, uint8_t* p_digest, size_t* p_digest_size)
+{
+    *p_digest_size = 32;
+    return sha256_final(p_context, p_digest, 0);
+}
+
+static uint8_t* const m_image = (uint8_t*)FW_HASH_APP_ADDR;
+
+/* Image bytes, bootloader settings crc and the bank0 size the digest covers. */
+static void image_set(uint32_t seed, uint32_t crc)
+{
+    uint8_t* p_size = (uint8_t*)FW_HASH_APP_SIZE_ADDR;
+    uint32_t i;
+
+    for(i = 0; i < IMAGE_SIZE; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        m_image[i] = (uint8_t)seed;
+    }
+    *(uint32_t*)FW_HASH_SETTINGS_ADDR = crc;
+    p_size[0] = IMAGE_SIZE & 0xFF;
+    p_size[1] = (IMAGE_SIZE >> 8) & 0xFF;
+    p_size[2] = (IMAGE_SIZE >> 16) & 0xFF;
+}
+
+/* Digest of the image as printed by utils/hash.py. */
+static int reference_digest(uint8_t* p_digest)
+{
+    char line[160];
+    char* p_hex;
+    FILE* p_file;
+    uint32_t i, byte;
+    int found = 0;
+
+    p_file = fopen(IMAGE_FILE, "wb");
+    if(p_file == NULL || fwrite(m_image, 1, IMAGE_SIZE, p_file) != IMAGE_SIZE)
+    {
+        return 0;
+    }
+    fclose(p_file);
+
+    p_file = popen(HASH_PY, "r");
+    if(p_file == NULL)
+    {
+        return 0;
+    }
+    while(fgets(line, sizeof(line), p_file) != NULL)
+    {
+        p_hex = strstr(line, "hash: ");
+        if(p_hex == NULL)
+        {
+            continue;
+        }
+        p_hex += strlen("hash: ");
+        while(*p_hex == ' ')
+        {
+            p_hex++;
+        }
+        for(i = 0; i < 32 && sscanf(p_hex + 2 * i, "%2x", &byte) == 1; i++)
+        {
+            p_digest[i] = (uint8_t)byte;
+        }
+        found = (i == 32);
+    }
+    return (pclose(p_file) == 0) && found;
+}
+
+static int test_background(void)
+{
+    uint8_t digest[32], expected[32];
+    uint32_t steps = 0;
+    uint32_t chunks = (IMAGE_SIZE + FW_HASH_CHUNK_SIZE - 1) / FW_HASH_CHUNK_SIZE;
+
+    image_set(0x2545F491, 0x1234);
+    CHECK(reference_digest(expected));
+
+    sched_model_init(16);
+    timer_model_init();
+    fw_hash_start();
+    app_sched_execute();
+    CHECK(!fw_hash_ready() && sched_model_stats.executed == 0);
+
+    /* Every expiry queues one step, every scheduler pass runs that one chunk. */
+    while(!fw_hash_ready())
+    {
+        CHECK(timer_model_run_next());
+        CHECK(sched_model_queued() == 1);
+        app_sched_execute();
+        steps++;
+    }
+    CHECK(steps == chunks);
+    CHECK(timer_model_active() == 0);
+    printf("background: %u chunks of %u bytes, one per %u ms step, %.0f ms in total\n", steps,
+           FW_HASH_CHUNK_SIZE, FW_HASH_STEP_MS, timer_model_now * 1000.0 / 32768);
+
+    fw_hash_get(digest);
+    CHECK(memcmp(digest, expected, 32) == 0);
+    return 0;
+}
+
+static int test_queue_full(void)
+{
+    uint8_t digest[32], expected[32];
+    uint32_t i;
+
+    image_set(7, 0x5678);
+    CHECK(reference_digest(expected));
+
+    /* No room for the step, the timer tries again. */
+    sched_model_init(0);
+    timer_model_init();
+    fw_hash_start();
+    for(i = 0; i < 3; i++)
+    {
+        CHECK(timer_model_run_next());
+        CHECK(timer_model_active() == 1);
+    }
+    sched_model_init(16);
+    while(!fw_hash_ready())
+    {
+        CHECK(timer_model_run_next());
+        app_sched_execute();
+    }
+    fw_hash_get(digest);
+    CHECK(memcmp(digest, expected, 32) == 0);
+    return 0;
+}
+
+static int test_request(void)
+{
+    uint8_t digest[32], expected[32];
+
+    /* Asked for halfway through, the rest is hashed in the call. */
+    image_set(11, 0x9ABC);
+    CHECK(reference_digest(expected));
+    sched_model_init(16);
+    timer_model_init();
+    fw_hash_start();
+    CHECK(timer_model_run_next());
+    app_sched_execute();
+    fw_hash_get(digest);
+    CHECK(fw_hash_ready() && memcmp(digest, expected, 32) == 0);
+
+    /* The step still pending finds the digest done. */
+    CHECK(timer_model_run_next());
+    app_sched_execute();
+    CHECK(timer_model_active() == 0);
+
+    /* A new image comes with new bootloader settings, the cached digest is dropped. */
+    image_set(13, 0xDEF0);
+    CHECK(reference_digest(expected));
+    fw_hash_get(digest);
+    CHECK(memcmp(digest, expected, 32) == 0);
+    return 0;
+}
+
+int main(void)
+{
+    void* p = mmap((void*)FW_HASH_APP_ADDR, FLASH_END - FW_HASH_APP_ADDR, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if(p != (void*)FW_HASH_APP_ADDR)
+    {
+        perror("flash mmap");
+        return 1;
+    }
+    if(test_background() || test_queue_full() || test_request())
+    {
+        return 1;
+    }
+    printf("firmware hash: all tests passed\n");
+    return 0;
+}
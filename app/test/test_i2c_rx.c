@@ -0,0 +1,431 @@
+/* Runs the TWI read pipeline of i2c.c against a model TWIM at 400 kHz and a slave that raises
+   TWI_STATUS_GPIO whenever a NUS or FIDO response is ready. The GPIOTE interrupt calls
+   twi_read_data() as gpio.h does, BLE gives the slots back after a drain time, and host
+   writes are queued in between. The former twi_read_data() polled in 1 ms steps for up to
+   500 ms inside that interrupt. Checks that no interrupt-context call waits for the bus: each
+   starts at most one transfer and twi_read_data() returns before a byte is read. Checks that
+   every response reaches ble_nus_send()/ble_fido_send() intact, in order and in the same
+   main loop pass as its last chunk. Prints the response latencies and the host CPU time of
+   the interrupt-context calls. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "boards.h"
+#include "i2c.h"
+#include "nrf_drv_twi.h"
+#include "sched_model.h"
+#include "app_scheduler.h"
+#include "sdk_errors.h"
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+/* Tallied instead of checked in place, the fakes run in the middle of the code under test. */
+#define FAULT(cond)     \
+    do                  \
+    {                   \
+        if(!(cond))     \
+        {               \
+            m_faults++; \
+        }               \
+    } while(0)
+
+#define RESPONSES    4000
+#define RSP_DATA_MAX 3072 // i2c_data_buffer_t data
+#define BYTE_NS      22500ull // 9 clocks at 400 kHz
+#define WRITE_MAX    600
+#define NEVER        UINT64_MAX
+
+static uint32_t m_faults;
+static uint64_t m_now; // virtual ns
+
+static uint32_t m_rand = 0x2545F491;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Model TWIM, one transfer at a time, its DONE event is the test's next interrupt. */
+static nrf_drv_twi_evt_handler_t m_twi_handler;
+static bool m_twi_busy, m_twi_rx;
+static uint8_t* m_twi_p_rx;
+static uint8_t m_twi_len;
+static uint64_t m_twi_end = NEVER;
+static uint32_t m_starts; // transfers started by the running interrupt
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const* p_instance,
+                            nrf_drv_twi_config_t const* p_config,
+                            nrf_drv_twi_evt_handler_t event_handler,
+                            void* p_context)
+{
+    (void)p_instance;
+    (void)p_context;
+    FAULT(p_config->frequency == NRF_DRV_TWI_FREQ_400K);
+    m_twi_handler = event_handler;
+    return NRF_SUCCESS;
+}
+
+void nrf_drv_twi_enable(nrf_drv_twi_t const* p_instance)
+{
+    (void)p_instance;
+}
+
+static ret_code_t twi_start(bool rx, uint8_t* p_rx, uint8_t length)
+{
+    if(m_twi_busy)
+    {
+        return NRF_ERROR_BUSY;
+    }
+    m_twi_busy = true;
+    m_twi_rx = rx;
+    m_twi_p_rx = p_rx;
+    m_twi_len = length;
+    m_twi_end = m_now + (length + 1) * BYTE_NS;
+    m_starts++;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_twi_tx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t const* p_data,
+                          uint8_t length,
+                          bool no_stop)
+{
+    (void)p_instance;
+    (void)p_data;
+    (void)no_stop;
+    FAULT(address == SLAVE_ADDR);
+    return twi_start(false, NULL, length);
+}
+
+ret_code_t nrf_drv_twi_rx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t* p_data,
+                          uint8_t length)
+{
+    (void)p_instance;
+    FAULT(address == SLAVE_ADDR);
+    return twi_start(true, p_data, length);
+}
+
+bool nrf_drv_twi_is_busy(nrf_drv_twi_t const* p_instance)
+{
+    (void)p_instance;
+    return m_twi_busy;
+}
+
+/* Responses of the slave, as it puts them on the bus and as BLE has to get them. */
+typedef struct
+{
+    uint8_t wire[RSP_DATA_MAX];
+    uint16_t wire_len;
+    uint16_t ble_offset; // FIDO responses reach BLE from the status byte on
+    bool fido;
+    uint64_t t_gpio, t_last, t_ble;
+} response_t;
+
+static response_t m_rsp[RESPONSES];
+static uint32_t m_rsp_read;      // response on the bus
+static uint32_t m_rsp_pos;       // bytes of it read
+static uint32_t m_rsp_delivered; // responses that reached BLE
+static uint64_t m_gpio_at = NEVER;
+
+static void response_make(response_t* p_rsp)
+{
+    uint32_t len;
+
+    p_rsp->fido = (rand_next() % 3) == 0;
+    // Mostly short answers, some close to the slot size.
+    len = (rand_next() % 8) ? rand_next() % 300 : rand_next() % (RSP_DATA_MAX - 9 + 1);
+    if(p_rsp->fido)
+    {
+        len = len > RSP_DATA_MAX - 3 ? RSP_DATA_MAX - 3 : len;
+        memcpy(p_rsp->wire, "fid", 3);
+        p_rsp->wire[3] = (uint8_t)rand_next(); // status
+        p_rsp->wire[4] = (uint8_t)(len >> 8);
+        p_rsp->wire[5] = (uint8_t)len;
+        p_rsp->wire_len = 6 + len;
+        p_rsp->ble_offset = 3;
+    }
+    else
+    {
+        memcpy(p_rsp->wire, "?##", 3);
+        p_rsp->wire[3] = (uint8_t)rand_next(); // id
+        p_rsp->wire[4] = (uint8_t)rand_next();
+        p_rsp->wire[5] = (uint8_t)(len >> 24);
+        p_rsp->wire[6] = (uint8_t)(len >> 16);
+        p_rsp->wire[7] = (uint8_t)(len >> 8);
+        p_rsp->wire[8] = (uint8_t)len;
+        p_rsp->wire_len = 9 + len;
+        p_rsp->ble_offset = 0;
+    }
+    for(uint32_t i = p_rsp->wire_len - len; i < p_rsp->wire_len; i++)
+    {
+        p_rsp->wire[i] = (uint8_t)rand_next();
+    }
+}
+
+static void slave_read(uint8_t* p_data, uint32_t len)
+{
+    response_t* p_rsp = &m_rsp[m_rsp_read];
+
+    FAULT(m_rsp_read < RESPONSES && m_rsp_pos + len <= p_rsp->wire_len);
+    memcpy(p_data, &p_rsp->wire[m_rsp_pos], len);
+    m_rsp_pos += len;
+    if(m_rsp_pos == p_rsp->wire_len)
+    {
+        p_rsp->t_last = m_now;
+        m_rsp_read++;
+        m_rsp_pos = 0;
+        // The slave works out its next response, then signals it.
+        if(m_rsp_read < RESPONSES)
+        {
+            m_gpio_at = m_now + 50000 + rand_next() % 2000000;
+        }
+    }
+}
+
+/* BLE side, a slot drains at roughly 20 KB/s before it is released. */
+#define BLE_HELD_MAX 2
+
+static uint8_t const* m_held[BLE_HELD_MAX];
+static uint64_t m_held_until[BLE_HELD_MAX];
+static uint32_t m_held_count, m_held_peak;
+
+static void ble_deliver(uint8_t* data, uint16_t data_len, bool fido)
+{
+    response_t* p_rsp = &m_rsp[m_rsp_delivered];
+
+    FAULT(m_rsp_delivered < RESPONSES);
+    FAULT(p_rsp->fido == fido);
+    FAULT(data_len == p_rsp->wire_len - p_rsp->ble_offset);
+    FAULT(memcmp(data, &p_rsp->wire[p_rsp->ble_offset], data_len) == 0);
+    p_rsp->t_ble = m_now;
+    m_rsp_delivered++;
+
+    FAULT(m_held_count < BLE_HELD_MAX);
+    m_held[m_held_count] = data;
+    m_held_until[m_held_count] = m_now + data_len * 50000ull + rand_next() % 5000000;
+    m_held_count++;
+    m_held_peak = m_held_count > m_held_peak ? m_held_count : m_held_peak;
+}
+
+void ble_nus_send(uint8_t* data, uint16_t data_len)
+{
+    ble_deliver(data, data_len, false);
+}
+
+void ble_fido_send(uint8_t* data, uint16_t data_len)
+{
+    ble_deliver(data, data_len, true);
+}
+
+/* Host writes to the slave, queued from one buffer the TWI reads in place. */
+static uint8_t m_write_buf[WRITE_MAX];
+static uint32_t m_write_queued, m_write_done;
+
+/* Host CPU time and transfers of the interrupt-context calls. */
+static double m_isr_ns_max, m_isr_ns_sum;
+static uint32_t m_isr_count, m_starts_max;
+
+static void isr_begin(void)
+{
+    m_starts = 0;
+}
+
+static void isr_end(double t0)
+{
+    double ns = now_ns() - t0;
+
+    m_isr_ns_max = ns > m_isr_ns_max ? ns : m_isr_ns_max;
+    m_isr_ns_sum += ns;
+    m_isr_count++;
+    m_starts_max = m_starts > m_starts_max ? m_starts : m_starts_max;
+}
+
+static void main_loop_pass(void)
+{
+    i2c_rx_post_retry();
+    app_sched_execute();
+}
+
+/* Bus time of the transfers twi_handler reads a response in, an address byte each. */
+static uint64_t response_wire_ns(response_t const* p_rsp)
+{
+    uint32_t header = p_rsp->fido ? 6 : 9;
+    uint32_t xfers = (p_rsp->fido ? 3 : 2) + (p_rsp->wire_len - header + 254) / 255;
+
+    return (uint64_t)(p_rsp->wire_len + xfers) * BYTE_NS;
+}
+
+static int cmp_u64(void const* p_a, void const* p_b)
+{
+    uint64_t a = *(uint64_t const*)p_a;
+    uint64_t b = *(uint64_t const*)p_b;
+
+    return (a > b) - (a < b);
+}
+
+static uint64_t m_total[RESPONSES];
+static uint64_t m_wait[RESPONSES];
+
+int main(void)
+{
+    nrf_drv_twi_evt_t const done = {.type = NRF_DRV_TWI_EVT_DONE};
+    uint64_t bytes = 0;
+    uint32_t early = 0;
+    double t0;
+
+    for(uint32_t i = 0; i < RESPONSES; i++)
+    {
+        response_make(&m_rsp[i]);
+    }
+    for(uint32_t i = 0; i < WRITE_MAX; i++)
+    {
+        m_write_buf[i] = (uint8_t)i;
+    }
+    sched_model_init(16); // SCHED_QUEUE_SIZE of main.c
+    CHECK(twi_master_init() == NRF_SUCCESS);
+    m_gpio_at = 0;
+
+    while(m_rsp_delivered < RESPONSES)
+    {
+        uint64_t next = m_twi_busy ? m_twi_end : NEVER;
+        uint32_t held = BLE_HELD_MAX;
+
+        next = m_gpio_at < next ? m_gpio_at : next;
+        for(uint32_t i = 0; i < m_held_count; i++)
+        {
+            if(m_held_until[i] < next)
+            {
+                next = m_held_until[i];
+                held = i;
+            }
+        }
+        CHECK(next != NEVER);
+        m_now = next;
+
+        if(held < BLE_HELD_MAX)
+        {
+            // BLE_NUS_EVT_TX_RDY of the last fragment, the slot is free again.
+            uint8_t const* p_data = m_held[held];
+
+            m_held[held] = m_held[--m_held_count];
+            m_held_until[held] = m_held_until[m_held_count];
+            isr_begin();
+            t0 = now_ns();
+            i2c_rx_release(p_data);
+            isr_end(t0);
+        }
+        else if(m_twi_busy && m_twi_end == m_now)
+        {
+            m_twi_busy = false;
+            if(m_twi_rx)
+            {
+                slave_read(m_twi_p_rx, m_twi_len);
+            }
+            else
+            {
+                m_write_done += m_twi_len;
+            }
+            isr_begin();
+            t0 = now_ns();
+            m_twi_handler(&done, NULL);
+            isr_end(t0);
+        }
+        else
+        {
+            uint32_t delivered = m_rsp_delivered;
+
+            // The host queues a write now and then, as BLE RX does.
+            if(!i2c_tx_busy(m_write_buf) && (rand_next() % 4) == 0)
+            {
+                uint32_t len = 1 + rand_next() % WRITE_MAX;
+
+                if(i2c_master_write(m_write_buf, len))
+                {
+                    m_write_queued += len;
+                }
+            }
+            m_gpio_at = NEVER;
+            m_rsp[m_rsp_read].t_gpio = m_now;
+            // in_pin_handler
+            isr_begin();
+            t0 = now_ns();
+            twi_read_data();
+            isr_end(t0);
+            // Back from the interrupt before a byte of the response is read.
+            CHECK(m_rsp_pos == 0 && m_rsp_delivered == delivered);
+            CHECK(m_starts <= 1);
+        }
+        CHECK(m_faults == 0);
+        main_loop_pass();
+        CHECK(m_faults == 0);
+    }
+    while(m_twi_busy)
+    {
+        m_now = m_twi_end;
+        m_twi_busy = false;
+        CHECK(!m_twi_rx);
+        m_write_done += m_twi_len;
+        m_twi_handler(&done, NULL);
+    }
+
+    CHECK(m_faults == 0);
+    CHECK(m_rsp_read == RESPONSES);
+    CHECK(m_starts_max <= 1);
+    CHECK(m_write_done == m_write_queued && m_write_queued > 0);
+    CHECK(sched_model_stats.full == 0);
+    for(uint32_t i = 0; i < RESPONSES; i++)
+    {
+        response_t const* p_rsp = &m_rsp[i];
+
+        // Handed to BLE in the main loop pass right after the last chunk landed.
+        CHECK(p_rsp->t_ble == p_rsp->t_last);
+        m_total[i] = p_rsp->t_ble - p_rsp->t_gpio;
+        CHECK(m_total[i] >= response_wire_ns(p_rsp));
+        // Time not spent reading this response: queued writes, or both slots held by BLE.
+        m_wait[i] = m_total[i] - response_wire_ns(p_rsp);
+        early += m_wait[i] == 0;
+        bytes += p_rsp->wire_len;
+    }
+    CHECK(early > 0);
+    qsort(m_total, RESPONSES, sizeof(m_total[0]), cmp_u64);
+    qsort(m_wait, RESPONSES, sizeof(m_wait[0]), cmp_u64);
+
+    printf("i2c rx: %u responses, %llu bytes, %u of them read with the bus free\n", (unsigned)RESPONSES,
+           (unsigned long long)bytes, (unsigned)early);
+    printf("  gpio to BLE    p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", m_total[RESPONSES / 2] / 1e6,
+           m_total[RESPONSES * 99 / 100] / 1e6, m_total[RESPONSES - 1] / 1e6);
+    printf("  waiting        p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", m_wait[RESPONSES / 2] / 1e6,
+           m_wait[RESPONSES * 99 / 100] / 1e6, m_wait[RESPONSES - 1] / 1e6);
+    printf("  last chunk to BLE 0 ms, slots held by BLE at most %u, scheduler high water %u\n",
+           (unsigned)m_held_peak, (unsigned)sched_model_stats.high_water);
+    printf("  interrupt calls %u, host CPU mean %.0f ns max %.0f ns, transfers started per call at most %u\n",
+           (unsigned)m_isr_count, m_isr_ns_sum / m_isr_count, m_isr_ns_max, (unsigned)m_starts_max);
+    printf("i2c rx: all tests passed\n");
+    return 0;
+}
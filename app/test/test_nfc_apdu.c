@@ -0,0 +1,314 @@
+/* Feeds random NFC commands, single frames and chains of fragments, to nfc.c while a model TWI
+   writes the queued frames out at random later points, as the TWIM reads nfc_apdu in place.
+   Checks that every frame reaches the slave as it was received, in order, that each command
+   answered 9000 is forwarded whole, and that a command arriving while nfc_apdu is still
+   queued is refused with 6D00 as a whole. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "app_error.h"
+#include "boards.h"
+#include "main_evt.h"
+#include "nfc_t4t_lib.h"
+#include "sdk_errors.h"
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+#define COMMANDS     20000
+#define FRAG_MAX     4
+#define FRAME_MAX    253 // nfc_apdu
+#define TWI_QUEUE    8
+#define WRITTEN_MAX  (COMMANDS * FRAG_MAX)
+
+extern int nfc_init(void);
+extern void nfc_poll(void* p_event_data, uint16_t event_size);
+
+uint8_t ble_adv_switch_flag;
+
+static uint32_t m_rand = 0x2545F491;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+/* Model TWI, the bytes are taken from the caller's buffer when the transfer completes. */
+typedef struct
+{
+    uint8_t const* p_buf;
+    uint8_t len;
+    bool no_stop;
+} twi_entry_t;
+
+typedef struct
+{
+    uint8_t data[FRAME_MAX];
+    uint8_t len;
+    bool no_stop;
+} frame_t;
+
+static twi_entry_t m_twi[TWI_QUEUE];
+static uint32_t m_twi_head, m_twi_count;
+static frame_t m_written[WRITTEN_MAX];
+static uint32_t m_written_count;
+
+static nfc_t4t_callback_t m_callback;
+static uint8_t m_rsp[FRAME_MAX];
+static size_t m_rsp_len;
+static bool m_posted;
+
+bool i2c_master_write_ex(uint8_t* buf, uint8_t len, bool no_stop)
+{
+    twi_entry_t* p_entry;
+
+    if(m_twi_count == TWI_QUEUE)
+    {
+        return false;
+    }
+    p_entry = &m_twi[(m_twi_head + m_twi_count++) % TWI_QUEUE];
+    p_entry->p_buf = buf;
+    p_entry->len = len;
+    p_entry->no_stop = no_stop;
+    return true;
+}
+
+bool i2c_tx_busy(uint8_t const* p_buf)
+{
+    for(uint32_t i = 0; i < m_twi_count; i++)
+    {
+        if(m_twi[(m_twi_head + i) % TWI_QUEUE].p_buf == p_buf)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void twi_complete(void)
+{
+    twi_entry_t const* p_entry = &m_twi[m_twi_head];
+    frame_t* p_frame = &m_written[m_written_count++];
+
+    memcpy(p_frame->data, p_entry->p_buf, p_entry->len);
+    p_frame->len = p_entry->len;
+    p_frame->no_stop = p_entry->no_stop;
+    m_twi_head = (m_twi_head + 1) % TWI_QUEUE;
+    m_twi_count--;
+}
+
+bool i2c_master_read(void)
+{
+    return true;
+}
+
+static uint8_t m_i2c_data[4];
+
+void get_i2c_data(uint8_t** data, uint16_t* len)
+{
+    *data = m_i2c_data;
+    *len = 0;
+}
+
+bool get_i2c_data_flag(void)
+{
+    return false;
+}
+
+void set_i2c_data_flag(bool flag)
+{
+    (void)flag;
+}
+
+uint32_t nrf_gpio_pin_read(uint32_t pin_number)
+{
+    (void)pin_number;
+    return 0;
+}
+
+void main_evt_post(main_evt_src_t src)
+{
+    if(src == MAIN_EVT_NFC)
+    {
+        m_posted = true;
+    }
+}
+
+ret_code_t nfc_t4t_setup(nfc_t4t_callback_t callback, void* p_context)
+{
+    (void)p_context;
+    m_callback = callback;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nfc_t4t_emulation_start(void)
+{
+    return NRF_SUCCESS;
+}
+
+ret_code_t nfc_t4t_response_pdu_send(const uint8_t* p_pdu, size_t pdu_length)
+{
+    memcpy(m_rsp, p_pdu, pdu_length);
+    m_rsp_len = pdu_length;
+    return NRF_SUCCESS;
+}
+
+/* The main loop and the TWI interrupt between two frames. A frame takes about 20 ms at
+   106 kbit/s and the TWI writes it out in about 6 ms, mostly both are done by the next one. */
+static void background_run(void)
+{
+    if(m_posted && (rand_next() % 10) < 9)
+    {
+        m_posted = false;
+        nfc_poll(NULL, 0);
+    }
+    if((rand_next() % 10) < 8)
+    {
+        while(m_twi_count > 0)
+        {
+            twi_complete();
+        }
+    }
+    else if(m_twi_count > 0 && (rand_next() % 2))
+    {
+        twi_complete();
+    }
+}
+
+/* A frame carries its serial in bytes 1 and 2, so the slave side can tell where it came from. */
+static void frame_make(frame_t* p_frame, uint32_t serial, bool first, bool more)
+{
+    p_frame->len = 3 + rand_next() % (FRAME_MAX - 2);
+    p_frame->no_stop = more;
+    for(uint32_t i = 0; i < p_frame->len; i++)
+    {
+        p_frame->data[i] = (uint8_t)rand_next();
+    }
+    p_frame->data[0] = first ? '?' : (uint8_t)(p_frame->data[0] | 0x80);
+    p_frame->data[1] = (uint8_t)(serial >> 8);
+    p_frame->data[2] = (uint8_t)serial;
+}
+
+static frame_t m_sent[WRITTEN_MAX];
+static bool m_accepted[WRITTEN_MAX]; // per sent frame, its command was answered 9000
+static uint32_t m_cmd_of[WRITTEN_MAX];
+
+int main(void)
+{
+    static uint8_t const poll[] = {'#', '*', '*'};
+    uint32_t serial = 0;
+    uint32_t accepted = 0;
+    uint32_t refused = 0;
+    uint32_t polls = 0;
+    uint32_t next = 0;
+    uint32_t frags;
+
+    nfc_init();
+    CHECK(m_callback != NULL);
+    m_callback(NULL, NFC_T4T_EVENT_FIELD_ON, NULL, 0, 0);
+
+    for(uint32_t cmd = 0; cmd < COMMANDS; cmd++)
+    {
+        uint32_t first = serial;
+
+        frags = (rand_next() % 2) ? 1 : 2 + rand_next() % (FRAG_MAX - 1);
+        for(uint32_t f = 0; f < frags; f++)
+        {
+            frame_t* p_frame = &m_sent[serial];
+
+            frame_make(p_frame, serial & 0xFFFF, f == 0, f + 1 < frags);
+            m_cmd_of[serial++] = cmd;
+            background_run();
+            m_rsp_len = 0;
+            m_callback(NULL, NFC_T4T_EVENT_DATA_IND, p_frame->data, p_frame->len,
+                       p_frame->no_stop ? NFC_T4T_DI_FLAG_MORE : NFC_T4T_DI_FLAG_NONE);
+            CHECK(m_rsp_len == (p_frame->no_stop ? 0 : 2));
+        }
+        CHECK((m_rsp[0] == 0x90 || m_rsp[0] == 0x6D) && m_rsp[1] == 0x00);
+        for(uint32_t s = first; s < serial; s++)
+        {
+            m_accepted[s] = m_rsp[0] == 0x90;
+        }
+        if(m_rsp[0] == 0x90)
+        {
+            accepted++;
+        }
+        else
+        {
+            refused++;
+        }
+
+        // The reader polls for the response, that never touches nfc_apdu and is never refused.
+        if((rand_next() % 4) == 0)
+        {
+            background_run();
+            m_rsp_len = 0;
+            m_callback(NULL, NFC_T4T_EVENT_DATA_IND, poll, sizeof(poll), NFC_T4T_DI_FLAG_NONE);
+            CHECK(m_rsp_len == 3 && memcmp(m_rsp, poll, 3) == 0);
+            polls++;
+        }
+    }
+    if(m_posted)
+    {
+        nfc_poll(NULL, 0);
+    }
+    while(m_twi_count > 0)
+    {
+        twi_complete();
+    }
+
+    // Each written frame is a received one, unchanged, later than the one written before.
+    // Frames of accepted commands are all written, a refused command only up to where the
+    // refusal started.
+    for(uint32_t w = 0; w < m_written_count; w++)
+    {
+        frame_t const* p_frame = &m_written[w];
+        uint32_t s;
+
+        CHECK(p_frame->len >= 3);
+        s = (next & ~0xFFFFu) | ((uint32_t)p_frame->data[1] << 8) | p_frame->data[2];
+        if(s < next)
+        {
+            s += 0x10000;
+        }
+        CHECK(s < serial);
+        for(; next < s; next++)
+        {
+            CHECK(!m_accepted[next]);
+        }
+        CHECK(p_frame->len == m_sent[s].len && memcmp(p_frame->data, m_sent[s].data, p_frame->len) == 0);
+        CHECK(p_frame->no_stop == m_sent[s].no_stop);
+        if(!m_accepted[s] && s > 0 && m_cmd_of[s - 1] == m_cmd_of[s])
+        {
+            // A refused chain keeps only a prefix, the fragment before this one went out too.
+            CHECK(w > 0 && m_written[w - 1].data[1] == m_sent[s - 1].data[1] &&
+                  m_written[w - 1].data[2] == m_sent[s - 1].data[2]);
+        }
+        next = s + 1;
+    }
+    for(; next < serial; next++)
+    {
+        CHECK(!m_accepted[next]);
+    }
+
+    // Both outcomes have to occur for the run to say anything.
+    CHECK(accepted > COMMANDS / 2);
+    CHECK(refused > 0);
+    CHECK(polls > 0);
+    printf("nfc apdu: %u commands, %u refused while busy, %u frames written\n",
+           (unsigned)COMMANDS, (unsigned)refused, (unsigned)m_written_count);
+    printf("nfc apdu: all tests passed\n");
+    return 0;
+}
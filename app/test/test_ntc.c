@@ -0,0 +1,127 @@
+/* Checks the NTC lookup of ntc.c against the thermistor formula it was computed from and
+   against the float conversion it replaced, then times both. */
+
+#include "ntc.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CODE_MIN 128 // table range, about 83 C down to -21 C
+#define CODE_MAX 832
+
+#define ADC_RESULT_IN_MILLI_VOLTS(code) ((((code) * 600) / 1024) * 6)
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+static double exact_degree(int code)
+{
+    double mv = code * 3600.0 / 1024;
+    double r = NTC_R_FIXED * mv / (3300 - mv);
+
+    return NTC_B_VALUE / (log(r / NTC_R_NTC) + NTC_B_VALUE / 298.15) - 273.15;
+}
+
+// The former voltage_to_resistance() and resistance_to_temperature() of adc.h.
+__attribute__((noinline)) static int old_degree(int code)
+{
+    int voltage_mv = ADC_RESULT_IN_MILLI_VOLTS(code);
+    int resistance = NTC_R_FIXED * voltage_mv / (3300 - voltage_mv);
+    float temperature = (NTC_B_VALUE / (log((float)resistance / NTC_R_NTC) + (NTC_B_VALUE / 298.15))) - 273.15;
+    return temperature;
+}
+
+// Charge switch of saadc_event_handler() for HW_VER_V_2_0, starting from "on".
+static int charge_allowed(int degree)
+{
+    return !(degree > 45 || degree < 0);
+}
+
+static int test_error(void)
+{
+    double err, table_max = 0, old_max = 0;
+    int code, diff, diff_codes = 0, flips = 0;
+
+    for(code = CODE_MIN; code <= CODE_MAX; code++)
+    {
+        err = fabs(ntc_code_to_decidegree(code) / 10.0 - exact_degree(code));
+        table_max = err > table_max ? err : table_max;
+        err = fabs(old_degree(code) - exact_degree(code));
+        old_max = err > old_max ? err : old_max;
+
+        diff = ntc_code_to_decidegree(code) / 10 - old_degree(code);
+        CHECK(diff >= -1 && diff <= 1);
+        diff_codes += diff != 0;
+        flips += charge_allowed(ntc_code_to_decidegree(code) / 10) != charge_allowed(old_degree(code));
+    }
+    printf("codes %d..%d: table within %.2f C of the formula, former code within %.2f C\n",
+           CODE_MIN, CODE_MAX, table_max, old_max);
+    printf("  whole degrees differ by 1 C on %d codes, %d charge decisions differ\n", diff_codes, flips);
+    CHECK(table_max < 0.2);
+    CHECK(flips <= 1);
+
+    // Clamped outside the table, hot below it and cold above it.
+    CHECK(ntc_code_to_decidegree(0) == ntc_code_to_decidegree(CODE_MIN));
+    CHECK(ntc_code_to_decidegree(1024) == ntc_code_to_decidegree(CODE_MAX));
+    CHECK(ntc_code_to_decidegree(0) / 10 > 45 && ntc_code_to_decidegree(1024) / 10 < 0);
+    return 0;
+}
+
+#define COST_ROUNDS 2000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best of COST_ROUNDS passes over the table range. The host has a hardware double log(), on
+   the Cortex-M4 the former code runs libm in soft float and the gap is wider. */
+static void report_cost(void)
+{
+    volatile int sink = 0;
+    double t0, old_ns = 1e30, new_ns = 1e30;
+    int code, round;
+
+    for(round = 0; round < COST_ROUNDS; round++)
+    {
+        t0 = now_ns();
+        for(code = CODE_MIN; code <= CODE_MAX; code++)
+        {
+            sink += old_degree(code);
+        }
+        t0 = now_ns() - t0;
+        old_ns = t0 < old_ns ? t0 : old_ns;
+
+        t0 = now_ns();
+        for(code = CODE_MIN; code <= CODE_MAX; code++)
+        {
+            sink += ntc_code_to_decidegree(code);
+        }
+        t0 = now_ns() - t0;
+        new_ns = t0 < new_ns ? t0 : new_ns;
+    }
+    printf("per call on this host: %.2f ns before, %.2f ns now\n",
+           old_ns / (CODE_MAX - CODE_MIN + 1), new_ns / (CODE_MAX - CODE_MIN + 1));
+}
+
+int main(void)
+{
+    if(test_error())
+    {
+        return 1;
+    }
+    report_cost();
+    printf("ntc: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,367 @@
+/* Runs the NUS response queue of nus.h against a fake SoftDevice with a few notification
+   buffers. BLE_NUS_EVT_TX_RDY and disconnections preempt the main loop in the middle of its
+   calls, as the SoftDevice event interrupt does. Checks that the fragments of every response
+   go on air once and in order, that each slot is released once after its last fragment, and
+   that neither the SoftDevice nor i2c_rx_release() is called inside the critical region. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "app_error.h"
+#include "nrf_log.h"
+#include "sdk_errors.h"
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+/* Tallied instead of checked in place, the fakes run in the middle of the code under test. */
+#define FAULT(cond)          \
+    do                       \
+    {                        \
+        if(!(cond))          \
+        {                    \
+            m_faults++;      \
+        }                    \
+    } while(0)
+
+static uint32_t m_faults;
+static uint32_t m_critical; // depth of the critical region
+static uint32_t m_context;  // 0 main loop, 1 inside the fake event interrupt
+
+#define CRITICAL_REGION_ENTER() \
+    {                           \
+        m_critical++;
+#define CRITICAL_REGION_EXIT() \
+    m_critical--;              \
+    }
+
+/* What main.c defines before it includes nus.h. */
+#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE 247
+#define OPCODE_LENGTH                 1
+#define HANDLE_LENGTH                 2
+#define DATA_INIT                     0x00
+#define DATA_DATA                     0x02
+#define BLE_OFF_ALWAYS                2
+#define MAIN_EVT_BLE_CTL              0
+#define SD_BUFFERS                    4 // hvn_tx_queue_size of the SoftDevice configuration
+
+typedef enum
+{
+    BLE_NUS_EVT_RX_DATA,
+    BLE_NUS_EVT_TX_RDY
+} ble_nus_evt_type_t;
+
+typedef struct
+{
+    ble_nus_evt_type_t type;
+    struct
+    {
+        struct
+        {
+            uint8_t const* p_data;
+            uint16_t length;
+        } rx_data;
+    } params;
+} ble_nus_evt_t;
+
+typedef struct
+{
+    int unused;
+} ble_nus_t;
+
+static ble_nus_t m_nus;
+static uint16_t m_conn_handle = 1;
+static uint16_t m_ble_gatt_max_data_len = NRF_SDH_BLE_GATT_MAX_MTU_SIZE - OPCODE_LENGTH - HANDLE_LENGTH;
+static uint8_t ble_adv_switch_flag;
+
+static void conn_policy_traffic(void) {}
+static void set_i2c_data_flag(bool flag) { (void)flag; }
+static void start_data_out_timer(void) {}
+static void stop_data_out_timer(void) {}
+static void main_evt_post(int src) { (void)src; }
+static bool i2c_tx_busy(uint8_t const* p_buf) { (void)p_buf; return false; }
+static bool i2c_master_write(uint8_t* buf, uint32_t len) { (void)buf; (void)len; return true; }
+
+/* Receive slots of i2c.c. A response is a slot with a sequence number in every byte pair. */
+#define SLOT_NUM  4
+#define SLOT_SIZE 600
+
+typedef struct
+{
+    uint8_t data[SLOT_SIZE];
+    uint16_t len;
+    uint16_t sent; // bytes that went on air
+    bool in_use;
+} slot_t;
+
+static slot_t m_slots[SLOT_NUM];
+
+static void i2c_rx_release(uint8_t const* p_data);
+static ret_code_t ble_nus_data_send(ble_nus_t* p_nus, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle);
+
+#include "nus.h"
+
+/* The fake SoftDevice: notification buffers, the link, and the air. */
+static struct
+{
+    uint32_t free;
+    bool connected;
+    uint32_t seed;
+    uint32_t preempt_permil; // chance that an event interrupts a call from the main loop
+    uint32_t drop_permil;    // chance that the interrupt is a disconnection
+    uint8_t air[1 << 20];
+    uint32_t air_len;
+    uint8_t expected[1 << 20]; // the responses queued while connected, back to back
+    uint32_t fragments;
+} m_sd;
+
+/* Responses in the order ble_nus_send() got them, and in the order their slots came back. */
+static uint16_t m_sent_seq[4096], m_released_seq[4096];
+static uint32_t m_sent_count, m_released_count, m_expected_air;
+
+static uint32_t rand_next(void)
+{
+    m_sd.seed ^= m_sd.seed << 13;
+    m_sd.seed ^= m_sd.seed >> 17;
+    m_sd.seed ^= m_sd.seed << 5;
+    return m_sd.seed;
+}
+
+static void event_tx_rdy(void)
+{
+    ble_nus_evt_t evt = {.type = BLE_NUS_EVT_TX_RDY};
+
+    nus_data_handler(&evt);
+}
+
+/* The SoftDevice event interrupt: the radio sent some buffers, or the link dropped. A new
+   link only comes up while the main loop is idle, not within one of its calls. */
+static void event_interrupt(bool idle)
+{
+    m_context++;
+    if(m_sd.connected && (rand_next() % 1000 < m_sd.drop_permil))
+    {
+        m_sd.connected = false;
+        m_sd.free = SD_BUFFERS;
+        ble_nus_tx_reset(); // BLE_GAP_EVT_DISCONNECTED of main.c
+    }
+    else if(!m_sd.connected)
+    {
+        m_sd.connected = idle && (rand_next() % 10 == 0);
+    }
+    else if(m_sd.free < SD_BUFFERS)
+    {
+        m_sd.free += 1 + rand_next() % (SD_BUFFERS - m_sd.free);
+        event_tx_rdy();
+    }
+    m_context--;
+}
+
+static void maybe_preempt(void)
+{
+    if((m_context == 0) && (rand_next() % 1000 < m_sd.preempt_permil))
+    {
+        event_interrupt(false);
+    }
+}
+
+static slot_t* slot_of(uint8_t const* p_data)
+{
+    uint32_t i;
+
+    for(i = 0; i < SLOT_NUM; i++)
+    {
+        if((p_data >= m_slots[i].data) && (p_data < m_slots[i].data + SLOT_SIZE))
+        {
+            return &m_slots[i];
+        }
+    }
+    return NULL;
+}
+
+static ret_code_t ble_nus_data_send(ble_nus_t* p_nus, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle)
+{
+    slot_t* p_slot = slot_of(p_data);
+    ret_code_t result;
+
+    (void)p_nus;
+    (void)conn_handle;
+    FAULT(m_critical == 0);
+    FAULT(p_slot != NULL && p_slot->in_use);
+    FAULT(*p_length > 0 && *p_length <= m_ble_gatt_max_data_len);
+
+    maybe_preempt();
+    if(!m_sd.connected)
+    {
+        result = NRF_ERROR_INVALID_STATE;
+    }
+    else if(m_sd.free == 0)
+    {
+        result = NRF_ERROR_RESOURCES;
+    }
+    else
+    {
+        // Every fragment continues its response where the last one stopped.
+        FAULT(p_data == p_slot->data + p_slot->sent);
+        m_sd.free--;
+        memcpy(m_sd.air + m_sd.air_len, p_data, *p_length);
+        m_sd.air_len += *p_length;
+        m_sd.fragments++;
+        p_slot->sent += *p_length;
+        result = NRF_SUCCESS;
+    }
+    maybe_preempt();
+    return result;
+}
+
+static void i2c_rx_release(uint8_t const* p_data)
+{
+    slot_t* p_slot = slot_of(p_data);
+
+    FAULT(m_critical == 0);
+    FAULT(p_slot != NULL && p_slot->in_use && p_slot->data == p_data);
+    if((p_slot == NULL) || !p_slot->in_use)
+    {
+        return;
+    }
+    // Only given back once on air, unless the link is gone.
+    FAULT((p_slot->sent == p_slot->len) || !m_sd.connected);
+    m_released_seq[m_released_count++] = p_slot->data[0] | (p_slot->data[1] << 8);
+    p_slot->in_use = false;
+    maybe_preempt();
+}
+
+/* i2c_read_sched_handler(): a response of the slave read into a free slot goes to BLE. */
+static bool response_send(uint16_t seq)
+{
+    slot_t* p_slot = NULL;
+    uint32_t i;
+
+    for(i = 0; i < SLOT_NUM; i++)
+    {
+        if(!m_slots[i].in_use)
+        {
+            p_slot = &m_slots[i];
+            break;
+        }
+    }
+    if(p_slot == NULL)
+    {
+        return false;
+    }
+    p_slot->len = 2 + rand_next() % (SLOT_SIZE - 1);
+    for(i = 0; i < p_slot->len; i++)
+    {
+        p_slot->data[i] = (i & 1) ? (uint8_t)(seq >> 8) : (uint8_t)seq;
+    }
+    p_slot->sent = 0;
+    p_slot->in_use = true;
+    if(m_sd.connected)
+    {
+        memcpy(m_sd.expected + m_expected_air, p_slot->data, p_slot->len);
+        m_expected_air += p_slot->len;
+    }
+    m_sent_seq[m_sent_count++] = seq;
+    ble_nus_send(p_slot->data, p_slot->len);
+    return true;
+}
+
+static void run_reset(uint32_t seed, uint32_t preempt_permil, uint32_t drop_permil)
+{
+    memset(&m_sd, 0, sizeof(m_sd));
+    memset(m_slots, 0, sizeof(m_slots));
+    m_sd.free = SD_BUFFERS;
+    m_sd.connected = true;
+    m_sd.seed = seed;
+    m_sd.preempt_permil = preempt_permil;
+    m_sd.drop_permil = drop_permil;
+    m_faults = 0;
+    m_sent_count = 0;
+    m_released_count = 0;
+    m_expected_air = 0;
+    ble_nus_tx_reset();
+    m_released_count = 0;
+}
+
+/* The main loop: responses from the slave, and events while it is idle. */
+static void run(uint32_t responses)
+{
+    uint16_t seq = 0;
+
+    while(seq < responses)
+    {
+        if((rand_next() % 2 == 0) && response_send(seq))
+        {
+            seq++;
+        }
+        else
+        {
+            event_interrupt(true);
+        }
+    }
+    while(m_sent_count != m_released_count)
+    {
+        event_interrupt(true);
+    }
+}
+
+static int test_order(void)
+{
+    uint32_t i;
+
+    run_reset(0x2545F491, 300, 0);
+    run(2000);
+    CHECK(m_faults == 0);
+    CHECK(m_released_count == m_sent_count);
+    // Released in the order they were queued, the air holds every response once, in order.
+    for(i = 0; i < m_sent_count; i++)
+    {
+        CHECK(m_released_seq[i] == m_sent_seq[i]);
+    }
+    CHECK(m_sd.air_len == m_expected_air);
+    CHECK(memcmp(m_sd.air, m_sd.expected, m_expected_air) == 0);
+    CHECK(ble_nus_tx_count == 0 && !ble_nus_tx_active);
+    printf("order: %u responses, %u fragments, %u bytes, events preempting 30%% of the calls\n",
+           m_sent_count, m_sd.fragments, m_sd.air_len);
+    return 0;
+}
+
+static int test_disconnect(void)
+{
+    uint32_t run_index, slot;
+
+    // A disconnection in the middle of a send drops what is queued, each slot still comes
+    // back exactly once and the queue is usable again after reconnecting.
+    for(run_index = 0; run_index < 50; run_index++)
+    {
+        run_reset(run_index + 1, 300, 20);
+        run(200);
+        CHECK(m_faults == 0);
+        CHECK(m_released_count == m_sent_count);
+        for(slot = 0; slot < SLOT_NUM; slot++)
+        {
+            CHECK(!m_slots[slot].in_use);
+        }
+        CHECK(ble_nus_tx_count == 0 && !ble_nus_tx_active);
+    }
+    printf("disconnect: 50 runs with links dropped mid-send, every slot released once\n");
+    return 0;
+}
+
+int main(void)
+{
+    if(test_order() || test_disconnect())
+    {
+        return 1;
+    }
+    printf("nus tx: all tests passed\n");
+    return 0;
+}
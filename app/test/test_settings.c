@@ -0,0 +1,405 @@
+/* Runs settings.c against flash_model.c. Every boot is a forked process, so its RAM starts
+   from zero like after a reset while the flash mapping is shared with this one. Covers the
+   migration from the one word per page layout, compaction, power cuts at every programmed
+   word of both, failed flash operations and a simulated year with SoftDevice latency on every
+   flash operation. */
+
+#include "settings.h"
+#include "flash_model.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LEGACY_BLE_CTL 0xBADC0FFE
+#define LEGACY_BAT_LVL 3
+#define BOOT_OK        0
+#define BOOT_FAIL      1
+
+#define PAGE(n) ((uint32_t*)(uintptr_t)(SETTINGS_PAGE0_ADDR + (n) * SETTINGS_PAGE_SIZE))
+
+typedef int (*boot_fn_t)(uint32_t arg);
+
+static uint8_t m_snapshot[2 * SETTINGS_PAGE_SIZE];
+static uint32_t m_boot_fails; /* flash operations failing from the start of the next boot */
+
+/* Boots in a child: settings_init() with fstorage completing synchronously, as it runs before
+   the SoftDevice is enabled, then fn. Returns fn's result or FLASH_MODEL_CUT_EXIT. */
+static int boot(boot_fn_t fn, uint32_t arg, int32_t cut)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+
+    if(pid == 0)
+    {
+        flash_model_sync();
+        flash_model_cut_after(cut);
+        flash_model_fail_next(m_boot_fails);
+        settings_init();
+        status = fn ? fn(arg) : BOOT_OK;
+        fflush(stdout);
+        _exit(status);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    {
+        printf("boot crashed\n");
+        exit(1);
+    }
+    return WEXITSTATUS(status);
+}
+
+static uint32_t get(settings_key_t key)
+{
+    uint32_t value;
+    return settings_get(key, &value) ? value : 0xFFFFFFFF;
+}
+
+static uint32_t steps(void)
+{
+    return flash_model_stats->words + flash_model_stats->erases[0] + flash_model_stats->erases[1];
+}
+
+static void legacy_layout(void)
+{
+    flash_model_erase_all();
+    PAGE(0)[0] = LEGACY_BLE_CTL;
+    PAGE(1)[0] = LEGACY_BAT_LVL;
+}
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return BOOT_FAIL;                                        \
+        }                                                            \
+    } while(0)
+
+static int expect_legacy(uint32_t arg)
+{
+    (void)arg;
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == LEGACY_BLE_CTL);
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == LEGACY_BAT_LVL);
+    return BOOT_OK;
+}
+
+/* After a cut migration the switch must survive, the battery level may be gone. */
+static int expect_legacy_ble(uint32_t arg)
+{
+    uint32_t bat = get(SETTINGS_KEY_BAT_LVL);
+    (void)arg;
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == LEGACY_BLE_CTL);
+    CHECK(bat == LEGACY_BAT_LVL || bat == 0xFFFFFFFF);
+    return BOOT_OK;
+}
+
+static int test_migration(void)
+{
+    uint32_t total;
+    int32_t k;
+
+    legacy_layout();
+    CHECK(boot(expect_legacy, 0, -1) == BOOT_OK);
+    CHECK(flash_model_stats->erases[0] == 0 && flash_model_stats->erases[1] == 1);
+    CHECK(boot(expect_legacy, 0, -1) == BOOT_OK);
+    CHECK(flash_model_stats->erases[1] == 1);
+    total = steps();
+
+    for(k = 0; k < (int32_t)total; k++)
+    {
+        legacy_layout();
+        CHECK(boot(NULL, 0, k) == FLASH_MODEL_CUT_EXIT);
+        CHECK(boot(expect_legacy_ble, 0, -1) == BOOT_OK);
+        CHECK(boot(expect_legacy_ble, 0, -1) == BOOT_OK);
+    }
+    printf("migration: %u steps, power cut at each recovered the switch\n", total);
+    return BOOT_OK;
+}
+
+/* count changes, as many records once the set that starts a compaction is counted. */
+static int fill(uint32_t count)
+{
+    uint32_t i;
+
+    settings_set(SETTINGS_KEY_BLE_CTL, 1);
+    for(i = 0; i + 1 < count; i++)
+    {
+        settings_set(SETTINGS_KEY_BAT_LVL, i);
+    }
+    CHECK(!settings_busy());
+    return BOOT_OK;
+}
+
+static int set_bat(uint32_t value)
+{
+    settings_set(SETTINGS_KEY_BAT_LVL, value);
+    CHECK(!settings_busy());
+    return BOOT_OK;
+}
+
+static int expect_bat(uint32_t value)
+{
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == 1);
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == value);
+    return BOOT_OK;
+}
+
+static uint32_t m_old_bat;
+
+static int expect_bat_new_or_old(uint32_t value)
+{
+    uint32_t bat = get(SETTINGS_KEY_BAT_LVL);
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == 1);
+    CHECK(bat == value || bat == m_old_bat);
+    return BOOT_OK;
+}
+
+static int test_compaction(void)
+{
+    uint32_t per_page = (SETTINGS_PAGE_SIZE - 8) / 8;
+    uint32_t total;
+    int32_t k;
+
+    /* Two and a half pages of records, the last value wins after each compaction. */
+    flash_model_erase_all();
+    CHECK(boot(fill, per_page * 5 / 2, -1) == BOOT_OK);
+    CHECK(flash_model_stats->erases[0] == 1 && flash_model_stats->erases[1] == 2);
+    CHECK(flash_model_stats->overwrites == 0);
+    CHECK(boot(expect_bat, per_page * 5 / 2 - 2, -1) == BOOT_OK);
+
+    /* Page exactly full, the next set compacts first. */
+    flash_model_erase_all();
+    CHECK(boot(fill, per_page, -1) == BOOT_OK);
+    m_old_bat = per_page - 2;
+    CHECK(boot(expect_bat, m_old_bat, -1) == BOOT_OK);
+    memcpy(m_snapshot, PAGE(0), sizeof(m_snapshot));
+
+    total = steps();
+    CHECK(boot(set_bat, 1000, -1) == BOOT_OK);
+    total = steps() - total;
+    CHECK(boot(expect_bat, 1000, -1) == BOOT_OK);
+
+    for(k = 0; k < (int32_t)total; k++)
+    {
+        memcpy(PAGE(0), m_snapshot, sizeof(m_snapshot));
+        CHECK(boot(set_bat, 1000, k) == FLASH_MODEL_CUT_EXIT);
+        CHECK(boot(expect_bat_new_or_old, 1000, -1) == BOOT_OK);
+        /* The store keeps working after the cut. */
+        CHECK(boot(set_bat, 2000 + k, -1) == BOOT_OK);
+        CHECK(boot(expect_bat, 2000 + k, -1) == BOOT_OK);
+    }
+    CHECK(flash_model_stats->overwrites == 0);
+    printf("compaction: %u steps, power cut at each kept the old or the new value\n", total);
+    return BOOT_OK;
+}
+
+/* SETTINGS_RETRY_MAX of settings.c. */
+#define RETRY_MAX 3
+
+/* A set whose operations fail arg times, then one more. */
+static int set_bat_failing(uint32_t fails)
+{
+    flash_model_fail_next(fails);
+    settings_set(SETTINGS_KEY_BAT_LVL, 100 + fails);
+    CHECK(settings_busy() == (fails > RETRY_MAX));
+    settings_set(SETTINGS_KEY_BLE_CTL, 0);
+    CHECK(!settings_busy());
+    return BOOT_OK;
+}
+
+static int expect_failing(uint32_t fails)
+{
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == 0);
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == 100 + fails);
+    return BOOT_OK;
+}
+
+/* The first boot formats, its erases fail m_boot_fails times. settings_flush() gives it one
+   more try after the retries. */
+static int format_failing(uint32_t fails)
+{
+    CHECK(settings_busy() == (fails > RETRY_MAX + 1));
+    settings_set(SETTINGS_KEY_BAT_LVL, 7);
+    CHECK(!settings_busy());
+    return BOOT_OK;
+}
+
+static int expect_format(uint32_t arg)
+{
+    (void)arg;
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == LEGACY_BLE_CTL);
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == 7);
+    return BOOT_OK;
+}
+
+static int test_failure(void)
+{
+    uint32_t per_page = (SETTINGS_PAGE_SIZE - 8) / 8;
+    uint32_t fails;
+
+    /* A failed record is written again at once, past the retries it waits for the next set.
+       Either way the slots it failed in stay erased between records. */
+    for(fails = 0; fails <= RETRY_MAX + 1; fails++)
+    {
+        flash_model_erase_all();
+        CHECK(boot(fill, 3, -1) == BOOT_OK);
+        CHECK(boot(set_bat_failing, fails, -1) == BOOT_OK);
+        CHECK(boot(expect_failing, fails, -1) == BOOT_OK);
+    }
+
+    /* A failed compaction restarts from the erase. */
+    for(fails = 0; fails <= RETRY_MAX + 1; fails++)
+    {
+        flash_model_erase_all();
+        CHECK(boot(fill, per_page, -1) == BOOT_OK);
+        CHECK(boot(set_bat_failing, fails, -1) == BOOT_OK);
+        CHECK(boot(expect_failing, fails, -1) == BOOT_OK);
+    }
+
+    /* Nothing is appended to the legacy page while the format has not gone through. */
+    for(fails = 0; fails <= RETRY_MAX + 2; fails++)
+    {
+        legacy_layout();
+        m_boot_fails = fails;
+        CHECK(boot(format_failing, fails, -1) == BOOT_OK);
+        m_boot_fails = 0;
+        CHECK(boot(expect_format, 0, -1) == BOOT_OK);
+    }
+    CHECK(flash_model_stats->overwrites == 0);
+    printf("failure: %u failed operations in a row retried at once, more left for the next set\n", RETRY_MAX);
+    return BOOT_OK;
+}
+
+#define DAY_US  (24ull * 3600 * 1000000)
+#define HOUR_US (3600ull * 1000000)
+
+/* Level over a day: discharging 4 -> 0 during the day, charging overnight. */
+static const uint8_t m_day_levels[24] = {
+    0, 1, 2, 3, 4, 4, 4, 4, 4, 3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0
+};
+
+typedef struct
+{
+    uint32_t sets;
+    uint32_t changes;
+    uint64_t worst_us;
+} year_result_t;
+
+static year_result_t* m_year;
+
+static void run_until(uint64_t t, uint64_t* p_busy_since)
+{
+    while(flash_model_next_us() <= t)
+    {
+        flash_model_run_next();
+        if(*p_busy_since != UINT64_MAX && !settings_busy())
+        {
+            if(flash_model_now_us - *p_busy_since > m_year->worst_us)
+            {
+                m_year->worst_us = flash_model_now_us - *p_busy_since;
+            }
+            *p_busy_since = UINT64_MAX;
+        }
+    }
+    flash_model_now_us = t;
+}
+
+static void year_set(settings_key_t key, uint32_t value, uint64_t t, uint64_t* p_busy_since)
+{
+    uint32_t old = get(key);
+
+    run_until(t, p_busy_since);
+    m_year->sets++;
+    m_year->changes += old != value;
+    if(*p_busy_since == UINT64_MAX && old != value)
+    {
+        *p_busy_since = t;
+    }
+    settings_set(key, value);
+}
+
+static int year(uint32_t days)
+{
+    uint64_t busy_since = UINT64_MAX;
+    uint64_t t;
+    uint32_t d, h, i;
+
+    flash_model_async(30000, 1);
+    flash_model_now_us = 0;
+    for(d = 0; d < days; d++)
+    {
+        for(h = 0; h < 24; h++)
+        {
+            t = d * DAY_US + h * HOUR_US;
+            year_set(SETTINGS_KEY_BAT_LVL, m_day_levels[h], t, &busy_since);
+            if(d % 3 == 0 && h == 12)
+            {
+                /* A burst of switch commands from the ST, 5 ms apart. */
+                for(i = 0; i < 10; i++)
+                {
+                    year_set(SETTINGS_KEY_BLE_CTL, (i & 1) ? 0xABABABAB : 0xBADC0FFE, t + 1000 + i * 5000, &busy_since);
+                }
+            }
+        }
+    }
+    run_until(UINT64_MAX - 1, &busy_since);
+    CHECK(!settings_busy());
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == m_day_levels[23]);
+    return BOOT_OK;
+}
+
+static int expect_year(uint32_t arg)
+{
+    (void)arg;
+    CHECK(get(SETTINGS_KEY_BAT_LVL) == m_day_levels[23]);
+    CHECK(get(SETTINGS_KEY_BLE_CTL) == 0xABABABAB);
+    return BOOT_OK;
+}
+
+static int test_year(void)
+{
+    flash_model_stats_t log;
+    uint32_t old_erases;
+    uint64_t old_busy_us;
+
+    m_year = mmap(NULL, sizeof(*m_year), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(m_year != MAP_FAILED);
+    memset(m_year, 0, sizeof(*m_year));
+
+    legacy_layout();
+    CHECK(boot(year, 365, -1) == BOOT_OK);
+    CHECK(flash_model_stats->overwrites == 0);
+    log = *flash_model_stats;
+    CHECK(boot(expect_year, 0, -1) == BOOT_OK);
+
+    /* The former layout erased the page and wrote one word for every change. */
+    old_erases = m_year->changes;
+    old_busy_us = (uint64_t)m_year->changes * (FLASH_MODEL_ERASE_US + FLASH_MODEL_WORD_US);
+
+    printf("year: %u sets, %u changes, %u words programmed\n", m_year->sets, m_year->changes, log.words);
+    printf("  former layout: %u erases, %.1f s flash busy\n", old_erases, old_busy_us / 1e6);
+    printf("  log:           %u erases (page0 %u, page1 %u), %.2f s flash busy\n",
+           log.erases[0] + log.erases[1], log.erases[0], log.erases[1], log.busy_us / 1e6);
+    printf("  worst change to flash with up to 30 ms SoftDevice latency: %.1f ms\n", m_year->worst_us / 1e3);
+    CHECK((log.erases[0] + log.erases[1]) * 100 < old_erases);
+    return BOOT_OK;
+}
+
+int main(void)
+{
+    flash_model_init(SETTINGS_PAGE0_ADDR, 2);
+    if(test_migration() != BOOT_OK || test_compaction() != BOOT_OK || test_failure() != BOOT_OK ||
+       test_year() != BOOT_OK)
+    {
+        return 1;
+    }
+    printf("settings: all tests passed\n");
+    return 0;
+}
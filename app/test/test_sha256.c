@@ -0,0 +1,307 @@
+/* Checks the SDK sha256.c against the FIPS 180-4 example vectors and against a textbook
+   implementation shaped like the former one on random messages fed at random alignments and
+   update splits, then compares the throughput of both. */
+
+#include <stddef.h>
+#include "sha256.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RANDOM_RUNS  3000
+#define RANDOM_MAX   1000
+#define COST_SIZE    (200 * 1024)
+#define COST_UPDATE  512 /* bytes per update, as the bootloader hashes a flash write */
+#define COST_ROUNDS  20
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+static const uint32_t m_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* The reference, shaped like the former sha256.c: the whole schedule expanded first, the working
+   variables shuffled every round and every byte copied through the block buffer. */
+typedef struct
+{
+    uint8_t data[64];
+    uint32_t datalen;
+    uint64_t bitlen;
+    uint32_t state[8];
+} ref_context_t;
+
+static void ref_transform(ref_context_t* p_ctx)
+{
+    uint32_t w[64], v[8], t1, t2;
+    uint32_t i;
+
+    for(i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)p_ctx->data[4 * i] << 24) | ((uint32_t)p_ctx->data[4 * i + 1] << 16) |
+               ((uint32_t)p_ctx->data[4 * i + 2] << 8) | p_ctx->data[4 * i + 3];
+    }
+    for(; i < 64; i++)
+    {
+        w[i] = (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+               (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+    }
+    memcpy(v, p_ctx->state, sizeof(v));
+    for(i = 0; i < 64; i++)
+    {
+        t1 = v[7] + (ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) +
+             m_k[i] + w[i];
+        t2 = (ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        v[7] = v[6];
+        v[6] = v[5];
+        v[5] = v[4];
+        v[4] = v[3] + t1;
+        v[3] = v[2];
+        v[2] = v[1];
+        v[1] = v[0];
+        v[0] = t1 + t2;
+    }
+    for(i = 0; i < 8; i++)
+    {
+        p_ctx->state[i] += v[i];
+    }
+}
+
+static void ref_init(ref_context_t* p_ctx)
+{
+    static const uint32_t iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    memcpy(p_ctx->state, iv, sizeof(iv));
+    p_ctx->datalen = 0;
+    p_ctx->bitlen = 0;
+}
+
+static void ref_update(ref_context_t* p_ctx, uint8_t const* p_data, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        p_ctx->data[p_ctx->datalen++] = p_data[i];
+        if(p_ctx->datalen == 64)
+        {
+            ref_transform(p_ctx);
+            p_ctx->bitlen += 512;
+            p_ctx->datalen = 0;
+        }
+    }
+}
+
+static void ref_final(ref_context_t* p_ctx, uint8_t* p_hash)
+{
+    uint64_t bitlen = p_ctx->bitlen + (uint64_t)p_ctx->datalen * 8;
+    uint8_t pad = 0x80;
+    uint32_t i;
+
+    ref_update(p_ctx, &pad, 1);
+    pad = 0;
+    while(p_ctx->datalen != 56)
+    {
+        ref_update(p_ctx, &pad, 1);
+    }
+    for(i = 0; i < 8; i++)
+    {
+        pad = (uint8_t)(bitlen >> (56 - 8 * i));
+        ref_update(p_ctx, &pad, 1);
+    }
+    for(i = 0; i < 32; i++)
+    {
+        p_hash[i] = (uint8_t)(p_ctx->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static int hex_equal(uint8_t const* p_hash, char const* p_hex)
+{
+    char hex[65];
+    uint32_t i;
+
+    for(i = 0; i < 32; i++)
+    {
+        sprintf(hex + 2 * i, "%02x", p_hash[i]);
+    }
+    return strcmp(hex, p_hex) == 0;
+}
+
+static int test_vectors(void)
+{
+    static const struct
+    {
+        char const* p_msg;
+        char const* p_digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+         "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+    };
+    sha256_context_t ctx;
+    uint8_t hash[32];
+    uint8_t block[1000];
+    uint32_t i;
+
+    for(i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        CHECK(sha256_init(&ctx) == NRF_SUCCESS);
+        CHECK(sha256_update(&ctx, (uint8_t const*)vectors[i].p_msg, strlen(vectors[i].p_msg)) == NRF_SUCCESS);
+        CHECK(sha256_final(&ctx, hash, 0) == NRF_SUCCESS);
+        CHECK(hex_equal(hash, vectors[i].p_digest));
+    }
+
+    // One million 'a', in updates that are not a multiple of the block.
+    memset(block, 'a', sizeof(block));
+    sha256_init(&ctx);
+    for(i = 0; i < 1000; i++)
+    {
+        sha256_update(&ctx, block, sizeof(block));
+    }
+    sha256_final(&ctx, hash, 0);
+    CHECK(hex_equal(hash, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+
+    CHECK(sha256_update(NULL, block, 1) == NRF_ERROR_NULL);
+    return 0;
+}
+
+static uint32_t m_rand = 0x2545F491;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+/* Random length, start offset and update split, so both the aligned __REV load and the byte
+   load and both the buffered and the direct block path are taken. */
+static int test_random(void)
+{
+    static uint8_t msg[RANDOM_MAX + 4];
+    sha256_context_t ctx;
+    ref_context_t ref;
+    uint8_t hash[32], expected[32];
+    uint32_t run, i, offset, size, done, part;
+
+    for(run = 0; run < RANDOM_RUNS; run++)
+    {
+        offset = rand_next() % 4;
+        size = rand_next() % (RANDOM_MAX + 1);
+        for(i = 0; i < size; i++)
+        {
+            msg[offset + i] = (uint8_t)rand_next();
+        }
+        ref_init(&ref);
+        ref_update(&ref, msg + offset, size);
+        ref_final(&ref, expected);
+
+        sha256_init(&ctx);
+        for(done = 0; done < size; done += part)
+        {
+            part = 1 + rand_next() % (size - done);
+            sha256_update(&ctx, msg + offset + done, part);
+        }
+        if(run & 1)
+        {
+            // Little endian output, the whole digest reversed.
+            sha256_final(&ctx, hash, 1);
+            for(i = 0; i < 16; i++)
+            {
+                uint8_t tmp = hash[i];
+                hash[i] = hash[31 - i];
+                hash[31 - i] = tmp;
+            }
+        }
+        else
+        {
+            sha256_final(&ctx, hash, 0);
+        }
+        CHECK(memcmp(hash, expected, 32) == 0);
+    }
+    printf("%u random messages of up to %u bytes match the reference\n", RANDOM_RUNS, RANDOM_MAX);
+    return 0;
+}
+
+static uint8_t m_cost_buf[COST_SIZE];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best of COST_ROUNDS passes. Host figures, they compare the two implementations, the
+   Cortex-M4 numbers are lower. */
+static void report_cost(void)
+{
+    sha256_context_t ctx;
+    ref_context_t ref;
+    uint8_t hash[32];
+    double t0, ref_ns = 1e30, new_ns = 1e30;
+    uint32_t i, round;
+
+    for(i = 0; i < COST_SIZE; i++)
+    {
+        m_cost_buf[i] = (uint8_t)rand_next();
+    }
+    for(round = 0; round < COST_ROUNDS; round++)
+    {
+        t0 = now_ns();
+        ref_init(&ref);
+        for(i = 0; i < COST_SIZE; i += COST_UPDATE)
+        {
+            ref_update(&ref, m_cost_buf + i, COST_UPDATE);
+        }
+        ref_final(&ref, hash);
+        t0 = now_ns() - t0;
+        ref_ns = t0 < ref_ns ? t0 : ref_ns;
+
+        t0 = now_ns();
+        sha256_init(&ctx);
+        for(i = 0; i < COST_SIZE; i += COST_UPDATE)
+        {
+            sha256_update(&ctx, m_cost_buf + i, COST_UPDATE);
+        }
+        sha256_final(&ctx, hash, 0);
+        t0 = now_ns() - t0;
+        new_ns = t0 < new_ns ? t0 : new_ns;
+    }
+    printf("%u KB in %u byte updates on this host: %.0f MB/s former code, %.0f MB/s now\n",
+           COST_SIZE / 1024, COST_UPDATE, COST_SIZE * 1e3 / ref_ns, COST_SIZE * 1e3 / new_ns);
+}
+
+int main(void)
+{
+    if(test_vectors() || test_random())
+    {
+        return 1;
+    }
+    report_cost();
+    printf("sha256: all tests passed\n");
+    return 0;
+}
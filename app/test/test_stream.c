@@ -0,0 +1,1152 @@
+/* Streams NUS and FIDO messages end to end through the BLE data path of the app: nus.h and
+   fido.h as main.c includes them, i2c.c, nfc.c, main_evt.c and conn_policy.c, on a fake
+   SoftDevice, a model TWIM and a model ST. The central writes a request over the link,
+   nus_data_handler()/fido_data_handler() queue it with i2c_master_write(), the ST raises
+   TWI_STATUS_GPIO once its response is ready, twi_handler() reads the response and
+   ble_nus_send()/ble_fido_send() put it back on air. Everything runs in virtual time:
+   - the link runs on 2M PHY with 251 byte packets, at the interval of the conn_policy
+     profile the central accepted. Each exchange carries one write and one notification, the
+     SoftDevice queues HVN_QUEUE notifications, and a busy connection event extends up to the
+     interval;
+   - the TWIM runs at 400 kHz as in test_i2c_rx;
+   - the ST needs ST_PROC_NS plus ST_BYTE_NS per request byte to work out a response.
+   SoftDevice events preempt the main loop, also while ble_fido_send() waits for a
+   notification buffer. Checks that every request reaches the ST and every response reaches
+   the central intact and in order, and that throughput stays above the floors below. Prints
+   bytes/s, the latency percentiles of both directions and the peak use of each buffer on the
+   way. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "ble_conn_params.h"
+#include "boards.h"
+#include "conn_policy.h"
+#include "i2c.h"
+#include "main_evt.h"
+#include "nfc_t4t_lib.h"
+#include "nrf_drv_twi.h"
+#include "nrf_log.h"
+#include "sched_model.h"
+#include "sdk_errors.h"
+#include "timer_model.h"
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+/* Tallied instead of checked in place, the fakes run in the middle of the code under test. */
+#define FAULT(cond)     \
+    do                  \
+    {                   \
+        if(!(cond))     \
+        {               \
+            m_faults++; \
+        }               \
+    } while(0)
+
+static uint32_t m_faults;
+
+/* What main.c defines before it includes nus.h and fido.h. */
+#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE 247
+#define OPCODE_LENGTH                 1
+#define HANDLE_LENGTH                 2
+#define DATA_INIT                     0x00
+#define DATA_DATA                     0x02
+#define BLE_OFF_ALWAYS                2
+#define BLE_FIDO_MAX_DATA_LEN         (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - OPCODE_LENGTH - HANDLE_LENGTH)
+#define CONN_HANDLE                   1
+
+typedef enum
+{
+    BLE_NUS_EVT_RX_DATA,
+    BLE_NUS_EVT_TX_RDY
+} ble_nus_evt_type_t;
+
+typedef struct
+{
+    ble_nus_evt_type_t type;
+    struct
+    {
+        struct
+        {
+            uint8_t const* p_data;
+            uint16_t length;
+        } rx_data;
+    } params;
+} ble_nus_evt_t;
+
+typedef enum
+{
+    BLE_FIDO_EVT_RX_DATA,
+    BLE_FIDO_EVT_TX_RDY
+} ble_fido_evt_type_t;
+
+typedef struct
+{
+    ble_fido_evt_type_t type;
+    struct
+    {
+        struct
+        {
+            uint8_t const* p_data;
+            uint16_t length;
+        } rx_data;
+    } params;
+} ble_fido_evt_t;
+
+typedef struct
+{
+    int unused;
+} ble_nus_t;
+
+typedef struct
+{
+    int unused;
+} ble_fido_t;
+
+static ble_nus_t m_nus;
+static ble_fido_t m_fido;
+static uint16_t m_conn_handle = CONN_HANDLE;
+// After the ATT MTU exchange, nrf_ble_gatt gets NRF_SDH_BLE_GATT_MAX_MTU_SIZE from the central.
+static uint16_t m_ble_gatt_max_data_len = NRF_SDH_BLE_GATT_MAX_MTU_SIZE - OPCODE_LENGTH - HANDLE_LENGTH;
+uint8_t ble_adv_switch_flag;
+
+static ret_code_t ble_nus_data_send(ble_nus_t* p_nus, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle);
+static ret_code_t ble_fido_data_send(ble_fido_t* p_fido, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle);
+
+// timer.h
+#define RCV_DATA_TIMEOUT_INTERVAL APP_TIMER_TICKS(2000)
+
+APP_TIMER_DEF(m_data_out_timer_id);
+
+static uint32_t m_data_timeouts;
+
+static void start_data_out_timer(void)
+{
+    ret_code_t err_code = app_timer_start(m_data_out_timer_id, RCV_DATA_TIMEOUT_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void stop_data_out_timer(void)
+{
+    ret_code_t err_code = app_timer_stop(m_data_out_timer_id);
+    APP_ERROR_CHECK(err_code);
+}
+
+#include "nus.h"
+#include "fido.h"
+
+static void data_timeout_handler(void* p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    m_data_timeouts++;
+    ble_nus_state_reset();
+}
+
+extern int nfc_init(void);
+extern void nfc_poll(void* p_event_data, uint16_t event_size);
+
+#define NUS_MESSAGES  2000
+#define FIDO_MESSAGES 1000
+#define MESSAGES_MAX  NUS_MESSAGES
+#define NUS_MSG_MAX   2900 // payload, a request fits the NUS receive ring and a response an i2c.c slot
+#define FIDO_MSG_MAX  1021 // fido_recv_buf less the frame header
+#define FIDO_RSP_MAX  1200
+#define REPORT_SIZE   64   // the client frames NUS messages in HID sized reports, '?' first
+#define WIRE_MAX      3072 // i2c_data_buffer_t data
+#define NEVER         UINT64_MAX
+#define RUN_LIMIT_NS  (600 * 1000000000ull)
+
+#define BYTE_NS         22500ull // TWI, 9 clocks at 400 kHz
+#define LINK_BYTE_NS    4000ull  // 2M PHY
+#define LINK_IFS_NS     150000ull
+#define LINK_PDU_EXTRA  21 // preamble, access address, header, MIC, CRC, L2CAP and ATT headers
+#define LINK_EMPTY_EXTRA 10
+#define LINK_EXCHANGE_MAX_NS (2 * LINK_IFS_NS + 2 * (NRF_SDH_BLE_GATT_MAX_MTU_SIZE + LINK_PDU_EXTRA) * LINK_BYTE_NS)
+#define HVN_QUEUE       1 // hvn_tx_queue_size, ble_stack_init() keeps the SoftDevice default
+#define UPDATE_EVENTS   6 // connection events from an accepted update to its instant
+#define CENTRAL_QUEUE   64
+#define SD_EVT_QUEUE    64
+#define ST_QUEUE        4
+#define ST_PROC_NS      500000ull
+#define ST_BYTE_NS      200ull
+#define GPIO_NS         50000ull // ST response ready to TWI_STATUS_GPIO
+
+/* Regression floors, about 80% of what the current code reaches in this run. */
+#define FLOOR_NUS_BPS  17000
+#define FLOOR_FIDO_BPS 7000
+
+static uint64_t m_now; // virtual ns
+
+static uint32_t m_rand = 0x2545F491;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+/* Mostly commands and short answers, some firmware chunk sized ones. */
+static uint32_t size_pick(uint32_t max)
+{
+    uint32_t r = rand_next() % 100;
+
+    if(r < 70)
+    {
+        return 1 + rand_next() % 200;
+    }
+    if(r < 95)
+    {
+        return 200 + rand_next() % 800;
+    }
+    return 1000 + rand_next() % (max - 1000 + 1);
+}
+
+/* Interrupt priorities, a call only runs from a level above the one it interrupts. */
+enum
+{
+    LEVEL_MAIN, // thread mode
+    LEVEL_SD,   // SoftDevice events and RTC1, the lowest interrupt priority
+    LEVEL_HIGH  // TWI and GPIOTE, APP_IRQ_PRIORITY_HIGH
+};
+
+static uint32_t m_level = LEVEL_MAIN;
+
+/* app_timer ticks from virtual ns and back, timer_model only knows ticks. */
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return (ticks * 1000000000ull + APP_TIMER_CLOCK_FREQ - 1) / APP_TIMER_CLOCK_FREQ;
+}
+
+static void clock_set(uint64_t t)
+{
+    m_now = t;
+    timer_model_now = t * APP_TIMER_CLOCK_FREQ / 1000000000ull;
+}
+
+/* The central: one request at a time per service, the next one written once the response is in. */
+enum
+{
+    SERVICE_NUS,
+    SERVICE_FIDO
+};
+
+typedef struct
+{
+    uint8_t service;
+    uint32_t messages; // to answer before the run ends
+    uint32_t done;
+    uint64_t next_at; // when the next request is written, NEVER while one is outstanding
+    uint16_t id;
+    uint8_t req[WIRE_MAX];
+    uint32_t req_len;
+    uint8_t rsp[WIRE_MAX]; // the response as the central reassembles it
+    uint32_t rsp_len, rsp_got;
+    uint8_t rsp_seq;
+    uint64_t t_issue, t_st, t_gpio;
+    uint64_t payload_bytes; // request and response payloads
+    uint64_t rtt[MESSAGES_MAX], up[MESSAGES_MAX], down[MESSAGES_MAX];
+} client_t;
+
+static client_t m_client[2];
+
+/* A packet on air, a write of the central or a notification of the peripheral. */
+typedef struct
+{
+    uint8_t service;
+    uint16_t len;
+    uint8_t data[BLE_FIDO_MAX_DATA_LEN];
+} packet_t;
+
+static packet_t m_central_q[CENTRAL_QUEUE];
+static uint32_t m_central_head, m_central_count, m_central_peak;
+static packet_t m_hvn[HVN_QUEUE];
+static uint32_t m_hvn_head, m_hvn_count;
+
+/* SoftDevice events waiting for the event interrupt. */
+typedef enum
+{
+    SD_EVT_RX,
+    SD_EVT_TX_COMPLETE,
+    SD_EVT_CONN_PARAMS
+} sd_evt_type_t;
+
+typedef struct
+{
+    sd_evt_type_t type;
+    packet_t packet;
+} sd_evt_t;
+
+static sd_evt_t m_sd_evt[SD_EVT_QUEUE];
+static uint32_t m_sd_evt_head, m_sd_evt_count, m_sd_evt_peak;
+
+static struct
+{
+    uint64_t next;     // next exchange, NEVER while no connection event is due
+    uint64_t anchor;   // start of the running or last connection event
+    uint64_t interval;
+    bool in_event;
+    uint64_t update_at; // instant of the update the central accepted, NEVER for none
+    uint64_t update_interval;
+    uint32_t events, exchanges;
+    uint64_t air_up, air_down; // ATT payload bytes
+} m_link;
+
+static void sd_evt_push(sd_evt_type_t type, packet_t const* p_packet)
+{
+    sd_evt_t* p_evt;
+
+    FAULT(m_sd_evt_count < SD_EVT_QUEUE);
+    if(m_sd_evt_count == SD_EVT_QUEUE)
+    {
+        return;
+    }
+    p_evt = &m_sd_evt[(m_sd_evt_head + m_sd_evt_count++) % SD_EVT_QUEUE];
+    p_evt->type = type;
+    if(p_packet != NULL)
+    {
+        p_evt->packet = *p_packet;
+    }
+    m_sd_evt_peak = m_sd_evt_count > m_sd_evt_peak ? m_sd_evt_count : m_sd_evt_peak;
+}
+
+/* Data to move, the link takes it from the next connection event on. */
+static void link_wake(void)
+{
+    if(m_link.next == NEVER)
+    {
+        m_link.next = m_link.anchor + ((m_now - m_link.anchor) / m_link.interval + 1) * m_link.interval;
+    }
+}
+
+static uint64_t pdu_ns(packet_t const* p_packet)
+{
+    return (p_packet != NULL ? p_packet->len + LINK_PDU_EXTRA : LINK_EMPTY_EXTRA) * LINK_BYTE_NS;
+}
+
+static void central_receive(packet_t const* p_packet);
+
+/* One exchange of a connection event: a write of the central, then a notification. */
+static void link_exchange(void)
+{
+    packet_t const* p_up = NULL;
+    packet_t const* p_down = NULL;
+
+    if(!m_link.in_event)
+    {
+        m_link.anchor = m_now;
+        m_link.in_event = true;
+        m_link.events++;
+    }
+    else if(m_now + LINK_EXCHANGE_MAX_NS > m_link.anchor + m_link.interval)
+    {
+        m_link.in_event = false;
+    }
+    if(!m_link.in_event || (m_central_count == 0 && m_hvn_count == 0))
+    {
+        // The event ends, a later one picks up what is left.
+        m_link.in_event = false;
+        m_link.next = NEVER;
+        if(m_central_count > 0 || m_hvn_count > 0)
+        {
+            link_wake();
+        }
+        return;
+    }
+
+    if(m_central_count > 0)
+    {
+        p_up = &m_central_q[m_central_head];
+        m_central_head = (m_central_head + 1) % CENTRAL_QUEUE;
+        m_central_count--;
+        m_link.air_up += p_up->len;
+        sd_evt_push(SD_EVT_RX, p_up);
+    }
+    if(m_hvn_count > 0)
+    {
+        p_down = &m_hvn[m_hvn_head];
+        m_hvn_head = (m_hvn_head + 1) % HVN_QUEUE;
+        m_hvn_count--;
+        m_link.air_down += p_down->len;
+        central_receive(p_down);
+        sd_evt_push(SD_EVT_TX_COMPLETE, NULL);
+    }
+    m_link.exchanges++;
+    m_link.next = m_now + 2 * LINK_IFS_NS + pdu_ns(p_up) + pdu_ns(p_down);
+}
+
+static void link_update(void)
+{
+    m_link.interval = m_link.update_interval;
+    m_link.anchor = m_now;
+    m_link.in_event = false;
+    m_link.next = NEVER;
+    m_link.update_at = NEVER;
+    if(m_central_count > 0 || m_hvn_count > 0)
+    {
+        link_wake();
+    }
+    sd_evt_push(SD_EVT_CONN_PARAMS, NULL);
+}
+
+/* The central takes the interval at the top of the range conn_policy asks for. */
+ret_code_t ble_conn_params_change_conn_params(uint16_t conn_handle, ble_gap_conn_params_t* p_new_params)
+{
+    FAULT(conn_handle == CONN_HANDLE);
+    if(m_link.update_at != NEVER)
+    {
+        return NRF_ERROR_BUSY;
+    }
+    m_link.update_interval = (uint64_t)p_new_params->max_conn_interval * UNIT_1_25_MS * 1000;
+    m_link.update_at = m_now + UPDATE_EVENTS * m_link.interval;
+    return NRF_SUCCESS;
+}
+
+static uint32_t m_hvn_peak; // responses queued in nus.h at once
+static uint64_t m_wait_ns[LEVEL_HIGH + 1], m_wait_max_ns[LEVEL_HIGH + 1];
+
+static bool event_run_next(uint64_t t_limit);
+
+static ret_code_t hvn_send(uint8_t service, uint8_t const* p_data, uint16_t const* p_length)
+{
+    packet_t* p_packet;
+
+    FAULT(*p_length > 0 && *p_length <= m_ble_gatt_max_data_len);
+    if(m_hvn_count == HVN_QUEUE)
+    {
+        return NRF_ERROR_RESOURCES;
+    }
+    p_packet = &m_hvn[(m_hvn_head + m_hvn_count++) % HVN_QUEUE];
+    p_packet->service = service;
+    p_packet->len = *p_length;
+    memcpy(p_packet->data, p_data, *p_length);
+    link_wake();
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ble_nus_data_send(ble_nus_t* p_nus, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle)
+{
+    (void)p_nus;
+    FAULT(conn_handle == CONN_HANDLE);
+    m_hvn_peak = ble_nus_tx_count > m_hvn_peak ? ble_nus_tx_count : m_hvn_peak;
+    return hvn_send(SERVICE_NUS, p_data, p_length);
+}
+
+/* ble_fido_send_packet() calls again right away. The radio, and the interrupts above the
+   caller, run on until a buffer is free. */
+static ret_code_t ble_fido_data_send(ble_fido_t* p_fido, uint8_t* p_data, uint16_t* p_length, uint16_t conn_handle)
+{
+    ret_code_t result;
+    uint64_t t0 = m_now;
+
+    (void)p_fido;
+    FAULT(conn_handle == CONN_HANDLE);
+    result = hvn_send(SERVICE_FIDO, p_data, p_length);
+    if(result == NRF_ERROR_RESOURCES)
+    {
+        FAULT(m_link.next != NEVER);
+        while((m_hvn_count == HVN_QUEUE) && event_run_next(NEVER))
+        {
+        }
+        // The event interrupt pended along with the free buffer runs before the call is retried.
+        while(event_run_next(m_now))
+        {
+        }
+        m_wait_ns[m_level] += m_now - t0;
+        m_wait_max_ns[m_level] = m_now - t0 > m_wait_max_ns[m_level] ? m_now - t0 : m_wait_max_ns[m_level];
+    }
+    return result;
+}
+
+/* The ST: takes requests off the bus, answers each one in turn. */
+typedef struct
+{
+    client_t* p_client;
+    uint8_t wire[WIRE_MAX];
+    uint32_t wire_len;
+} st_rsp_t;
+
+static struct
+{
+    uint8_t rx[2048]; // the running write transaction
+    uint32_t rx_len;
+    bool nus_open; // a NUS request is coming in, its first report was seen
+    uint32_t nus_len, nus_got;
+    uint8_t nus_msg[WIRE_MAX];
+    client_t* p_job[ST_QUEUE]; // requests received
+    uint32_t job_head, job_count;
+    uint64_t done_at; // the oldest request answered, NEVER while idle
+    st_rsp_t rsp[ST_QUEUE];
+    uint32_t rsp_head, rsp_count;
+    bool signalled; // TWI_STATUS_GPIO raised for the head response, until it is read
+    uint32_t read_pos;
+    uint64_t written, read; // bytes over the bus
+} m_st;
+
+static uint64_t m_gpio_at = NEVER;
+
+static void st_request(client_t* p_client)
+{
+    p_client->t_st = m_now;
+    FAULT(m_st.job_count < ST_QUEUE);
+    if(m_st.job_count == ST_QUEUE)
+    {
+        return;
+    }
+    m_st.p_job[(m_st.job_head + m_st.job_count++) % ST_QUEUE] = p_client;
+    if(m_st.job_count == 1)
+    {
+        m_st.done_at = m_now + ST_PROC_NS + p_client->req_len * ST_BYTE_NS;
+    }
+}
+
+static void st_signal(void)
+{
+    if(!m_st.signalled && (m_st.rsp_count > 0))
+    {
+        m_st.signalled = true;
+        m_gpio_at = m_now + GPIO_NS;
+    }
+}
+
+/* The request is in, the response goes out as the ST puts it on the bus. */
+static void st_answer(void)
+{
+    client_t* p_client = m_st.p_job[m_st.job_head];
+    st_rsp_t* p_rsp = &m_st.rsp[(m_st.rsp_head + m_st.rsp_count) % ST_QUEUE];
+    uint32_t len, header, i;
+
+    FAULT(m_st.rsp_count < ST_QUEUE);
+    m_st.job_head = (m_st.job_head + 1) % ST_QUEUE;
+    m_st.job_count--;
+    m_st.done_at = NEVER;
+    if(m_st.job_count > 0)
+    {
+        m_st.done_at = m_now + ST_PROC_NS + m_st.p_job[m_st.job_head]->req_len * ST_BYTE_NS;
+    }
+
+    p_rsp->p_client = p_client;
+    if(p_client->service == SERVICE_NUS)
+    {
+        len = size_pick(NUS_MSG_MAX);
+        header = 9;
+        memcpy(p_rsp->wire, "?##", 3);
+        p_rsp->wire[3] = (uint8_t)(p_client->id >> 8);
+        p_rsp->wire[4] = (uint8_t)p_client->id;
+        p_rsp->wire[5] = (uint8_t)(len >> 24);
+        p_rsp->wire[6] = (uint8_t)(len >> 16);
+        p_rsp->wire[7] = (uint8_t)(len >> 8);
+        p_rsp->wire[8] = (uint8_t)len;
+    }
+    else
+    {
+        len = size_pick(FIDO_RSP_MAX);
+        header = 6;
+        memcpy(p_rsp->wire, "fid", 3);
+        p_rsp->wire[3] = 0x83; // CTAPBLE_MSG
+        p_rsp->wire[4] = (uint8_t)(len >> 8);
+        p_rsp->wire[5] = (uint8_t)len;
+    }
+    for(i = header; i < header + len; i++)
+    {
+        p_rsp->wire[i] = (uint8_t)rand_next();
+    }
+    p_rsp->wire_len = header + len;
+    m_st.rsp_count++;
+
+    // What the central gets: NUS the whole response, FIDO from the status byte on.
+    p_client->rsp_len = p_rsp->wire_len - (p_client->service == SERVICE_NUS ? 0 : 3);
+    memcpy(p_client->rsp, p_rsp->wire + p_rsp->wire_len - p_client->rsp_len, p_client->rsp_len);
+    p_client->rsp_got = 0;
+    p_client->rsp_seq = 0;
+    p_client->payload_bytes += len;
+    st_signal();
+}
+
+/* A NUS packet, reports of REPORT_SIZE that each start with '?', the last one may be cut. */
+static void st_nus_packet(uint8_t const* p_data, uint32_t len)
+{
+    client_t* p_client = &m_client[SERVICE_NUS];
+    uint32_t off, n, take;
+    uint8_t const* p_body;
+
+    for(off = 0; off < len; off += REPORT_SIZE)
+    {
+        n = len - off < REPORT_SIZE ? len - off : REPORT_SIZE;
+        FAULT(p_data[off] == '?');
+        if(!m_st.nus_open)
+        {
+            FAULT(n >= 9 && p_data[off + 1] == '#' && p_data[off + 2] == '#');
+            FAULT(((p_data[off + 3] << 8) | p_data[off + 4]) == p_client->id);
+            m_st.nus_len = ((uint32_t)p_data[off + 5] << 24) | ((uint32_t)p_data[off + 6] << 16) |
+                           ((uint32_t)p_data[off + 7] << 8) | p_data[off + 8];
+            FAULT(m_st.nus_len == p_client->req_len);
+            m_st.nus_got = 0;
+            m_st.nus_open = true;
+            p_body = &p_data[off + 9];
+            n -= 9;
+        }
+        else
+        {
+            p_body = &p_data[off + 1];
+            n -= 1;
+        }
+        take = m_st.nus_len - m_st.nus_got < n ? m_st.nus_len - m_st.nus_got : n;
+        FAULT(m_st.nus_got + take <= sizeof(m_st.nus_msg));
+        if(m_st.nus_got + take > sizeof(m_st.nus_msg))
+        {
+            return;
+        }
+        memcpy(&m_st.nus_msg[m_st.nus_got], p_body, take);
+        m_st.nus_got += take;
+        if(m_st.nus_got == m_st.nus_len)
+        {
+            // Only the padding of the last report may follow.
+            FAULT(off + REPORT_SIZE >= len);
+            FAULT(memcmp(m_st.nus_msg, p_client->req, m_st.nus_len) == 0);
+            m_st.nus_open = false;
+            st_request(p_client);
+            return;
+        }
+    }
+}
+
+/* A write transaction is over, a NUS packet or a whole FIDO frame behind its tag. */
+static void st_transaction(uint8_t const* p_data, uint32_t len)
+{
+    client_t* p_client = &m_client[SERVICE_FIDO];
+
+    if(len >= 3 && memcmp(p_data, "fid", 3) == 0)
+    {
+        FAULT(len == 3 + p_client->req_len && memcmp(p_data + 3, p_client->req, p_client->req_len) == 0);
+        st_request(p_client);
+    }
+    else
+    {
+        st_nus_packet(p_data, len);
+    }
+}
+
+static void st_write(uint8_t const* p_data, uint32_t len, bool stop)
+{
+    FAULT(m_st.rx_len + len <= sizeof(m_st.rx));
+    if(m_st.rx_len + len <= sizeof(m_st.rx))
+    {
+        memcpy(&m_st.rx[m_st.rx_len], p_data, len);
+        m_st.rx_len += len;
+    }
+    m_st.written += len;
+    if(stop)
+    {
+        st_transaction(m_st.rx, m_st.rx_len);
+        m_st.rx_len = 0;
+    }
+}
+
+static void st_read(uint8_t* p_data, uint32_t len)
+{
+    st_rsp_t* p_rsp = &m_st.rsp[m_st.rsp_head];
+
+    FAULT(m_st.signalled && m_st.rsp_count > 0 && m_st.read_pos + len <= p_rsp->wire_len);
+    if(!m_st.signalled || m_st.rsp_count == 0 || m_st.read_pos + len > p_rsp->wire_len)
+    {
+        return;
+    }
+    memcpy(p_data, &p_rsp->wire[m_st.read_pos], len);
+    m_st.read_pos += len;
+    m_st.read += len;
+    if(m_st.read_pos == p_rsp->wire_len)
+    {
+        m_st.read_pos = 0;
+        m_st.rsp_head = (m_st.rsp_head + 1) % ST_QUEUE;
+        m_st.rsp_count--;
+        m_st.signalled = false;
+        st_signal();
+    }
+}
+
+uint32_t nrf_gpio_pin_read(uint32_t pin_number)
+{
+    FAULT(pin_number == TWI_STATUS_GPIO);
+    return m_st.signalled;
+}
+
+/* Model TWIM, one transfer at a time, the bytes move when it completes. */
+static nrf_drv_twi_evt_handler_t m_twi_handler;
+static bool m_twi_busy, m_twi_rx, m_twi_no_stop;
+static uint8_t const* m_twi_p_tx;
+static uint8_t* m_twi_p_rx;
+static uint8_t m_twi_len;
+static uint64_t m_twi_end = NEVER;
+static uint64_t m_twi_busy_ns;
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const* p_instance,
+                            nrf_drv_twi_config_t const* p_config,
+                            nrf_drv_twi_evt_handler_t event_handler,
+                            void* p_context)
+{
+    (void)p_instance;
+    (void)p_context;
+    FAULT(p_config->frequency == NRF_DRV_TWI_FREQ_400K);
+    m_twi_handler = event_handler;
+    return NRF_SUCCESS;
+}
+
+void nrf_drv_twi_enable(nrf_drv_twi_t const* p_instance)
+{
+    (void)p_instance;
+}
+
+static ret_code_t twi_start(uint8_t const* p_tx, uint8_t* p_rx, uint8_t length, bool no_stop)
+{
+    if(m_twi_busy)
+    {
+        return NRF_ERROR_BUSY;
+    }
+    m_twi_busy = true;
+    m_twi_rx = p_rx != NULL;
+    m_twi_p_tx = p_tx;
+    m_twi_p_rx = p_rx;
+    m_twi_len = length;
+    m_twi_no_stop = no_stop;
+    m_twi_end = m_now + (length + 1) * BYTE_NS;
+    m_twi_busy_ns += (length + 1) * BYTE_NS;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_twi_tx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t const* p_data,
+                          uint8_t length,
+                          bool no_stop)
+{
+    (void)p_instance;
+    FAULT(address == SLAVE_ADDR);
+    return twi_start(p_data, NULL, length, no_stop);
+}
+
+ret_code_t nrf_drv_twi_rx(nrf_drv_twi_t const* p_instance,
+                          uint8_t address,
+                          uint8_t* p_data,
+                          uint8_t length)
+{
+    (void)p_instance;
+    FAULT(address == SLAVE_ADDR);
+    return twi_start(NULL, p_data, length, false);
+}
+
+bool nrf_drv_twi_is_busy(nrf_drv_twi_t const* p_instance)
+{
+    (void)p_instance;
+    return m_twi_busy;
+}
+
+/* NFC, the reader stays away while BLE is in use. */
+ret_code_t nfc_t4t_setup(nfc_t4t_callback_t callback, void* p_context)
+{
+    (void)callback;
+    (void)p_context;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nfc_t4t_emulation_start(void)
+{
+    return NRF_SUCCESS;
+}
+
+ret_code_t nfc_t4t_response_pdu_send(const uint8_t* p_pdu, size_t pdu_length)
+{
+    (void)p_pdu;
+    (void)pdu_length;
+    m_faults++;
+    return NRF_SUCCESS;
+}
+
+/* The central writes a request, framed as its service wants it. */
+static void central_write(uint8_t service, uint8_t const* p_data, uint32_t len)
+{
+    packet_t* p_packet;
+
+    FAULT(m_central_count < CENTRAL_QUEUE && len <= BLE_FIDO_MAX_DATA_LEN);
+    if(m_central_count == CENTRAL_QUEUE)
+    {
+        return;
+    }
+    p_packet = &m_central_q[(m_central_head + m_central_count++) % CENTRAL_QUEUE];
+    p_packet->service = service;
+    p_packet->len = (uint16_t)len;
+    memcpy(p_packet->data, p_data, len);
+    m_central_peak = m_central_count > m_central_peak ? m_central_count : m_central_peak;
+}
+
+static void central_issue(client_t* p_client)
+{
+    uint8_t buf[BLE_FIDO_MAX_DATA_LEN];
+    uint32_t len, pos, n, i;
+
+    p_client->next_at = NEVER;
+    p_client->t_issue = m_now;
+    p_client->id++;
+    if(p_client->service == SERVICE_NUS)
+    {
+        uint32_t reports_per_write = m_ble_gatt_max_data_len / REPORT_SIZE;
+        uint32_t fill = 0;
+
+        len = size_pick(NUS_MSG_MAX);
+        for(i = 0; i < len; i++)
+        {
+            p_client->req[i] = (uint8_t)rand_next();
+        }
+        p_client->req_len = len;
+        // "?##", id, length and 55 bytes, then '?' and 63 bytes a report, the last zero padded.
+        pos = 0;
+        n = 0;
+        while(pos < len || n == 0)
+        {
+            uint8_t* p_report = &buf[fill * REPORT_SIZE];
+            uint32_t body, head;
+
+            memset(p_report, 0, REPORT_SIZE);
+            p_report[0] = '?';
+            head = 1;
+            if(n == 0)
+            {
+                p_report[1] = '#';
+                p_report[2] = '#';
+                p_report[3] = (uint8_t)(p_client->id >> 8);
+                p_report[4] = (uint8_t)p_client->id;
+                p_report[5] = (uint8_t)(len >> 24);
+                p_report[6] = (uint8_t)(len >> 16);
+                p_report[7] = (uint8_t)(len >> 8);
+                p_report[8] = (uint8_t)len;
+                head = 9;
+            }
+            body = len - pos < REPORT_SIZE - head ? len - pos : REPORT_SIZE - head;
+            memcpy(&p_report[head], &p_client->req[pos], body);
+            pos += body;
+            n++;
+            if(++fill == reports_per_write || pos == len)
+            {
+                central_write(SERVICE_NUS, buf, fill * REPORT_SIZE);
+                fill = 0;
+            }
+        }
+    }
+    else
+    {
+        // CTAPBLE_MSG, length and data, then a sequence number and data a fragment.
+        len = size_pick(FIDO_MSG_MAX);
+        p_client->req[0] = 0x83;
+        p_client->req[1] = (uint8_t)(len >> 8);
+        p_client->req[2] = (uint8_t)len;
+        for(i = 3; i < len + 3; i++)
+        {
+            p_client->req[i] = (uint8_t)rand_next();
+        }
+        p_client->req_len = len + 3;
+        n = p_client->req_len < BLE_FIDO_MAX_DATA_LEN ? p_client->req_len : BLE_FIDO_MAX_DATA_LEN;
+        central_write(SERVICE_FIDO, p_client->req, n);
+        for(pos = n, i = 0; pos < p_client->req_len; pos += n, i++)
+        {
+            n = p_client->req_len - pos < BLE_FIDO_MAX_DATA_LEN - 1 ? p_client->req_len - pos : BLE_FIDO_MAX_DATA_LEN - 1;
+            buf[0] = (uint8_t)i;
+            memcpy(&buf[1], &p_client->req[pos], n);
+            central_write(SERVICE_FIDO, buf, n + 1);
+        }
+        len = p_client->req_len - 3;
+    }
+    p_client->payload_bytes += len;
+    link_wake();
+}
+
+/* A notification reached the central. */
+static void central_receive(packet_t const* p_packet)
+{
+    client_t* p_client = &m_client[p_packet->service];
+    uint8_t const* p_data = p_packet->data;
+    uint32_t len = p_packet->len;
+    uint32_t index;
+
+    if(p_packet->service == SERVICE_FIDO && p_client->rsp_got > 0)
+    {
+        FAULT(len > 1 && p_data[0] == p_client->rsp_seq);
+        p_client->rsp_seq++;
+        p_data++;
+        len--;
+    }
+    FAULT(p_client->rsp_len > 0 && p_client->rsp_got + len <= p_client->rsp_len);
+    if(p_client->rsp_len == 0 || p_client->rsp_got + len > p_client->rsp_len)
+    {
+        return;
+    }
+    FAULT(memcmp(p_data, &p_client->rsp[p_client->rsp_got], len) == 0);
+    p_client->rsp_got += len;
+    if(p_client->rsp_got < p_client->rsp_len)
+    {
+        return;
+    }
+
+    index = p_client->done++;
+    p_client->rtt[index] = m_now - p_client->t_issue;
+    p_client->up[index] = p_client->t_st - p_client->t_issue;
+    p_client->down[index] = m_now - p_client->t_gpio;
+    p_client->rsp_len = 0;
+    if(p_client->done < p_client->messages)
+    {
+        p_client->next_at = m_now + rand_next() % 1000000;
+    }
+}
+
+static void sd_evt_deliver(void)
+{
+    sd_evt_t evt = m_sd_evt[m_sd_evt_head];
+
+    m_sd_evt_head = (m_sd_evt_head + 1) % SD_EVT_QUEUE;
+    m_sd_evt_count--;
+    if(evt.type == SD_EVT_RX && evt.packet.service == SERVICE_NUS)
+    {
+        ble_nus_evt_t nus_evt = {.type = BLE_NUS_EVT_RX_DATA};
+
+        nus_evt.params.rx_data.p_data = evt.packet.data;
+        nus_evt.params.rx_data.length = evt.packet.len;
+        nus_data_handler(&nus_evt);
+    }
+    else if(evt.type == SD_EVT_RX)
+    {
+        ble_fido_evt_t fido_evt = {.type = BLE_FIDO_EVT_RX_DATA};
+
+        fido_evt.params.rx_data.p_data = evt.packet.data;
+        fido_evt.params.rx_data.length = evt.packet.len;
+        fido_data_handler(&fido_evt);
+    }
+    else if(evt.type == SD_EVT_TX_COMPLETE)
+    {
+        // BLE_GATTS_EVT_HVN_TX_COMPLETE, both services pass it on as TX_RDY.
+        ble_nus_evt_t nus_evt = {.type = BLE_NUS_EVT_TX_RDY};
+        ble_fido_evt_t fido_evt = {.type = BLE_FIDO_EVT_TX_RDY};
+
+        nus_data_handler(&nus_evt);
+        fido_data_handler(&fido_evt);
+    }
+    else
+    {
+        ble_conn_params_evt_t params_evt = {.evt_type = BLE_CONN_PARAMS_EVT_SUCCEEDED, .conn_handle = CONN_HANDLE};
+
+        FAULT(conn_policy_on_conn_params_evt(&params_evt));
+    }
+}
+
+/* Runs the next thing due by t_limit that the current level lets in, false when there is none. */
+static bool event_run_next(uint64_t t_limit)
+{
+    nrf_drv_twi_evt_t const done = {.type = NRF_DRV_TWI_EVT_DONE};
+    enum
+    {
+        NEXT_SD_EVT,
+        NEXT_LINK,
+        NEXT_UPDATE,
+        NEXT_TWI,
+        NEXT_GPIO,
+        NEXT_ST,
+        NEXT_NUS,
+        NEXT_FIDO,
+        NEXT_TIMER,
+        NEXT_COUNT
+    };
+    uint64_t at[NEXT_COUNT];
+    uint64_t t = NEVER;
+    uint32_t next = NEXT_COUNT;
+    uint32_t level = m_level;
+
+    at[NEXT_SD_EVT] = (m_sd_evt_count > 0 && level < LEVEL_SD) ? m_now : NEVER;
+    at[NEXT_LINK] = m_link.next;
+    at[NEXT_UPDATE] = m_link.update_at;
+    at[NEXT_TWI] = (m_twi_busy && level < LEVEL_HIGH) ? m_twi_end : NEVER;
+    at[NEXT_GPIO] = level < LEVEL_HIGH ? m_gpio_at : NEVER;
+    at[NEXT_ST] = m_st.done_at;
+    at[NEXT_NUS] = m_client[SERVICE_NUS].next_at;
+    at[NEXT_FIDO] = m_client[SERVICE_FIDO].next_at;
+    at[NEXT_TIMER] = (timer_model_next() != NEVER && level < LEVEL_SD) ? ticks_to_ns(timer_model_next()) : NEVER;
+    for(uint32_t i = 0; i < NEXT_COUNT; i++)
+    {
+        if(at[i] < t)
+        {
+            t = at[i];
+            next = i;
+        }
+    }
+    if(t > t_limit || next == NEXT_COUNT)
+    {
+        return false;
+    }
+    clock_set(t > m_now ? t : m_now);
+
+    switch(next)
+    {
+        case NEXT_SD_EVT:
+            m_level = LEVEL_SD;
+            sd_evt_deliver();
+            break;
+        case NEXT_LINK:
+            link_exchange();
+            break;
+        case NEXT_UPDATE:
+            link_update();
+            break;
+        case NEXT_TWI:
+            m_twi_busy = false;
+            if(m_twi_rx)
+            {
+                st_read(m_twi_p_rx, m_twi_len);
+            }
+            else
+            {
+                st_write(m_twi_p_tx, m_twi_len, !m_twi_no_stop);
+            }
+            m_level = LEVEL_HIGH;
+            m_twi_handler(&done, NULL);
+            break;
+        case NEXT_GPIO:
+            // in_pin_handler of gpio.h
+            m_gpio_at = NEVER;
+            m_st.rsp[m_st.rsp_head].p_client->t_gpio = m_now;
+            m_level = LEVEL_HIGH;
+            twi_read_data();
+            break;
+        case NEXT_ST:
+            st_answer();
+            break;
+        case NEXT_NUS:
+        case NEXT_FIDO:
+            central_issue(&m_client[next == NEXT_NUS ? SERVICE_NUS : SERVICE_FIDO]);
+            break;
+        default:
+            m_level = LEVEL_SD;
+            (void)timer_model_run_next();
+            break;
+    }
+    m_level = level;
+    return true;
+}
+
+static int cmp_u64(void const* p_a, void const* p_b)
+{
+    uint64_t a = *(uint64_t const*)p_a;
+    uint64_t b = *(uint64_t const*)p_b;
+
+    return (a > b) - (a < b);
+}
+
+static void latency_print(char const* p_name, uint64_t* p_ns, uint32_t count)
+{
+    qsort(p_ns, count, sizeof(p_ns[0]), cmp_u64);
+    printf("    %-16s p50 %7.2f ms  p90 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", p_name,
+           p_ns[count / 2] / 1e6, p_ns[count * 90 / 100] / 1e6, p_ns[count * 99 / 100] / 1e6,
+           p_ns[count - 1] / 1e6);
+}
+
+static app_sched_event_handler_t const m_main_evt_handlers[MAIN_EVT_COUNT] =
+    {
+        [MAIN_EVT_NFC] = nfc_poll,
+};
+
+int main(void)
+{
+    conn_policy_stats_t const* p_policy;
+    uint32_t ring_peak = 0;
+    uint64_t profile_ticks = 0;
+    double seconds;
+
+    sched_model_init(16); // SCHED_QUEUE_SIZE of main.c
+    timer_model_init();
+    main_evt_init(m_main_evt_handlers);
+    CHECK(app_timer_create(&m_data_out_timer_id, APP_TIMER_MODE_SINGLE_SHOT, data_timeout_handler) == NRF_SUCCESS);
+    CHECK(twi_master_init() == NRF_SUCCESS);
+    CHECK(nfc_init() == 0);
+    conn_policy_init();
+
+    // BLE_GAP_EVT_CONNECTED with the preferred parameters of main.c, 30 ms.
+    m_link.interval = 30000000;
+    m_link.next = NEVER;
+    m_link.update_at = NEVER;
+    conn_policy_on_connected(CONN_HANDLE);
+    m_st.done_at = NEVER;
+    m_client[SERVICE_NUS].service = SERVICE_NUS;
+    m_client[SERVICE_NUS].messages = NUS_MESSAGES;
+    m_client[SERVICE_FIDO].service = SERVICE_FIDO;
+    m_client[SERVICE_FIDO].messages = FIDO_MESSAGES;
+
+    while(m_client[SERVICE_NUS].done < NUS_MESSAGES || m_client[SERVICE_FIDO].done < FIDO_MESSAGES)
+    {
+        uint32_t ring = 0;
+
+        // idle_state_handle() until the next interrupt, then the main loop of main.c.
+        CHECK(event_run_next(NEVER));
+        i2c_rx_post_retry();
+        main_evt_retry();
+        app_sched_execute();
+        CHECK(m_faults == 0);
+        CHECK(m_now < RUN_LIMIT_NS);
+        for(uint32_t i = 0; i < NUS_RX_BUF_NUM; i++)
+        {
+            ring += i2c_tx_busy(nus_recv_data_buff[i]);
+        }
+        ring_peak = ring > ring_peak ? ring : ring_peak;
+    }
+
+    CHECK(m_faults == 0);
+    CHECK(m_data_timeouts == 0);
+    CHECK(sched_model_stats.full == 0);
+    CHECK(m_st.job_count == 0 && m_st.rsp_count == 0);
+    seconds = m_now / 1e9;
+    CHECK(m_client[SERVICE_NUS].payload_bytes / seconds > FLOOR_NUS_BPS);
+    CHECK(m_client[SERVICE_FIDO].payload_bytes / seconds > FLOOR_FIDO_BPS);
+
+    conn_policy_on_disconnected();
+    p_policy = conn_policy_stats_get();
+    for(uint32_t i = 0; i < CONN_PROFILE_COUNT; i++)
+    {
+        profile_ticks += p_policy->time_ticks[i];
+    }
+
+    printf("stream: %u NUS and %u FIDO messages in %.1f s of virtual time\n", (unsigned)NUS_MESSAGES,
+           (unsigned)FIDO_MESSAGES, seconds);
+    printf("  payload   NUS %7.0f B/s  FIDO %7.0f B/s, requests and responses\n",
+           m_client[SERVICE_NUS].payload_bytes / seconds, m_client[SERVICE_FIDO].payload_bytes / seconds);
+    printf("  link      up %7.0f B/s  down %7.0f B/s, %u events, %u exchanges, fast profile %.0f%% of the time\n",
+           m_link.air_up / seconds, m_link.air_down / seconds, (unsigned)m_link.events, (unsigned)m_link.exchanges,
+           100.0 * p_policy->time_ticks[CONN_PROFILE_FAST] / profile_ticks);
+    printf("  TWI       write %7.0f B/s  read %7.0f B/s, bus busy %.0f%% of the time\n", m_st.written / seconds,
+           m_st.read / seconds, 100.0 * m_twi_busy_ns / m_now);
+    for(uint32_t s = 0; s < 2; s++)
+    {
+        client_t* p_client = &m_client[s];
+
+        printf("  %s latency\n", s == SERVICE_NUS ? "NUS" : "FIDO");
+        latency_print("round trip", p_client->rtt, p_client->done);
+        latency_print("request to ST", p_client->up, p_client->done);
+        latency_print("GPIO to central", p_client->down, p_client->done);
+    }
+    printf("  peak use  central writes %u, NUS rx ring %u/%u, NUS tx queue %u/%u, SoftDevice events %u, scheduler %u/16\n",
+           (unsigned)m_central_peak, (unsigned)ring_peak, (unsigned)NUS_RX_BUF_NUM, (unsigned)m_hvn_peak,
+           (unsigned)BLE_NUS_TX_QUEUE_SIZE, (unsigned)m_sd_evt_peak, (unsigned)sched_model_stats.high_water);
+    printf("  ble_fido_send() waiting for a notification buffer: main loop %.1f ms, at most %.2f ms at once\n",
+           m_wait_ns[LEVEL_MAIN] / 1e6, m_wait_max_ns[LEVEL_MAIN] / 1e6);
+    printf("stream: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,720 @@
+/* Runs the UART command path of uart.h, decoder, frame queue, dispatch table and the two
+   response queues, against a fake libuarte and an ST that fires bursts of queries back to back.
+   The bursts arrive in RX buffers cut at random points, the TX completions and the main loop
+   passes run in random order in between, and BLE status frames are queued meanwhile. The ST
+   keeps at most UART_FRAME_QUEUE_SIZE commands unanswered. Checks that every command is
+   answered, that the responses arrive in command order with the expected content, signing
+   batches included, and that no frame is dropped. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "ble_gap.h"
+#include "nordic_common.h"
+#include "nrf_log.h"
+#include "sdk_errors.h"
+#include "sched_model.h"
+#include "baud_neg.h"
+#include "fw_hash.h"
+#include "main_evt.h"
+#include "settings.h"
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if(!(cond))                                                  \
+        {                                                            \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                \
+        }                                                            \
+    } while(0)
+
+/* Tallied instead of checked in place, the fakes run in the middle of the code under test. */
+#define FAULT(cond)     \
+    do                  \
+    {                   \
+        if(!(cond))     \
+        {               \
+            m_faults++; \
+        }               \
+    } while(0)
+
+static uint32_t m_faults;
+
+/* What main.c and its headers define before uart.h. */
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define UART_TX_TAG     0x5A // ble_nus.h
+#define UART_TX_TAG2    0xA5
+#define FW_REVISION     "1.5.6"
+#define BUILD_ID        "0123abc"
+#define PASSKEY_LENGTH  6
+
+#define BLE_DEF            0
+#define BLE_ON_ALWAYS      1
+#define BLE_OFF_ALWAYS     2
+#define BLE_DISCON         3
+#define BLE_ON_TEMPO       5
+#define BLE_OFF_TEMPO      6
+#define BLE_STATUS         7
+#define BLE_PASSKEY_ACCEPT 8
+#define BLE_PASSKEY_REJECT 9
+
+#define BLE_GAP_AUTH_KEY_TYPE_NONE                 0
+#define BLE_GAP_AUTH_KEY_TYPE_PASSKEY              1
+#define BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION  0x13
+
+#define UART_PIN_DISCONNECTED 0xFFFFFFFF
+#define RX_PIN_NUMBER         8
+#define TX_PIN_NUMBER         6
+#define CTS_PIN_NUMBER        UART_PIN_DISCONNECTED
+#define RTS_PIN_NUMBER        UART_PIN_DISCONNECTED
+
+typedef enum
+{
+    HW_VER_V_2_0 = 2072,
+} HW_VER_t;
+
+static volatile uint8_t ble_adv_switch_flag;
+static volatile uint8_t ble_conn_flag;
+static char ble_adv_name[20] = "K1234 host";
+static uint8_t pending_passkey[PASSKEY_LENGTH];
+static bool waiting_passkey_response;
+static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;
+static uint16_t m_ble_gatt_max_data_len = 244;
+static uint8_t m_link_data_length = 251;
+static uint8_t m_link_tx_phy = 2;
+static uint8_t m_link_rx_phy = 2;
+static uint8_t ble_status_flag = BLE_ON_ALWAYS;
+
+static uint32_t sd_ble_gap_auth_key_reply(uint16_t conn_handle, uint8_t key_type, uint8_t const* p_key)
+{
+    (void)conn_handle;
+    (void)key_type;
+    (void)p_key;
+    return NRF_SUCCESS;
+}
+
+static uint32_t sd_ble_gap_disconnect(uint16_t conn_handle, uint8_t hci_status_code)
+{
+    (void)conn_handle;
+    (void)hci_status_code;
+    return NRF_SUCCESS;
+}
+
+static void NVIC_SystemReset(void)
+{
+    FAULT(false);
+}
+
+static void nrf_delay_us(uint32_t us)
+{
+    (void)us;
+}
+
+void settings_flush(void)
+{
+}
+
+static uint8_t get_battery_level(void)
+{
+    return 77;
+}
+
+static HW_VER_t get_hw_ver(void)
+{
+    return HW_VER_V_2_0;
+}
+
+void fw_hash_get(uint8_t* hash)
+{
+    for(uint8_t i = 0; i < 32; i++)
+    {
+        hash[i] = 0xC0 + i;
+    }
+}
+
+static bool device_key_lock_busy(void)
+{
+    return false;
+}
+
+static void device_key_lock(app_sched_event_handler_t done)
+{
+    (void)done;
+    FAULT(false);
+}
+
+/* Signatures of the fake device key: FNV-1a of what is signed, spread over 64 bytes. */
+#define FNV_INIT 2166136261u
+
+static uint32_t fnv(uint32_t h, uint8_t const* p_data, uint32_t len)
+{
+    while(len--)
+    {
+        h = (h ^ *p_data++) * 16777619u;
+    }
+    return h;
+}
+
+static void fake_signature(uint32_t h, uint8_t* signature)
+{
+    for(uint8_t i = 0; i < 64; i++)
+    {
+        signature[i] = (uint8_t)((h >> (8 * (i % 4))) + i);
+    }
+}
+
+static uint8_t m_pubkey[64];
+static bool m_sign_session;
+static uint32_t m_sign_hash;
+
+static bool ecdsa_key_cache_valid(void)
+{
+    return true;
+}
+
+static bool ecdsa_key_cache_locked(void)
+{
+    return false;
+}
+
+static void ecdsa_key_cache_lock(void)
+{
+    FAULT(false);
+}
+
+static uint8_t const* ecdsa_key_cache_pubkey(void)
+{
+    return m_pubkey;
+}
+
+static ret_code_t ecdsa_key_cache_sign_msg(uint8_t const* msg, uint32_t msg_len, uint8_t* signature)
+{
+    fake_signature(fnv(FNV_INIT, msg, msg_len), signature);
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ecdsa_key_cache_sign_hash(uint8_t const* hash, uint8_t* signature)
+{
+    fake_signature(fnv(FNV_INIT, hash, 32), signature);
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ecdsa_key_cache_sign_begin(void)
+{
+    m_sign_session = true;
+    m_sign_hash = FNV_INIT;
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ecdsa_key_cache_sign_update(uint8_t const* msg, uint32_t msg_len)
+{
+    if(!m_sign_session)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    m_sign_hash = fnv(m_sign_hash, msg, msg_len);
+    return NRF_SUCCESS;
+}
+
+static ret_code_t ecdsa_key_cache_sign_finalize(uint8_t* signature)
+{
+    if(!m_sign_session)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    m_sign_session = false;
+    fake_signature(m_sign_hash, signature);
+    return NRF_SUCCESS;
+}
+
+/* nrf_libuarte_async.h and nrf_uarte.h, the port is the fake below. */
+typedef enum
+{
+    NRF_UARTE_BAUDRATE_115200,
+    NRF_UARTE_BAUDRATE_460800,
+    NRF_UARTE_BAUDRATE_921600,
+    NRF_UARTE_BAUDRATE_1000000,
+} nrf_uarte_baudrate_t;
+
+#define NRF_UARTE_HWFC_DISABLED   0
+#define NRF_UARTE_HWFC_ENABLED    1
+#define NRF_UARTE_PARITY_EXCLUDED 0
+#define APP_IRQ_PRIORITY_MID      6
+
+typedef enum
+{
+    NRF_LIBUARTE_ASYNC_EVT_RX_DATA,
+    NRF_LIBUARTE_ASYNC_EVT_TX_DONE,
+    NRF_LIBUARTE_ASYNC_EVT_ERROR,
+    NRF_LIBUARTE_ASYNC_EVT_OVERRUN_ERROR,
+} nrf_libuarte_async_evt_type_t;
+
+typedef struct
+{
+    nrf_libuarte_async_evt_type_t type;
+    union
+    {
+        struct
+        {
+            uint8_t* p_data;
+            size_t length;
+        } rxtx;
+        uint32_t errorsrc;
+        struct
+        {
+            uint32_t overrun_length;
+        } overrun_err;
+    } data;
+} nrf_libuarte_async_evt_t;
+
+typedef void (*nrf_libuarte_async_evt_handler_t)(void* context, nrf_libuarte_async_evt_t* p_evt);
+
+typedef struct
+{
+    uint32_t rx_pin;
+    uint32_t tx_pin;
+    uint32_t cts_pin;
+    uint32_t rts_pin;
+    uint32_t timeout_us;
+    uint32_t hwfc;
+    uint32_t parity;
+    nrf_uarte_baudrate_t baudrate;
+    bool pullup_rx;
+    uint8_t int_prio;
+} nrf_libuarte_async_config_t;
+
+typedef int nrf_libuarte_async_t;
+
+#define NRF_LIBUARTE_PERIPHERAL_NOT_USED 255
+#define NRF_LIBUARTE_ASYNC_DEFINE(_name, ...) static nrf_libuarte_async_t _name
+
+static nrf_libuarte_async_evt_handler_t m_uart_handler;
+static uint8_t const* m_tx_data; // frame in the EasyDMA, read in place until TX_DONE
+static size_t m_tx_len;
+
+static ret_code_t nrf_libuarte_async_init(nrf_libuarte_async_t const* p_libuarte,
+                                          nrf_libuarte_async_config_t const* p_config,
+                                          nrf_libuarte_async_evt_handler_t evt_handler,
+                                          void* context)
+{
+    (void)p_libuarte;
+    (void)context;
+    FAULT(p_config->baudrate == NRF_UARTE_BAUDRATE_115200);
+    m_uart_handler = evt_handler;
+    return NRF_SUCCESS;
+}
+
+static void nrf_libuarte_async_uninit(nrf_libuarte_async_t const* p_libuarte)
+{
+    (void)p_libuarte;
+}
+
+static void nrf_libuarte_async_enable(nrf_libuarte_async_t const* p_libuarte)
+{
+    (void)p_libuarte;
+}
+
+static ret_code_t nrf_libuarte_async_tx(nrf_libuarte_async_t const* p_libuarte, uint8_t* p_data, size_t length)
+{
+    (void)p_libuarte;
+    if(m_tx_data != NULL)
+    {
+        return NRF_ERROR_BUSY;
+    }
+    m_tx_data = p_data;
+    m_tx_len = length;
+    return NRF_SUCCESS;
+}
+
+static void nrf_libuarte_async_rx_free(nrf_libuarte_async_t const* p_libuarte, uint8_t* p_data, size_t length)
+{
+    (void)p_libuarte;
+    (void)p_data;
+    (void)length;
+}
+
+#include "uart.h"
+
+#define BURSTS       3000
+#define FRAMES_MAX   (BURSTS * UART_FRAME_QUEUE_SIZE * SIGN_BATCH_MAX)
+#define ST_BUF_SIZE  (1 << 20)
+
+static uint32_t m_rand = 0x2545F491;
+
+static uint32_t rand_next(void)
+{
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+/* The ST. Commands go out back to back from m_st_out, responses are parsed from m_st_in. */
+typedef struct
+{
+    uint8_t data[UART_TX_FRAME_MAX];
+    uint8_t len;
+    bool last; // last response of its command
+} expected_t;
+
+static uint8_t m_st_out[ST_BUF_SIZE];
+static uint32_t m_st_out_len, m_st_out_sent;
+static uint8_t m_st_in[UART_TX_FRAME_MAX];
+static uint32_t m_st_in_len;
+static expected_t m_expected[FRAMES_MAX];
+static uint32_t m_expected_head, m_expected_count;
+static uint32_t m_outstanding, m_outstanding_peak;
+static uint32_t m_answered, m_status_sent, m_status_got;
+static bool m_st_session;
+static uint32_t m_st_sign_hash;
+
+static uint8_t st_xor(uint8_t const* p_buf, uint32_t len)
+{
+    uint8_t x = 0;
+
+    while(len--)
+    {
+        x ^= *p_buf++;
+    }
+    return x;
+}
+
+/* A response as the ST expects it: 5A A5 | 00 | len + 3 | cmd | len | data | xor. */
+static void expect(uint8_t cmd, uint8_t const* p_data, uint8_t len, bool last)
+{
+    expected_t* p_exp = &m_expected[(m_expected_head + m_expected_count++) % FRAMES_MAX];
+
+    p_exp->data[0] = 0x5A;
+    p_exp->data[1] = 0xA5;
+    p_exp->data[2] = 0x00;
+    p_exp->data[3] = len + 3;
+    p_exp->data[4] = cmd;
+    p_exp->data[5] = len;
+    memcpy(&p_exp->data[6], p_data, len);
+    p_exp->data[6 + len] = st_xor(p_exp->data, 6 + len);
+    p_exp->len = 7 + len;
+    p_exp->last = last;
+}
+
+static void expect_byte(uint8_t cmd, uint8_t value)
+{
+    expect(cmd, &value, 1, true);
+}
+
+/* A command: 5A A5 | len(2) | cmd | payload | xor, len counting cmd to xor. */
+static void st_send(uint8_t cmd, uint8_t const* p_payload, uint32_t len)
+{
+    uint8_t* p_frame = &m_st_out[m_st_out_len];
+
+    p_frame[0] = 0x5A;
+    p_frame[1] = 0xA5;
+    p_frame[2] = (uint8_t)((len + 2) >> 8);
+    p_frame[3] = (uint8_t)(len + 2);
+    p_frame[4] = cmd;
+    memcpy(&p_frame[5], p_payload, len);
+    p_frame[5 + len] = st_xor(p_frame, 5 + len);
+    m_st_out_len += 6 + len;
+    m_outstanding++;
+    m_outstanding_peak = m_outstanding > m_outstanding_peak ? m_outstanding : m_outstanding_peak;
+}
+
+/* One random query and the responses it has to get. */
+static void st_command(void)
+{
+    uint8_t payload[UART_FRAME_MAX] = {0};
+    uint8_t rsp[65];
+    uint32_t len;
+    uint8_t count;
+
+    switch(rand_next() % 12)
+    {
+        case 0:
+            st_send(UART_CMD_ADV_NAME, NULL, 0);
+            expect(UART_CMD_ADV_NAME, (uint8_t const*)ble_adv_name, 0x12, true);
+            break;
+        case 1:
+            st_send(UART_CMD_BAT_PERCENT, NULL, 0);
+            expect_byte(UART_CMD_BAT_PERCENT, 77);
+            break;
+        case 2:
+            st_send(UART_CMD_BLE_VERSION, NULL, 0);
+            expect(UART_CMD_BLE_VERSION, (uint8_t const*)FW_REVISION, strlen(FW_REVISION), true);
+            break;
+        case 3:
+            st_send(UART_CMD_BLE_BUILD_ID, NULL, 0);
+            expect(UART_CMD_BLE_BUILD_ID, (uint8_t const*)BUILD_ID, 7, true);
+            break;
+        case 4:
+            st_send(UART_CMD_BLE_HASH, NULL, 0);
+            fw_hash_get(rsp);
+            expect(UART_CMD_BLE_HASH, rsp, 32, true);
+            break;
+        case 5:
+            st_send(UART_CMD_BLE_HW_VER, NULL, 0);
+            rsp[0] = HW_VER_V_2_0 & 0xFF;
+            rsp[1] = HW_VER_V_2_0 >> 8;
+            expect(UART_CMD_BLE_HW_VER, rsp, 2, true);
+            break;
+        case 6:
+            st_send(UART_CMD_BLE_LINK, NULL, 0);
+            rsp[0] = m_link_tx_phy;
+            rsp[1] = m_link_rx_phy;
+            rsp[2] = m_link_data_length;
+            rsp[3] = m_ble_gatt_max_data_len >> 8;
+            rsp[4] = m_ble_gatt_max_data_len & 0xFF;
+            expect(UART_CMD_BLE_LINK, rsp, 5, true);
+            break;
+        case 7:
+            st_send(UART_CMD_BLE_PUBKEY, NULL, 0);
+            expect(UART_CMD_BLE_PUBKEY, m_pubkey, 64, true);
+            break;
+        case 8:
+            payload[0] = 1; // cmd | len | flag
+            payload[1] = BLE_STATUS;
+            st_send(UART_CMD_CTL_BLE, payload, 2);
+            expect_byte(UART_CMD_CTL_BLE, (ble_status_flag - 1) ^ 1);
+            break;
+        case 9:
+            len = rand_next() % 120;
+            for(uint32_t i = 0; i < len; i++)
+            {
+                payload[i] = (uint8_t)rand_next();
+            }
+            st_send(UART_CMD_BLE_SIGN, payload, len);
+            fake_signature(fnv(FNV_INIT, payload, len), rsp);
+            expect(UART_CMD_BLE_SIGN, rsp, 64, true);
+            break;
+        case 10:
+            // A stage of a streamed signature, in whatever order the bursts bring them.
+            payload[0] = rand_next() % 3;
+            len = payload[0] == SIGN_STREAM_UPDATE ? rand_next() % 100 : 0;
+            for(uint32_t i = 1; i <= len; i++)
+            {
+                payload[i] = (uint8_t)rand_next();
+            }
+            st_send(UART_CMD_BLE_SIGN_STREAM, payload, 1 + len);
+            if(payload[0] == SIGN_STREAM_BEGIN)
+            {
+                m_st_session = true;
+                m_st_sign_hash = FNV_INIT;
+                expect_byte(UART_CMD_BLE_SIGN_STREAM, 0x00);
+            }
+            else if(!m_st_session)
+            {
+                expect_byte(UART_CMD_BLE_SIGN_STREAM, 0x02);
+            }
+            else if(payload[0] == SIGN_STREAM_UPDATE)
+            {
+                m_st_sign_hash = fnv(m_st_sign_hash, &payload[1], len);
+                expect_byte(UART_CMD_BLE_SIGN_STREAM, 0x00);
+            }
+            else
+            {
+                m_st_session = false;
+                fake_signature(m_st_sign_hash, rsp);
+                expect(UART_CMD_BLE_SIGN_STREAM, rsp, 64, true);
+            }
+            break;
+        default:
+            count = 1 + rand_next() % SIGN_BATCH_MAX;
+            payload[0] = count;
+            for(uint32_t i = 1; i <= 32u * count; i++)
+            {
+                payload[i] = (uint8_t)rand_next();
+            }
+            st_send(UART_CMD_BLE_SIGN_BATCH, payload, 1 + 32 * count);
+            for(uint8_t i = 0; i < count; i++)
+            {
+                rsp[0] = i;
+                fake_signature(fnv(FNV_INIT, &payload[1 + 32 * i], 32), rsp + 1);
+                expect(UART_CMD_BLE_SIGN_BATCH, rsp, 65, i + 1 == count);
+            }
+            break;
+    }
+}
+
+/* A frame the ST received. Status frames have their own order, responses go by m_expected. */
+static void st_frame(uint8_t const* p_frame, uint32_t len)
+{
+    expected_t const* p_exp = &m_expected[m_expected_head];
+
+    if(uart_cmd_prio(p_frame[4]) == UART_TX_PRIO_STATUS)
+    {
+        FAULT(p_frame[4] == UART_CMD_BLE_CON_STA && p_frame[6] == (uint8_t)m_status_got);
+        m_status_got++;
+        return;
+    }
+    FAULT(m_expected_count > 0);
+    FAULT(len == p_exp->len && memcmp(p_frame, p_exp->data, len) == 0);
+    if(p_exp->last)
+    {
+        m_outstanding--;
+        m_answered++;
+    }
+    m_expected_head = (m_expected_head + 1) % FRAMES_MAX;
+    m_expected_count--;
+}
+
+static void st_receive(uint8_t const* p_data, uint32_t len)
+{
+    while(len--)
+    {
+        m_st_in[m_st_in_len++] = *p_data++;
+        if(m_st_in_len >= 4 && m_st_in_len == m_st_in[3] + 4u)
+        {
+            FAULT(m_st_in[0] == 0x5A && m_st_in[1] == 0xA5);
+            FAULT(st_xor(m_st_in, m_st_in_len - 1) == m_st_in[m_st_in_len - 1]);
+            st_frame(m_st_in, m_st_in_len);
+            m_st_in_len = 0;
+        }
+    }
+}
+
+/* The UARTE interrupt: the frame in the EasyDMA left. */
+static void uart_tx_complete(void)
+{
+    nrf_libuarte_async_evt_t evt = {.type = NRF_LIBUARTE_ASYNC_EVT_TX_DONE};
+
+    st_receive(m_tx_data, m_tx_len);
+    m_tx_data = NULL;
+    m_uart_handler(NULL, &evt);
+}
+
+/* The UARTE interrupt: an RX buffer filled up or the line went idle. */
+static void uart_rx(void)
+{
+    static uint8_t dma[UART_RX_BUF_SIZE];
+    nrf_libuarte_async_evt_t evt = {.type = NRF_LIBUARTE_ASYNC_EVT_RX_DATA};
+    uint32_t len = 1 + rand_next() % UART_RX_BUF_SIZE;
+
+    if(len > m_st_out_len - m_st_out_sent)
+    {
+        len = m_st_out_len - m_st_out_sent;
+    }
+    memcpy(dma, &m_st_out[m_st_out_sent], len);
+    m_st_out_sent += len;
+    evt.data.rxtx.p_data = dma;
+    evt.data.rxtx.length = len;
+    m_uart_handler(NULL, &evt);
+}
+
+static void main_loop_pass(void)
+{
+    main_evt_retry();
+    app_sched_execute();
+}
+
+int main(void)
+{
+    static app_sched_event_handler_t const handlers[MAIN_EVT_COUNT] = {
+        [MAIN_EVT_UART_RX] = uart_frame_poll,
+    };
+    uint32_t commands = 0;
+    uint32_t burst_max = 0;
+
+    for(uint8_t i = 0; i < sizeof(m_pubkey); i++)
+    {
+        m_pubkey[i] = 0x40 + i;
+    }
+    sched_model_init(16); // SCHED_QUEUE_SIZE of main.c
+    main_evt_init(handlers);
+    usr_uart_init();
+    CHECK(m_uart_handler != NULL);
+
+    for(uint32_t burst = 0; burst < BURSTS; burst++)
+    {
+        // A burst goes out back to back, as many queries as the ST may leave unanswered. Every
+        // other one comes after the ST heard back on everything, as at boot, and fills the queue.
+        uint32_t n = 1 + rand_next() % (UART_FRAME_QUEUE_SIZE - m_outstanding);
+
+        if((burst % 2) == 0)
+        {
+            while(m_outstanding > 0)
+            {
+                if(m_tx_data != NULL)
+                {
+                    uart_tx_complete();
+                }
+                main_loop_pass();
+                CHECK(m_faults == 0);
+            }
+            n = UART_FRAME_QUEUE_SIZE;
+        }
+
+        for(uint32_t i = 0; i < n; i++)
+        {
+            st_command();
+        }
+        commands += n;
+        burst_max = n > burst_max ? n : burst_max;
+
+        // Until the ST may send again: bytes on the line, TX completions, BLE status changes
+        // and main loop passes, in any order.
+        while(m_outstanding == UART_FRAME_QUEUE_SIZE || m_st_out_sent < m_st_out_len ||
+              (rand_next() % 4) != 0)
+        {
+            switch(rand_next() % 5)
+            {
+                case 0:
+                    if(m_st_out_sent < m_st_out_len)
+                    {
+                        uart_rx();
+                    }
+                    break;
+                case 1:
+                case 2:
+                    if(m_tx_data != NULL)
+                    {
+                        uart_tx_complete();
+                    }
+                    break;
+                case 3:
+                    if((rand_next() % 8) == 0)
+                    {
+                        send_ble_data_to_st_byte(UART_CMD_BLE_CON_STA, (uint8_t)m_status_sent++);
+                    }
+                    break;
+                default:
+                    main_loop_pass();
+                    break;
+            }
+            CHECK(m_faults == 0);
+            CHECK(m_outstanding <= UART_FRAME_QUEUE_SIZE);
+            if(m_st_out_sent == m_st_out_len && m_tx_data == NULL && !main_evt_deferred() &&
+               sched_model_queued() == 0 && m_outstanding > 0)
+            {
+                // Idle with commands unanswered: nothing would ever answer them.
+                CHECK(uart_frame_count == 0 && uart_tx_count[UART_TX_PRIO_BULK] == 0);
+                CHECK(!uart_sign_batch_busy());
+                CHECK(m_outstanding == 0);
+            }
+        }
+    }
+    while(m_outstanding > 0 || m_tx_data != NULL || sched_model_queued() > 0)
+    {
+        if(m_tx_data != NULL)
+        {
+            uart_tx_complete();
+        }
+        main_loop_pass();
+        CHECK(m_faults == 0);
+    }
+
+    CHECK(m_faults == 0);
+    CHECK(m_answered == commands);
+    CHECK(m_expected_count == 0);
+    CHECK(m_status_got == m_status_sent);
+    CHECK(uart_tx_stats.dropped[UART_TX_PRIO_STATUS] == 0 && uart_tx_stats.dropped[UART_TX_PRIO_BULK] == 0);
+    CHECK(burst_max == UART_FRAME_QUEUE_SIZE && m_outstanding_peak == UART_FRAME_QUEUE_SIZE);
+    printf("uart cmd: %u commands in %u bursts, %u status frames, response queue high water %u\n",
+           (unsigned)commands, (unsigned)BURSTS, (unsigned)m_status_sent,
+           (unsigned)uart_tx_stats.high_water[UART_TX_PRIO_BULK]);
+    printf("uart cmd: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "timer_model.h"
+#include "app_timer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define TIMER_MODEL_MAX 16
+
+uint64_t timer_model_now;
+
+static app_timer_t* m_timers[TIMER_MODEL_MAX];
+static uint32_t m_timer_count;
+
+void timer_model_init(void)
+{
+    timer_model_now = 0;
+    m_timer_count = 0;
+}
+
+ret_code_t app_timer_create(app_timer_id_t const* p_timer_id, app_timer_mode_t mode,
+                            app_timer_timeout_handler_t timeout_handler)
+{
+    app_timer_t* p_timer = *p_timer_id;
+
+    if(timeout_handler == NULL)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if(m_timer_count >= TIMER_MODEL_MAX)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+    memset(p_timer, 0, sizeof(*p_timer));
+    p_timer->handler = timeout_handler;
+    p_timer->mode = mode;
+    m_timers[m_timer_count++] = p_timer;
+    return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void* p_context)
+{
+    if(timer_id->handler == NULL || timeout_ticks < 5)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    timer_id->p_context = p_context;
+    timer_id->period = timeout_ticks;
+    timer_id->expires = timer_model_now + timeout_ticks;
+    timer_id->active = true;
+    return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+    timer_id->active = false;
+    return NRF_SUCCESS;
+}
+
+/* The 24 bit RTC1 counter. */
+uint32_t app_timer_cnt_get(void)
+{
+    return (uint32_t)(timer_model_now & 0xFFFFFF);
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+    return (ticks_to - ticks_from) & 0xFFFFFF;
+}
+
+uint32_t timer_model_active(void)
+{
+    uint32_t i, count = 0;
+
+    for(i = 0; i < m_timer_count; i++)
+    {
+        count += m_timers[i]->active;
+    }
+    return count;
+}
+
+static app_timer_t* timer_next(void)
+{
+    app_timer_t* p_next = NULL;
+    uint32_t i;
+
+    for(i = 0; i < m_timer_count; i++)
+    {
+        if(m_timers[i]->active && (p_next == NULL || m_timers[i]->expires < p_next->expires))
+        {
+            p_next = m_timers[i];
+        }
+    }
+    return p_next;
+}
+
+static void timer_run(app_timer_t* p_timer)
+{
+    timer_model_now = p_timer->expires;
+    if(p_timer->mode == APP_TIMER_MODE_REPEATED)
+    {
+        p_timer->expires += p_timer->period;
+    }
+    else
+    {
+        p_timer->active = false;
+    }
+    p_timer->handler(p_timer->p_context);
+}
+
+bool timer_model_run_next(void)
+{
+    app_timer_t* p_next = timer_next();
+
+    if(p_next == NULL)
+    {
+        return false;
+    }
+    timer_run(p_next);
+    return true;
+}
+
+uint64_t timer_model_next(void)
+{
+    app_timer_t* p_next = timer_next();
+
+    return (p_next != NULL) ? p_next->expires : UINT64_MAX;
+}
@@ -0,0 +1,17 @@
+/* app_timer for host tests: timers expire on a virtual RTC1 tick count that only moves when
+   the test runs the next expiry. */
+#ifndef TIMER_MODEL_H__
+#define TIMER_MODEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern uint64_t timer_model_now;
+
+void timer_model_init(void);
+/* Advances to the earliest armed timer and runs its handler, false when none is armed. */
+bool timer_model_run_next(void);
+/* Tick of the earliest armed timer, UINT64_MAX when none is armed. */
+uint64_t timer_model_next(void);
+uint32_t timer_model_active(void);
+#endif
@@ -17,6 +17,10 @@
 #define UART_CMD_BLE_BUILD_ID 0x0d
 #define UART_CMD_BLE_HASH     0x0e
 #define UART_CMD_BLE_HW_VER   0x0f
+#define UART_CMD_BLE_LINK     0x10
+#define UART_CMD_BAUD         0x11
+#define UART_CMD_BLE_SIGN_STREAM 0x12
+#define UART_CMD_BLE_SIGN_BATCH  0x13
 // VALUE
 #define VALUE_CONNECT    0x01
 #define VALUE_DISCONNECT 0x02
@@ -43,23 +47,69 @@
 #define NFC_CHANNEL  0x02
 #define UART_CHANNEL 0x03
 
-#define UART_DEF                  0x00
-#define ACTIVE_SEND_UART          0x01
-#define RESPONESE_NAME_UART       0x02
-#define RESPONESE_BAT_UART        0x03
-#define RESPONESE_VER_UART        0x04
-#define RESPONESE_BLE_PUBKEY      0x05
-#define RESPONESE_BLE_PUBKEY_LOCK 0x06
-#define RESPONESE_BLE_SIGN        0x07
-#define RESPONESE_BLE_STATUS      0x08
-#define RESPONESE_BLE_BUILD_ID    0x09
-#define RESPONESE_BLE_BLE_HASH    0x0a
-#define RESPONESE_BLE_HW_VER      0x0b
-#define DEF_RESP                  0xFF
+#define UART_FRAME_MAX        256 /**< Largest frame accepted from the ST, tag to xor. */
+#define UART_FRAME_LEN_MIN    2   /**< Shortest length field accepted, cmd and xor. */
+#define UART_FRAME_QUEUE_SIZE 4   /**< Received frames waiting for the main loop, the ST leaves at most this many commands unanswered. */
+#define UART_RX_TIMEOUT_US    200 /**< Line idle time after which a partly filled RX buffer is delivered. */
+
+NRF_LIBUARTE_ASYNC_DEFINE(libuarte, 0, 1, NRF_LIBUARTE_PERIPHERAL_NOT_USED, 2, UART_RX_BUF_SIZE, 3);
+
+typedef struct
+{
+    uint16_t len;
+    uint8_t data[UART_FRAME_MAX];
+} uart_frame_t;
+
+static uart_frame_t uart_frame_queue[UART_FRAME_QUEUE_SIZE];
+static volatile uint8_t uart_frame_head, uart_frame_count;
+#define UART_TX_FRAME_MAX  128 /**< Largest frame sent to the ST. */
+#define UART_TX_QUEUE_SIZE 4   /**< Frames queued per priority. */
+
+typedef enum
+{
+    UART_TX_PRIO_STATUS, // link, pairing and DFU state changes, sent ahead of responses
+    UART_TX_PRIO_BULK,   // command responses and periodic reports
+    UART_TX_PRIO_COUNT
+} uart_tx_prio_t;
+
+typedef struct
+{
+    uint8_t len;
+    uint8_t data[UART_TX_FRAME_MAX];
+} uart_tx_frame_t;
+
+typedef struct
+{
+    uint32_t sent;                        // frames that completed
+    uint32_t dropped[UART_TX_PRIO_COUNT]; // frames lost to a full queue
+    uint8_t high_water[UART_TX_PRIO_COUNT];
+} uart_tx_stats_t;
+
+static uart_tx_frame_t uart_tx_queue[UART_TX_PRIO_COUNT][UART_TX_QUEUE_SIZE];
+static uint8_t uart_tx_head[UART_TX_PRIO_COUNT];
+static volatile uint8_t uart_tx_count[UART_TX_PRIO_COUNT];
+static volatile int8_t uart_tx_active = -1; // priority of the frame in the EasyDMA, -1 when idle
+static uart_tx_stats_t uart_tx_stats;
 
 static volatile uint8_t flag_uart_trans = 1;
-static uint8_t uart_data_array[64];
-static volatile uint8_t trans_info_flag = 0;
+
+#define UART_BAUD_CONFIRM_MS     500 /**< Time the ST has to confirm a new rate before falling back. */
+#define UART_BAUD_SWITCH_GUARD_US 200 /**< Lets the last byte of the reply leave the shift register. */
+#define UART_BAUD_HWFC ((RTS_PIN_NUMBER != UART_PIN_DISCONNECTED) && (CTS_PIN_NUMBER != UART_PIN_DISCONNECTED))
+
+static const nrf_uarte_baudrate_t uart_baud_table[UART_BAUD_COUNT] = {
+    NRF_UARTE_BAUDRATE_115200,
+    NRF_UARTE_BAUDRATE_460800,
+    NRF_UARTE_BAUDRATE_921600,
+    NRF_UARTE_BAUDRATE_1000000,
+};
+
+APP_TIMER_DEF(uart_baud_timer_id);
+static baud_neg_t uart_baud_neg;
+static uint16_t uart_decode_index = 0;
+
+static void uart_baud_request(uint8_t const* p_frame, uint32_t lenth);
+static void uart_baud_fallback_schedule(void);
 
 static uint8_t calcXor(uint8_t* buf, uint8_t len)
 {
@@ -72,20 +122,91 @@ static uint8_t calcXor(uint8_t* buf, uint8_t len)
     }
     return tmp;
 }
-static void uart_put_data(uint8_t* pdata, uint8_t lenth)
+/**@brief Function for starting the next queued frame, status frames first.
+ *
+ * @details Called with the queue protected, from a critical region or from the UARTE
+ *          interrupt. The EasyDMA reads the frame in place from its queue slot.
+ */
+static void uart_tx_kick(void)
 {
-    uint32_t err_code;
+    ret_code_t err_code;
+    uart_tx_frame_t* p_frame;
 
-    while(lenth--)
+    if(uart_tx_active >= 0)
     {
-        do
+        return;
+    }
+    for(uint8_t prio = 0; prio < UART_TX_PRIO_COUNT; prio++)
+    {
+        while(uart_tx_count[prio] > 0)
         {
-            err_code = app_uart_put(*pdata++);
-            if((err_code != NRF_SUCCESS) && (err_code != NRF_ERROR_BUSY))
+            p_frame = &uart_tx_queue[prio][uart_tx_head[prio]];
+            err_code = nrf_libuarte_async_tx(&libuarte, p_frame->data, p_frame->len);
+            if(err_code == NRF_SUCCESS)
             {
-                APP_ERROR_CHECK(err_code);
+                uart_tx_active = prio;
+                return;
             }
-        } while(err_code == NRF_ERROR_BUSY);
+            NRF_LOG_INFO("uart tx error %d", err_code);
+            uart_tx_head[prio] = (uart_tx_head[prio] + 1) % UART_TX_QUEUE_SIZE;
+            uart_tx_count[prio]--;
+        }
+    }
+}
+
+/**@brief Function for retiring the frame that just left, from the TX_DONE event. */
+static void uart_tx_done(void)
+{
+    uint8_t prio = uart_tx_active;
+
+    uart_tx_head[prio] = (uart_tx_head[prio] + 1) % UART_TX_QUEUE_SIZE;
+    uart_tx_count[prio]--;
+    uart_tx_stats.sent++;
+    uart_tx_active = -1;
+    uart_tx_kick();
+}
+
+/**@brief Function for queueing one frame for the ST.
+ *
+ * @details Returns at once, the frame is copied and sent from the UARTE interrupt. A frame that
+ *          finds its queue full is dropped and counted in uart_tx_stats.
+ */
+static void uart_put_data(uint8_t* pdata, uint8_t lenth, uart_tx_prio_t prio)
+{
+    uart_tx_frame_t* p_frame;
+
+    if(lenth > UART_TX_FRAME_MAX)
+    {
+        uart_tx_stats.dropped[prio]++;
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    if(uart_tx_count[prio] < UART_TX_QUEUE_SIZE)
+    {
+        p_frame = &uart_tx_queue[prio][(uart_tx_head[prio] + uart_tx_count[prio]) % UART_TX_QUEUE_SIZE];
+        memcpy(p_frame->data, pdata, lenth);
+        p_frame->len = lenth;
+        uart_tx_count[prio]++;
+        if(uart_tx_count[prio] > uart_tx_stats.high_water[prio])
+        {
+            uart_tx_stats.high_water[prio] = uart_tx_count[prio];
+        }
+        uart_tx_kick();
+    }
+    else
+    {
+        uart_tx_stats.dropped[prio]++;
+        NRF_LOG_WARNING("uart tx queue %d full, %d dropped", prio, uart_tx_stats.dropped[prio]);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for waiting until every queued frame has left, e.g. before a reset. */
+static void uart_tx_flush(void)
+{
+    while(uart_tx_active >= 0)
+    {
     }
 }
 
@@ -95,23 +216,45 @@ static void uart_rsp_status(uint8_t rsp)
     data[0] = 0xA5;
     data[1] = 0x5A;
     data[2] = rsp;
-    uart_put_data(data, 3);
+    uart_put_data(data, 3, UART_TX_PRIO_STATUS);
+}
+
+static uart_tx_prio_t uart_cmd_prio(uint8_t cmd)
+{
+    switch(cmd)
+    {
+        case UART_CMD_BLE_CON_STA:
+        case UART_CMD_BLE_PAIR_STA:
+        case UART_CMD_PAIR_CODE:
+        case UART_CMD_DFU_STA:
+            return UART_TX_PRIO_STATUS;
+        default:
+            return UART_TX_PRIO_BULK;
+    }
+}
+
+/**@brief Function for framing a response, returns the frame length. */
+static uint8_t uart_frame_build(uint8_t* p_buf, uint8_t cmd, uint8_t const* data, uint8_t len)
+{
+    p_buf[0] = UART_TX_TAG;
+    p_buf[1] = UART_TX_TAG2;
+    p_buf[2] = 0x00;
+    p_buf[3] = len + 3;
+    p_buf[4] = cmd;
+    p_buf[5] = len;
+    memcpy(&p_buf[6], data, len);
+    p_buf[p_buf[3] + 3] = calcXor(p_buf, (p_buf[3] + 3));
+
+    return p_buf[3] + 4;
 }
 
 void send_ble_data_to_st(uint8_t cmd, uint8_t* data, uint8_t len)
 {
     uint8_t uart_trans_buff[128];
+    uint8_t frame_len;
 
-    uart_trans_buff[0] = UART_TX_TAG;
-    uart_trans_buff[1] = UART_TX_TAG2;
-    uart_trans_buff[2] = 0x00;
-    uart_trans_buff[3] = len + 3;
-    uart_trans_buff[4] = cmd;
-    uart_trans_buff[5] = len;
-    memcpy(&uart_trans_buff[6], data, len);
-    uart_trans_buff[uart_trans_buff[3] + 3] = calcXor(uart_trans_buff, (uart_trans_buff[3] + 3));
-
-    uart_put_data(uart_trans_buff, uart_trans_buff[3] + 4);
+    frame_len = uart_frame_build(uart_trans_buff, cmd, data, len);
+    uart_put_data(uart_trans_buff, frame_len, uart_cmd_prio(cmd));
 }
 
 void send_ble_data_to_st_byte(uint8_t cmd, uint8_t data)
@@ -121,350 +264,677 @@ void send_ble_data_to_st_byte(uint8_t cmd, uint8_t data)
     send_ble_data_to_st(cmd, data_buff, 1);
 }
 
-static void rsp_st_uart_cmd(void* p_event_data, uint16_t event_size)
+typedef void (*uart_cmd_handler_t)(uint8_t const* p_frame, uint32_t lenth);
+
+typedef struct
 {
-    if(trans_info_flag == DEF_RESP)
-    {
-        return;
-    }
-    switch(trans_info_flag)
+    uint8_t cmd;
+    uint8_t min_len; // shortest lenth the handler reads, the cmd byte included
+    uart_cmd_handler_t handler;
+} uart_cmd_entry_t;
+
+static void uart_cmd_ctl_ble(uint8_t const* p_frame, uint32_t lenth)
+{
+    switch(p_frame[6])
     {
-        case RESPONESE_NAME_UART:
-            send_ble_data_to_st(UART_CMD_ADV_NAME, (uint8_t*)ble_adv_name, 0x12);
+        case BLE_ON_ALWAYS:
+            ble_adv_switch_flag = BLE_ON_ALWAYS;
+            main_evt_post(MAIN_EVT_BLE_CTL);
+            NRF_LOG_INFO("RCV ble always ON.");
             break;
-        case RESPONESE_VER_UART:
-            send_ble_data_to_st(UART_CMD_BLE_VERSION, (uint8_t*)FW_REVISION, strlen(FW_REVISION));
+        case BLE_OFF_ALWAYS:
+        case BLE_DEF:
+            ble_adv_switch_flag = BLE_OFF_ALWAYS;
+            main_evt_post(MAIN_EVT_BLE_CTL);
+            NRF_LOG_INFO("RCV ble always OFF.");
             break;
-        case RESPONESE_BAT_UART:
-            {
-                uint8_t bat_level = get_battery_level();
-                send_ble_data_to_st(UART_CMD_BAT_PERCENT, &bat_level, 1);
-            }
+        case BLE_DISCON:
+            ble_conn_flag = BLE_DISCON;
+            main_evt_post(MAIN_EVT_BLE_CTL);
+            NRF_LOG_INFO("RCV ble flag disconnect.");
             break;
-        case RESPONESE_BLE_PUBKEY:
-            {
-                ecdsa_key_info_t key_info = {0};
-                nrf_fstorage_read(&fstorage, DEVICE_KEY_INFO_ADDR, &key_info, sizeof(ecdsa_key_info_t));
-                if(key_info.key_lock_flag == STORAGE_TRUE_FLAG)
-                {
-                    send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x01);
-                }
-                else if(key_info.key_flag != STORAGE_TRUE_FLAG)
-                {
-                    send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x02);
-                }
-                else
-                {
-                    send_ble_data_to_st(UART_CMD_BLE_PUBKEY, key_info.public_key, sizeof(key_info.public_key));
-                }
-            }
+        case BLE_ON_TEMPO:
+            ble_conn_flag = BLE_ON_TEMPO;
+            main_evt_post(MAIN_EVT_BLE_CTL);
+            NRF_LOG_INFO("RCV ble flag start adv flag.");
             break;
-        case RESPONESE_BLE_PUBKEY_LOCK:
-            {
-                ecdsa_key_info_t key_info = {0};
-                nrf_fstorage_read(&fstorage, DEVICE_KEY_INFO_ADDR, &key_info, sizeof(ecdsa_key_info_t));
-                if(key_info.key_lock_flag != STORAGE_TRUE_FLAG)
-                {
-                    ret_code_t rc;
-                    key_info.key_lock_flag = STORAGE_TRUE_FLAG;
-                    rc = nrf_fstorage_erase(&fstorage, DEVICE_KEY_INFO_ADDR, FDS_PHY_PAGES_IN_VPAGE, NULL);
-                    APP_ERROR_CHECK(rc);
-
-                    rc = nrf_fstorage_write(&fstorage, DEVICE_KEY_INFO_ADDR, &key_info, sizeof(ecdsa_key_info_t), NULL);
-                    APP_ERROR_CHECK(rc);
-
-                    wait_for_flash_ready(&fstorage);
-                }
-                send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x00);
-            }
+        case BLE_OFF_TEMPO:
+            ble_conn_flag = BLE_OFF_TEMPO;
+            main_evt_post(MAIN_EVT_BLE_CTL);
+            NRF_LOG_INFO("RCV ble flag stop adv flag.");
             break;
-        case RESPONESE_BLE_SIGN:
-            {
-                uint32_t msg_len = uart_data_array[2] << 8 | uart_data_array[3] - 2;
-                ecdsa_key_info_t key_info = {0};
-                nrf_fstorage_read(&fstorage, DEVICE_KEY_INFO_ADDR, &key_info, sizeof(ecdsa_key_info_t));
-                if(key_info.key_flag != STORAGE_TRUE_FLAG)
-                {
-                    send_ble_data_to_st_byte(UART_CMD_BLE_SIGN, 0x01);
-                }
-                else
-                {
-                    uint8_t sign_data[64];
-                    sign_ecdsa_msg(key_info.private_key, uart_data_array + 5, msg_len, sign_data);
-                    send_ble_data_to_st(UART_CMD_BLE_SIGN, sign_data, 64);
-                }
-            }
-            break;
-        case RESPONESE_BLE_STATUS:
+        case BLE_STATUS:
             send_ble_data_to_st_byte(UART_CMD_CTL_BLE, ((ble_status_flag - 1) ^ 1));
             break;
-        case RESPONESE_BLE_BUILD_ID:
-            send_ble_data_to_st(UART_CMD_BLE_BUILD_ID, (uint8_t*)BUILD_ID, 7);
-            break;
-        case RESPONESE_BLE_BLE_HASH:
+        case BLE_PASSKEY_ACCEPT:
+            if(waiting_passkey_response && m_conn_handle != BLE_CONN_HANDLE_INVALID)
             {
                 ret_code_t err_code = NRF_SUCCESS;
-                nrf_crypto_backend_hash_context_t hash_context = {0};
-                uint8_t hash[32] = {0};
-                size_t hash_len = 32;
-                int chunks = 0;
-                int app_size = 0;
-                uint8_t* code_addr = (uint8_t*)0x26000;
-                uint8_t* code_len = (uint8_t*)0x7F018;
-                app_size = code_len[0] + code_len[1] * 256 + code_len[2] * 256 * 256;
-                chunks = app_size / 512;
-
-                err_code = nrf_crypto_hash_init(&hash_context, &g_nrf_crypto_hash_sha256_info);
-                APP_ERROR_CHECK(err_code);
-                for(int i = 0; i < chunks; i++)
+                bool passkey_provided = (lenth == PASSKEY_LENGTH + 3); // 1(cmd)+1(subcmd)+passkey+1(xor)
+
+                if(passkey_provided)
                 {
-                    err_code = nrf_crypto_hash_update(&hash_context, code_addr + i * 512, 512);
-                    APP_ERROR_CHECK(err_code);
+                    if(memcmp(pending_passkey, p_frame + 7, PASSKEY_LENGTH) == 0)
+                    {
+                        // Passkey matches, accept pairing with actual passkey data
+                        err_code =
+                            sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_PASSKEY, NULL);
+                    }
+                    else
+                    {
+                        // Passkey mismatch, reject pairing
+                        err_code = sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
+                        APP_ERROR_CHECK(err_code);
+                        // Disconnect to ensure phone exits pairing screen
+                        err_code =
+                            sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+                        APP_ERROR_CHECK(err_code);
+                    }
                 }
-                if(app_size % 512)
+                else
                 {
-                    err_code = nrf_crypto_hash_update(&hash_context, code_addr + chunks * 512, app_size % 512);
+                    err_code = sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
+                    APP_ERROR_CHECK(err_code);
+                    err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
                     APP_ERROR_CHECK(err_code);
                 }
-                err_code = nrf_crypto_hash_finalize(&hash_context, hash, &hash_len);
                 APP_ERROR_CHECK(err_code);
-
-                send_ble_data_to_st(UART_CMD_BLE_HASH, hash, 32);
+                waiting_passkey_response = false;
             }
             break;
-        case RESPONESE_BLE_HW_VER:
+        case BLE_PASSKEY_REJECT:
+            if(waiting_passkey_response && m_conn_handle != BLE_CONN_HANDLE_INVALID)
             {
-                HW_VER_t hw_ver = get_hw_ver();
-                send_ble_data_to_st(UART_CMD_BLE_HW_VER, &hw_ver, 2);
+                ret_code_t err_code =
+                    sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
+                err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+                APP_ERROR_CHECK(err_code);
+                waiting_passkey_response = false;
             }
             break;
         default:
+            NRF_LOG_INFO("Receive flag is %d \n", p_frame[6]);
+            break;
+    }
+}
+
+static void uart_cmd_reset_ble(uint8_t const* p_frame, uint32_t lenth)
+{
+    // Settings are written behind, do not lose the last ones.
+    settings_flush();
+    NVIC_SystemReset();
+}
+
+static void uart_cmd_adv_name(uint8_t const* p_frame, uint32_t lenth)
+{
+    send_ble_data_to_st(UART_CMD_ADV_NAME, (uint8_t*)ble_adv_name, 0x12);
+}
+
+static void uart_cmd_bat_percent(uint8_t const* p_frame, uint32_t lenth)
+{
+    uint8_t bat_level = get_battery_level();
+    send_ble_data_to_st(UART_CMD_BAT_PERCENT, &bat_level, 1);
+}
+
+static void uart_cmd_ble_version(uint8_t const* p_frame, uint32_t lenth)
+{
+    send_ble_data_to_st(UART_CMD_BLE_VERSION, (uint8_t*)FW_REVISION, strlen(FW_REVISION));
+}
+
+// UART_CMD_BLE_PUBKEY response, built from the key cache on first use and again after a lock.
+static uint8_t uart_pubkey_frame[UART_TX_FRAME_MAX];
+static uint8_t uart_pubkey_frame_len = 0;
+
+static void uart_pubkey_lock_done(void* p_event_data, uint16_t event_size)
+{
+    UNUSED_PARAMETER(event_size);
+
+    if(!*(bool*)p_event_data)
+    {
+        NRF_LOG_ERROR("Device key lock not written");
+        send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x02);
+        return;
+    }
+    ecdsa_key_cache_lock();
+    uart_pubkey_frame_len = 0;
+    send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x00);
+}
+
+static void uart_cmd_pubkey_lock(void)
+{
+    if(ecdsa_key_cache_locked())
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_PUBKEY, 0x00);
+    }
+    else if(!device_key_lock_busy())
+    {
+        // Answered from uart_pubkey_lock_done() once the page is rewritten, a repeated request
+        // meanwhile gets that single answer.
+        device_key_lock(uart_pubkey_lock_done);
+    }
+}
+
+static void uart_cmd_pubkey(uint8_t const* p_frame, uint32_t lenth)
+{
+    uint8_t status;
+
+    if((lenth == 2) && (p_frame[5] == 1))
+    {
+        uart_cmd_pubkey_lock();
+        return;
+    }
+
+    if(uart_pubkey_frame_len == 0)
+    {
+        if(ecdsa_key_cache_locked())
+        {
+            status = 0x01;
+            uart_pubkey_frame_len = uart_frame_build(uart_pubkey_frame, UART_CMD_BLE_PUBKEY, &status, 1);
+        }
+        else if(!ecdsa_key_cache_valid())
+        {
+            status = 0x02;
+            uart_pubkey_frame_len = uart_frame_build(uart_pubkey_frame, UART_CMD_BLE_PUBKEY, &status, 1);
+        }
+        else
+        {
+            uart_pubkey_frame_len = uart_frame_build(uart_pubkey_frame, UART_CMD_BLE_PUBKEY,
+                                                     ecdsa_key_cache_pubkey(), 64);
+        }
+    }
+    uart_put_data(uart_pubkey_frame, uart_pubkey_frame_len, UART_TX_PRIO_BULK);
+}
+
+static void uart_cmd_sign(uint8_t const* p_frame, uint32_t lenth)
+{
+    // The message follows the cmd byte.
+    uint32_t msg_len = lenth - 1;
+
+    if(!ecdsa_key_cache_valid())
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN, 0x01);
+    }
+    else
+    {
+        uint8_t sign_data[64];
+        ecdsa_key_cache_sign_msg(p_frame + 5, msg_len, sign_data);
+        send_ble_data_to_st(UART_CMD_BLE_SIGN, sign_data, 64);
+    }
+}
+
+// UART_CMD_BLE_SIGN_STREAM stages, byte 5 of the frame
+#define SIGN_STREAM_BEGIN    0x00
+#define SIGN_STREAM_UPDATE   0x01
+#define SIGN_STREAM_FINALIZE 0x02
+
+/**@brief Function for signing a message longer than one frame.
+ *
+ * @details Frames are cmd | stage | data. BEGIN starts a session, every UPDATE feeds its data
+ *          straight into the hash and FINALIZE replies with the 64 byte signature, so RAM use
+ *          does not depend on the message length. The other stages reply with one status
+ *          byte: 0x00 ok, 0x01 no device key, 0x02 no session open, 0x03 bad request.
+ */
+static void uart_cmd_sign_stream(uint8_t const* p_frame, uint32_t lenth)
+{
+    ret_code_t err_code;
+    uint8_t sign_data[64];
+
+    if(lenth < 2)
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_STREAM, 0x03);
+        return;
+    }
+
+    switch(p_frame[5])
+    {
+        case SIGN_STREAM_BEGIN:
+            err_code = ecdsa_key_cache_sign_begin();
+            break;
+        case SIGN_STREAM_UPDATE:
+            err_code = ecdsa_key_cache_sign_update(p_frame + 6, lenth - 2);
+            break;
+        case SIGN_STREAM_FINALIZE:
+            err_code = ecdsa_key_cache_sign_finalize(sign_data);
+            if(err_code == NRF_SUCCESS)
+            {
+                send_ble_data_to_st(UART_CMD_BLE_SIGN_STREAM, sign_data, 64);
+                return;
+            }
             break;
+        default:
+            send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_STREAM, 0x03);
+            return;
+    }
+
+    if(err_code == NRF_SUCCESS)
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_STREAM, 0x00);
+    }
+    else if(!ecdsa_key_cache_valid())
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_STREAM, 0x01);
+    }
+    else
+    {
+        NRF_LOG_INFO("sign stream stage %d failed 0x%x", p_frame[5], err_code);
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_STREAM, 0x02);
     }
-    trans_info_flag = DEF_RESP;
 }
 
-/**@brief   Function for handling app_uart events.
+#define SIGN_BATCH_MAX ((UART_FRAME_MAX - 7) / 32) /**< Digests that fit in one request frame. */
+
+static uint8_t sign_batch_digest[SIGN_BATCH_MAX][32];
+static uint8_t sign_batch_count, sign_batch_next;
+
+static bool uart_sign_batch_busy(void)
+{
+    return sign_batch_next < sign_batch_count;
+}
+
+/**@brief Function for signing the next digest of the batch.
  *
- * @details This function will receive a single character from the app_uart module and append it to
- *          a string. The string will be be sent over BLE when the last character received was a
- *          'new line' '\n' (hex 0x0A) or if the string has reached the maximum data length.
+ * @details Runs from the request and then from uart_frame_poll(), which the TX_DONE event posts
+ *          while a batch is open. A digest is only signed once the previous response has left
+ *          the bulk queue, so the UART paces the batch, other events run between two signatures
+ *          and nothing re-queues itself while the line is busy.
  */
-/**@snippet [Handling the data received over UART] */
-void uart_event_handle(app_uart_evt_t* p_event)
+static void uart_sign_batch_step(void)
 {
-    static uint8_t index = 0;
+    ret_code_t err_code;
+    uint8_t rsp[65];
+
+    if(!uart_sign_batch_busy() || (uart_tx_count[UART_TX_PRIO_BULK] > 0))
+    {
+        return;
+    }
+
+    rsp[0] = sign_batch_next;
+    err_code = ecdsa_key_cache_sign_hash(sign_batch_digest[sign_batch_next], rsp + 1);
+    if(err_code == NRF_SUCCESS)
+    {
+        send_ble_data_to_st(UART_CMD_BLE_SIGN_BATCH, rsp, sizeof(rsp));
+    }
+    else
+    {
+        NRF_LOG_INFO("sign batch %d failed 0x%x", sign_batch_next, err_code);
+        rsp[1] = 0x02;
+        send_ble_data_to_st(UART_CMD_BLE_SIGN_BATCH, rsp, 2);
+    }
+    sign_batch_next++;
+    if(!uart_sign_batch_busy() && (uart_frame_count > 0))
+    {
+        // Commands received during the batch.
+        main_evt_post(MAIN_EVT_UART_RX);
+    }
+}
+
+/**@brief Function for signing several digests in one request.
+ *
+ * @details The request is cmd | count | count * 32 byte digest. Each digest is answered with
+ *          its own frame, index | 64 byte signature, in request order. A rejected request is
+ *          answered with one status byte: 0x01 no device key, 0x03 bad request. No other
+ *          command is handled until the batch is done.
+ */
+static void uart_cmd_sign_batch(uint8_t const* p_frame, uint32_t lenth)
+{
+    uint8_t count = p_frame[5];
+
+    if((lenth < 2) || (count == 0) || (count > SIGN_BATCH_MAX) || (lenth != 2 + 32 * (uint32_t)count))
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_BATCH, 0x03);
+        return;
+    }
+    if(!ecdsa_key_cache_valid())
+    {
+        send_ble_data_to_st_byte(UART_CMD_BLE_SIGN_BATCH, 0x01);
+        return;
+    }
+
+    memcpy(sign_batch_digest, p_frame + 6, 32 * count);
+    sign_batch_count = count;
+    sign_batch_next = 0;
+    uart_sign_batch_step();
+}
+
+static void uart_cmd_build_id(uint8_t const* p_frame, uint32_t lenth)
+{
+    send_ble_data_to_st(UART_CMD_BLE_BUILD_ID, (uint8_t*)BUILD_ID, 7);
+}
+
+static void uart_cmd_hash(uint8_t const* p_frame, uint32_t lenth)
+{
+    uint8_t hash[32] = {0};
+    fw_hash_get(hash);
+    send_ble_data_to_st(UART_CMD_BLE_HASH, hash, 32);
+}
+
+static void uart_cmd_hw_ver(uint8_t const* p_frame, uint32_t lenth)
+{
+    HW_VER_t hw_ver = get_hw_ver();
+    send_ble_data_to_st(UART_CMD_BLE_HW_VER, (uint8_t*)&hw_ver, 2);
+}
+
+static void uart_cmd_link(uint8_t const* p_frame, uint32_t lenth)
+{
+    // tx phy | rx phy | LL data length | ATT payload length(2)
+    uint8_t link_info[5];
+    link_info[0] = m_link_tx_phy;
+    link_info[1] = m_link_rx_phy;
+    link_info[2] = m_link_data_length;
+    link_info[3] = m_ble_gatt_max_data_len >> 8;
+    link_info[4] = m_ble_gatt_max_data_len & 0xFF;
+    send_ble_data_to_st(UART_CMD_BLE_LINK, link_info, sizeof(link_info));
+}
+
+static void uart_cmd_baud(uint8_t const* p_frame, uint32_t lenth)
+{
+    uart_baud_request(p_frame, lenth);
+}
+
+// Handlers that answer a short frame with a status byte take it at length 1.
+static const uart_cmd_entry_t uart_cmd_table[] = {
+    {UART_CMD_CTL_BLE, 3, uart_cmd_ctl_ble}, // cmd | len | flag
+    {UART_CMD_RESET_BLE, 1, uart_cmd_reset_ble},
+    {UART_CMD_ADV_NAME, 1, uart_cmd_adv_name},
+    {UART_CMD_BAT_PERCENT, 1, uart_cmd_bat_percent},
+    {UART_CMD_BLE_VERSION, 1, uart_cmd_ble_version},
+    {UART_CMD_BLE_PUBKEY, 1, uart_cmd_pubkey},
+    {UART_CMD_BLE_SIGN, 1, uart_cmd_sign},
+    {UART_CMD_BLE_BUILD_ID, 1, uart_cmd_build_id},
+    {UART_CMD_BLE_HASH, 1, uart_cmd_hash},
+    {UART_CMD_BLE_HW_VER, 1, uart_cmd_hw_ver},
+    {UART_CMD_BLE_LINK, 1, uart_cmd_link},
+    {UART_CMD_BAUD, 1, uart_cmd_baud},
+    {UART_CMD_BLE_SIGN_STREAM, 1, uart_cmd_sign_stream},
+    {UART_CMD_BLE_SIGN_BATCH, 1, uart_cmd_sign_batch},
+};
+
+/**@brief Function for acting on one decoded frame.
+ *
+ * @param[in] p_frame  Whole frame, tag to xor.
+ * @param[in] lenth    Frame length field minus the xor byte.
+ */
+static void uart_cmd_handle(uint8_t const* p_frame, uint32_t lenth)
+{
+    for(uint8_t i = 0; i < ARRAY_SIZE(uart_cmd_table); i++)
+    {
+        if(uart_cmd_table[i].cmd == p_frame[4])
+        {
+            if(lenth < uart_cmd_table[i].min_len)
+            {
+                NRF_LOG_INFO("uart cmd 0x%x too short %d", p_frame[4], lenth);
+                return;
+            }
+            uart_cmd_table[i].handler(p_frame, lenth);
+            return;
+        }
+    }
+    NRF_LOG_INFO("uart unknown cmd 0x%x", p_frame[4]);
+}
+
+/**@brief Function for decoding the bytes of one DMA buffer into frames.
+ *
+ * @details Frames are A5 5A | len(2) | cmd | ... | xor, len counting cmd to xor. Complete
+ *          frames with a valid xor are queued for uart_frame_poll(), a frame without its cmd
+ *          byte or that does not fit in UART_FRAME_MAX is dropped.
+ */
+static void uart_frame_decode(uint8_t const* p_data, size_t len)
+{
+    static uint8_t frame[UART_FRAME_MAX];
     static uint32_t lenth = 0;
-    uint8_t xor_byte;
+    uint16_t index = uart_decode_index;
+    uart_frame_t* p_frame;
 
-    switch(p_event->evt_type)
+    while(len--)
     {
-        case APP_UART_DATA_READY:
-            UNUSED_VARIABLE(app_uart_get(&uart_data_array[index]));
-            index++;
+        frame[index++] = *p_data++;
 
-            if(1 == index)
+        if(1 == index)
+        {
+            if((UART_TX_TAG != frame[0]) && (UART_TX_TAG2 != frame[0]))
             {
-                if((UART_TX_TAG != uart_data_array[0]) && (UART_TX_TAG2 != uart_data_array[0]))
-                {
-                    index = 0;
-                    return;
-                }
+                index = 0;
             }
-            else if(2 == index)
+        }
+        else if(2 == index)
+        {
+            if((UART_TX_TAG2 != frame[1]) && (UART_TX_TAG != frame[1]))
             {
-                if((UART_TX_TAG2 != uart_data_array[1]) && (UART_TX_TAG != uart_data_array[1]))
-                {
-                    index = 0;
-                    return;
-                }
+                index = 0;
             }
-            else if(3 == index)
+        }
+        else if(3 == index)
+        {
+            if((UART_TX_TAG2 == frame[0]) && (UART_TX_TAG == frame[1]))
             {
-                if((UART_TX_TAG2 == uart_data_array[0]) && (UART_TX_TAG == uart_data_array[1]))
-                {
-                    index = 0;
-                    return;
-                }
+                index = 0;
             }
-            else if(4 == index)
+        }
+        else if(4 == index)
+        {
+            lenth = ((uint32_t)frame[2] << 8) + frame[3];
+            if((lenth < UART_FRAME_LEN_MIN) || (lenth + 4 > UART_FRAME_MAX))
             {
-                lenth = ((uint32_t)uart_data_array[2] << 8) + uart_data_array[3];
+                NRF_LOG_INFO("uart frame length %d out of range", lenth);
+                index = 0;
             }
-            else if(index >= lenth + 4)
+        }
+        else if(index >= lenth + 4)
+        {
+            if(calcXor(frame, index - 1) != frame[index - 1])
             {
-                xor_byte = calcXor(uart_data_array, index - 1);
-                if(xor_byte != uart_data_array[index - 1])
-                {
-                    index = 0;
-                    return;
-                }
-                lenth -= 1;
-                switch(uart_data_array[4])
-                {
-                    case UART_CMD_CTL_BLE:
-                        switch(uart_data_array[6])
-                        {
-                            case BLE_ON_ALWAYS:
-                                ble_adv_switch_flag = BLE_ON_ALWAYS;
-                                NRF_LOG_INFO("RCV ble always ON.");
-                                break;
-                            case BLE_OFF_ALWAYS:
-                            case BLE_DEF:
-                                ble_adv_switch_flag = BLE_OFF_ALWAYS;
-                                NRF_LOG_INFO("RCV ble always OFF.");
-                                break;
-                            case BLE_DISCON:
-                                ble_conn_flag = BLE_DISCON;
-                                NRF_LOG_INFO("RCV ble flag disconnect.");
-                                break;
-                            case BLE_ON_TEMPO:
-                                ble_conn_flag = BLE_ON_TEMPO;
-                                NRF_LOG_INFO("RCV ble flag start adv flag.");
-                                break;
-                            case BLE_OFF_TEMPO:
-                                ble_conn_flag = BLE_OFF_TEMPO;
-                                NRF_LOG_INFO("RCV ble flag stop adv flag.");
-                                break;
-                            case BLE_STATUS:
-                                trans_info_flag = RESPONESE_BLE_STATUS;
-                                break;
-                            case BLE_PASSKEY_ACCEPT:
-                                if(waiting_passkey_response && m_conn_handle != BLE_CONN_HANDLE_INVALID)
-                                {
-                                    ret_code_t err_code = NRF_SUCCESS;
-                                    bool passkey_provided = (lenth == PASSKEY_LENGTH + 3); // 1(cmd)+1(subcmd)+passkey+1(xor)
-
-                                    if(passkey_provided)
-                                    {
-                                        if(memcmp(pending_passkey, uart_data_array + 7, PASSKEY_LENGTH) == 0)
-                                        {
-                                            // Passkey matches, accept pairing with actual passkey data
-                                            err_code =
-                                                sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_PASSKEY, NULL);
-                                        }
-                                        else
-                                        {
-                                            // Passkey mismatch, reject pairing
-                                            err_code = sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
-                                            APP_ERROR_CHECK(err_code);
-                                            // Disconnect to ensure phone exits pairing screen
-                                            err_code =
-                                                sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
-                                            APP_ERROR_CHECK(err_code);
-                                        }
-                                    }
-                                    else
-                                    {
-                                        err_code = sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
-                                        APP_ERROR_CHECK(err_code);
-                                        err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
-                                        APP_ERROR_CHECK(err_code);
-                                    }
-                                    APP_ERROR_CHECK(err_code);
-                                    waiting_passkey_response = false;
-                                }
-                                break;
-                            case BLE_PASSKEY_REJECT:
-                                if(waiting_passkey_response && m_conn_handle != BLE_CONN_HANDLE_INVALID)
-                                {
-                                    ret_code_t err_code =
-                                        sd_ble_gap_auth_key_reply(m_conn_handle, BLE_GAP_AUTH_KEY_TYPE_NONE, NULL);
-                                    err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
-                                    APP_ERROR_CHECK(err_code);
-                                    waiting_passkey_response = false;
-                                }
-                                break;
-                            default:
-                                NRF_LOG_INFO("Receive flag is %d \n", uart_data_array[6]);
-                                break;
-                        }
-                        break;
-                    case UART_CMD_RESET_BLE:
-                        NVIC_SystemReset();
-                        break;
-                    case UART_CMD_ADV_NAME:
-                        trans_info_flag = RESPONESE_NAME_UART;
-                        break;
-                    case UART_CMD_BAT_PERCENT:
-                        trans_info_flag = RESPONESE_BAT_UART;
-                        break;
-                    case UART_CMD_BLE_VERSION:
-                        trans_info_flag = RESPONESE_VER_UART;
-                        break;
-                    case UART_CMD_BLE_PUBKEY:
-                        trans_info_flag = RESPONESE_BLE_PUBKEY;
-                        if(lenth == 2)
-                        {
-                            if(uart_data_array[5] == 0)
-                            {
-                                trans_info_flag = RESPONESE_BLE_PUBKEY;
-                            }
-                            else if(uart_data_array[5] == 1)
-                            {
-                                trans_info_flag = RESPONESE_BLE_PUBKEY_LOCK;
-                            }
-                        }
-                        break;
-                    case UART_CMD_BLE_SIGN:
-                        trans_info_flag = RESPONESE_BLE_SIGN;
-                        break;
-                    case UART_CMD_BLE_BUILD_ID:
-                        trans_info_flag = RESPONESE_BLE_BUILD_ID;
-                        break;
-                    case UART_CMD_BLE_HASH:
-                        trans_info_flag = RESPONESE_BLE_BLE_HASH;
-                        break;
-                    case UART_CMD_BLE_HW_VER:
-                        trans_info_flag = RESPONESE_BLE_HW_VER;
-                        break;
-                    default:
-                        break;
-                }
                 index = 0;
+                continue;
+            }
+            if(uart_frame_count < UART_FRAME_QUEUE_SIZE)
+            {
+                p_frame = &uart_frame_queue[(uart_frame_head + uart_frame_count) % UART_FRAME_QUEUE_SIZE];
+                memcpy(p_frame->data, frame, index);
+                p_frame->len = index;
+                uart_frame_count++;
+                main_evt_post(MAIN_EVT_UART_RX);
+            }
+            else
+            {
+                NRF_LOG_INFO("uart frame queue full");
+            }
+            index = 0;
+        }
+    }
+    uart_decode_index = index;
+}
+
+/**@brief Function for handling libuarte events.
+ *
+ * @details Each RX event carries a whole DMA buffer, cut short by the RX timeout when the line
+ *          goes idle. The buffer is decoded and given back right away.
+ */
+static void uart_event_handle(void* context, nrf_libuarte_async_evt_t* p_evt)
+{
+    switch(p_evt->type)
+    {
+        case NRF_LIBUARTE_ASYNC_EVT_RX_DATA:
+            uart_frame_decode(p_evt->data.rxtx.p_data, p_evt->data.rxtx.length);
+            nrf_libuarte_async_rx_free(&libuarte, p_evt->data.rxtx.p_data, p_evt->data.rxtx.length);
+            break;
+
+        case NRF_LIBUARTE_ASYNC_EVT_TX_DONE:
+            uart_tx_done();
+            if((uart_frame_count > 0) || uart_sign_batch_busy())
+            {
+                // Draining may have stopped on a full response queue, a batch waits for its
+                // previous signature to leave.
+                main_evt_post(MAIN_EVT_UART_RX);
             }
             break;
 
-        case APP_UART_COMMUNICATION_ERROR:
-            APP_ERROR_HANDLER(p_event->data.error_communication);
+        case NRF_LIBUARTE_ASYNC_EVT_ERROR:
+            if(uart_baud_neg.code != UART_BAUD_115200)
+            {
+                // Most likely the ST restarted at the default rate.
+                uart_baud_fallback_schedule();
+                break;
+            }
+            APP_ERROR_HANDLER(p_evt->data.errorsrc);
             break;
 
-        case APP_UART_FIFO_ERROR:
-            APP_ERROR_HANDLER(p_event->data.error_code);
+        case NRF_LIBUARTE_ASYNC_EVT_OVERRUN_ERROR:
+            APP_ERROR_HANDLER(p_evt->data.overrun_err.overrun_length);
             break;
 
         default:
             break;
     }
 }
-/**@snippet [Handling the data received over UART] */
 
-/**@brief  Function for initializing the UART module.
+/**@brief Function for handling the received frames, run for MAIN_EVT_UART_RX.
+ *
+ * @details Every queued frame is dispatched in the same pass, each handler queues its response
+ *          right away, so responses leave in command order. Draining pauses while the response
+ *          queue is full or a signing batch runs, the next TX completion or the end of the batch
+ *          posts the event again. While a batch runs each pass signs at most one digest.
  */
+static void uart_frame_poll(void* p_event_data, uint16_t event_size)
+{
+    uart_frame_t* p_frame;
+
+    if(uart_sign_batch_busy())
+    {
+        // Later commands are answered after the batch, keeping responses in order.
+        uart_sign_batch_step();
+        return;
+    }
+
+    while((uart_frame_count > 0) && (uart_tx_count[UART_TX_PRIO_BULK] < UART_TX_QUEUE_SIZE) &&
+          !uart_sign_batch_busy())
+    {
+        // The slot at the head is only written again after it is popped.
+        p_frame = &uart_frame_queue[uart_frame_head];
+        uart_cmd_handle(p_frame->data, (((uint32_t)p_frame->data[2] << 8) + p_frame->data[3]) - 1);
+
+        CRITICAL_REGION_ENTER();
+        uart_frame_head = (uart_frame_head + 1) % UART_FRAME_QUEUE_SIZE;
+        uart_frame_count--;
+        CRITICAL_REGION_EXIT();
+    }
+}
 /**@snippet [UART Initialization] */
-static void usr_uart_init(void)
+/**@brief Function for (re)starting the UARTE at one of the negotiable rates.
+ *
+ * @details Must not run in the UARTE interrupt. Frames still queued for TX are sent at the
+ *          new rate, a partly received frame is discarded.
+ */
+static void uart_port_init(uint8_t code)
 {
-    uint32_t err_code;
-    app_uart_comm_params_t const comm_params =
+    static bool initialized = false;
+    ret_code_t err_code;
+    nrf_libuarte_async_config_t const config =
         {
-            .rx_pin_no = RX_PIN_NUMBER,
-            .tx_pin_no = TX_PIN_NUMBER,
-            .rts_pin_no = RTS_PIN_NUMBER,
-            .cts_pin_no = CTS_PIN_NUMBER,
-            .flow_control = APP_UART_FLOW_CONTROL_DISABLED,
-            .use_parity = false,
-#if defined(UART_PRESENT)
-            .baud_rate = NRF_UART_BAUDRATE_115200
-#else
-            .baud_rate = NRF_UARTE_BAUDRATE_115200
-#endif
-        };
-
-    APP_UART_FIFO_INIT(&comm_params,
-                       UART_RX_BUF_SIZE,
-                       UART_TX_BUF_SIZE,
-                       uart_event_handle,
-                       APP_IRQ_PRIORITY_LOWEST,
-                       err_code);
+            .rx_pin = RX_PIN_NUMBER,
+            .tx_pin = TX_PIN_NUMBER,
+            .cts_pin = CTS_PIN_NUMBER,
+            .rts_pin = RTS_PIN_NUMBER,
+            .timeout_us = UART_RX_TIMEOUT_US,
+            .hwfc = UART_BAUD_HWFC ? NRF_UARTE_HWFC_ENABLED : NRF_UARTE_HWFC_DISABLED,
+            .parity = NRF_UARTE_PARITY_EXCLUDED,
+            .baudrate = uart_baud_table[code],
+            .pullup_rx = false,
+            .int_prio = APP_IRQ_PRIORITY_MID};
+
+    if(initialized)
+    {
+        nrf_libuarte_async_uninit(&libuarte);
+    }
+    uart_decode_index = 0;
+    uart_tx_active = -1;
+
+    err_code = nrf_libuarte_async_init(&libuarte, &config, uart_event_handle, NULL);
     APP_ERROR_CHECK(err_code);
+    initialized = true;
+
+    nrf_libuarte_async_enable(&libuarte);
+
+    CRITICAL_REGION_ENTER();
+    uart_tx_kick();
+    CRITICAL_REGION_EXIT();
+}
+
+static void usr_uart_init(void)
+{
+    baud_neg_init(&uart_baud_neg, UART_BAUD_HWFC);
+    uart_port_init(UART_BAUD_115200);
+}
+
+static void uart_baud_fallback(void* p_event_data, uint16_t event_size)
+{
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    (void)app_timer_stop(uart_baud_timer_id);
+    if(!baud_neg_fallback(&uart_baud_neg))
+    {
+        return;
+    }
+    NRF_LOG_WARNING("uart back to 115200");
+    uart_port_init(UART_BAUD_115200);
+}
+
+static void uart_baud_fallback_schedule(void)
+{
+    (void)app_sched_event_put(NULL, 0, uart_baud_fallback);
+}
+
+static void uart_baud_timeout_handler(void* p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if(uart_baud_neg.pending)
+    {
+        uart_baud_fallback_schedule();
+    }
+}
+
+/**@brief Function for handling UART_CMD_BAUD, called from the main loop.
+ *
+ * @details baud_neg_request() decides, this side sends the reply and restarts the port. The
+ *          ST has UART_BAUD_CONFIRM_MS to confirm a new rate. Without that confirmation, or on
+ *          a line error later on, the link falls back to 115200, which is also the rate after
+ *          every reset.
+ */
+static void uart_baud_request(uint8_t const* p_frame, uint32_t lenth)
+{
+    static bool timer_created = false;
+    ret_code_t err_code;
+    uint8_t rsp[BAUD_NEG_RSP_MAX];
+    uint8_t rsp_len;
+
+    if(baud_neg_request(&uart_baud_neg, p_frame, lenth, rsp, &rsp_len) == BAUD_NEG_ACT_REPLY)
+    {
+        if(rsp[0] == BAUD_NEG_STATUS_OK)
+        {
+            (void)app_timer_stop(uart_baud_timer_id);
+            NRF_LOG_INFO("uart rate %d confirmed", rsp[1]);
+        }
+        send_ble_data_to_st(UART_CMD_BAUD, rsp, rsp_len);
+        return;
+    }
+
+    if(!timer_created)
+    {
+        err_code = app_timer_create(&uart_baud_timer_id, APP_TIMER_MODE_SINGLE_SHOT, uart_baud_timeout_handler);
+        APP_ERROR_CHECK(err_code);
+        timer_created = true;
+    }
+
+    send_ble_data_to_st(UART_CMD_BAUD, rsp, rsp_len);
+    uart_tx_flush();
+    nrf_delay_us(UART_BAUD_SWITCH_GUARD_US);
+
+    (void)app_timer_stop(uart_baud_timer_id);
+    uart_port_init(uart_baud_neg.code);
+    if(uart_baud_neg.pending)
+    {
+        err_code = app_timer_start(uart_baud_timer_id, APP_TIMER_TICKS(UART_BAUD_CONFIRM_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+    }
 }
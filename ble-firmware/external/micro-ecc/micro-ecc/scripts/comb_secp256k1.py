@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+
+# Generates comb-secp256k1.inc, the fixed-base comb table used by EccPoint_mult_comb().
+#
+# With TEETH teeth spaced SPACING bits apart, entry u holds
+#     (2^((TEETH-1)*SPACING) + sum(j < TEETH-1) (bit j of u ? 1 : -1) * 2^(j*SPACING)) * G
+# as an affine point, x then y, in the BYTES_TO_WORDS_8 order used by curve-specific.inc.
+
+import sys
+
+p = 0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC2F
+n = 0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141
+G = (0x79BE667EF9DCBBAC55A06295CE870B07029BFCDB2DCE28D959F2815B16F81798,
+     0x483ADA7726A3C4655DA4FBFC0E1108A8FD17B448A68554199C47D08FFB10D4B8)
+
+TEETH = 6
+SPACING = 43
+
+def inv(a):
+    return pow(a, p - 2, p)
+
+def add(P, Q):
+    if P is None:
+        return Q
+    if Q is None:
+        return P
+    if P[0] == Q[0]:
+        if (P[1] + Q[1]) % p == 0:
+            return None
+        l = 3 * P[0] * P[0] * inv(2 * P[1]) % p
+    else:
+        l = (Q[1] - P[1]) * inv(Q[0] - P[0]) % p
+    x = (l * l - P[0] - Q[0]) % p
+    return (x, (l * (P[0] - x) - P[1]) % p)
+
+def mult(k, P):
+    R = None
+    k %= n
+    while k:
+        if k & 1:
+            R = add(R, P)
+        P = add(P, P)
+        k >>= 1
+    return R
+
+def words(v):
+    b = ["%02X" % ((v >> (8 * i)) & 0xFF) for i in range(32)]
+    return ["BYTES_TO_WORDS_8(%s)" % ", ".join(b[i:i + 8]) for i in range(0, 32, 8)]
+
+if TEETH * SPACING < 256:
+    sys.exit("TEETH * SPACING must cover 256 bits")
+
+out = []
+out.append("/* Generated by scripts/comb_secp256k1.py, do not edit. */")
+out.append("")
+out.append("#define uECC_COMB_TEETH %d" % TEETH)
+out.append("#define uECC_COMB_SPACING %d" % SPACING)
+out.append("#define uECC_COMB_POINTS %d" % (1 << (TEETH - 1)))
+out.append("")
+out.append("static const uECC_word_t comb_secp256k1[uECC_COMB_POINTS * num_words_secp256k1 * 2] = {")
+for u in range(1 << (TEETH - 1)):
+    k = 1 << ((TEETH - 1) * SPACING)
+    for j in range(TEETH - 1):
+        k += (1 if (u >> j) & 1 else -1) << (j * SPACING)
+    P = mult(k, G)
+    w = words(P[0]) + words(P[1])
+    out.append("    /* %d */" % u)
+    for i, line in enumerate(w):
+        out.append("    " + line + ",")
+out.append("};")
+print("\n".join(out))
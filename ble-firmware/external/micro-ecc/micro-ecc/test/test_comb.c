@@ -0,0 +1,115 @@
+/* Copyright 2014, Kenneth MacKay. Licensed under the BSD 2-clause license. */
+
+/* Checks the fixed-base comb (uECC_FIXED_BASE_COMB) against the generic ladder and reports
+   signing speed. Build with -DuECC_FIXED_BASE_COMB=1, and again with 0 to compare speed. */
+
+#include "uECC.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if uECC_SUPPORTS_secp256k1
+
+/* The vectors below are big-endian. With uECC_VLI_NATIVE_LITTLE_ENDIAN, as the nRF52 library
+   is built, keys and points are passed in native little-endian order instead, so each 32-byte
+   value is reversed before use. */
+static void to_native(uint8_t *dst, const uint8_t *src) {
+    int i;
+    for (i = 0; i < 32; ++i) {
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+        dst[i] = src[31 - i];
+#else
+        dst[i] = src[i];
+#endif
+    }
+}
+
+/* Generator, so uECC_shared_secret() computes x(k*G) with the variable-base ladder. */
+static const uint8_t generator[64] = {
+    0x79, 0xBE, 0x66, 0x7E, 0xF9, 0xDC, 0xBB, 0xAC, 0x55, 0xA0, 0x62, 0x95, 0xCE, 0x87, 0x0B, 0x07,
+    0x02, 0x9B, 0xFC, 0xDB, 0x2D, 0xCE, 0x28, 0xD9, 0x59, 0xF2, 0x81, 0x5B, 0x16, 0xF8, 0x17, 0x98,
+    0x48, 0x3A, 0xDA, 0x77, 0x26, 0xA3, 0xC4, 0x65, 0x5D, 0xA4, 0xFB, 0xFC, 0x0E, 0x11, 0x08, 0xA8,
+    0xFD, 0x17, 0xB4, 0x48, 0xA6, 0x85, 0x54, 0x19, 0x9C, 0x47, 0xD0, 0x8F, 0xFB, 0x10, 0xD4, 0xB8
+};
+
+/* x(2*G), x(3*G) and, for the comb only (the ladder rejects it), x((n-1)*G) = x(G). */
+static const struct {
+    uint8_t private[32];
+    uint8_t x[32];
+} vectors[] = {
+    { { [31] = 2 },
+      { 0xC6, 0x04, 0x7F, 0x94, 0x41, 0xED, 0x7D, 0x6D, 0x30, 0x45, 0x40, 0x6E, 0x95, 0xC0, 0x7C, 0xD8,
+        0x5C, 0x77, 0x8E, 0x4B, 0x8C, 0xEF, 0x3C, 0xA7, 0xAB, 0xAC, 0x09, 0xB9, 0x5C, 0x70, 0x9E, 0xE5 } },
+    { { [31] = 3 },
+      { 0xF9, 0x30, 0x8A, 0x01, 0x92, 0x58, 0xC3, 0x10, 0x49, 0x34, 0x4F, 0x85, 0xF8, 0x9D, 0x52, 0x29,
+        0xB5, 0x31, 0xC8, 0x45, 0x83, 0x6F, 0x99, 0xB0, 0x86, 0x01, 0xF1, 0x13, 0xBC, 0xE0, 0x36, 0xF9 } },
+#if uECC_FIXED_BASE_COMB
+    { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+        0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x40 },
+      { 0x79, 0xBE, 0x66, 0x7E, 0xF9, 0xDC, 0xBB, 0xAC, 0x55, 0xA0, 0x62, 0x95, 0xCE, 0x87, 0x0B, 0x07,
+        0x02, 0x9B, 0xFC, 0xDB, 0x2D, 0xCE, 0x28, 0xD9, 0x59, 0xF2, 0x81, 0x5B, 0x16, 0xF8, 0x17, 0x98 } },
+#endif
+};
+
+int main() {
+    int i;
+    uint8_t private[32] = {0};
+    uint8_t public[64] = {0};
+    uint8_t secret[32] = {0};
+    uint8_t hash[32] = {0};
+    uint8_t sig[64] = {0};
+    uint8_t g[64];
+    uint8_t x[32];
+    clock_t start;
+    const struct uECC_Curve_t * curve = uECC_secp256k1();
+
+    to_native(g, generator);
+    to_native(g + 32, generator + 32);
+
+    printf("Testing fixed vectors (uECC_VLI_NATIVE_LITTLE_ENDIAN=%d)\n", uECC_VLI_NATIVE_LITTLE_ENDIAN);
+    for (i = 0; i < (int)(sizeof(vectors) / sizeof(vectors[0])); ++i) {
+        to_native(private, vectors[i].private);
+        to_native(x, vectors[i].x);
+        if (!uECC_compute_public_key(private, public, curve) ||
+            memcmp(public, x, 32) != 0) {
+            printf("vector %d failed\n", i);
+            return 1;
+        }
+    }
+
+    printf("Testing 1024 keys against the ladder\n");
+    for (i = 0; i < 1024; ++i) {
+        if (!uECC_make_key(public, private, curve)) {
+            printf("uECC_make_key() failed\n");
+            return 1;
+        }
+        if (!uECC_shared_secret(g, private, secret, curve) ||
+            memcmp(public, secret, sizeof(secret)) != 0) {
+            printf("public key %d does not match the ladder\n", i);
+            return 1;
+        }
+        memcpy(hash, public + 32, sizeof(hash));
+        if (!uECC_sign(private, hash, sizeof(hash), sig, curve) ||
+            !uECC_verify(public, hash, sizeof(hash), sig, curve)) {
+            printf("signature %d failed\n", i);
+            return 1;
+        }
+    }
+
+    start = clock();
+    for (i = 0; clock() - start < CLOCKS_PER_SEC; ++i) {
+        uECC_sign(private, hash, sizeof(hash), sig, curve);
+    }
+    printf("%d signs/s (uECC_FIXED_BASE_COMB=%d)\n", i, uECC_FIXED_BASE_COMB);
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("secp256k1 is disabled\n");
+    return 0;
+}
+
+#endif
@@ -155,6 +155,9 @@ struct uECC_Curve_t {
 #if (uECC_OPTIMIZATION_LEVEL > 0)
     void (*mmod_fast)(uECC_word_t *result, uECC_word_t *product);
 #endif
+#if uECC_FIXED_BASE_COMB
+    const uECC_word_t *comb; /* Comb table of G, 0 if the curve has none. */
+#endif
 };
 
 #if uECC_VLI_NATIVE_LITTLE_ENDIAN
@@ -899,6 +902,151 @@ static void EccPoint_mult(uECC_word_t * result,
     uECC_vli_set(result + num_words, Ry[0], num_words);
 }
 
+#if uECC_FIXED_BASE_COMB
+
+/* Bit 'bit' of the odd scalar as seen by the comb: bit + 1 of k, the top digit is always set. */
+static uECC_word_t comb_bit(const uECC_word_t *k, bitcount_t bit, uECC_Curve curve) {
+    bitcount_t num_bits = uECC_COMB_TEETH * uECC_COMB_SPACING;
+    if (bit == num_bits - 1) {
+        return 1;
+    }
+    if (bit + 1 >= (bitcount_t)curve->num_words * uECC_WORD_BITS) {
+        return 0;
+    }
+    return (k[(bit + 1) >> uECC_WORD_BITS_SHIFT] >> ((bit + 1) & uECC_WORD_BITS_MASK)) & 1;
+}
+
+/* Loads +/- table entry 'index' into (X1, Y1), reading every entry so the access pattern does
+   not depend on the scalar. */
+static void comb_select(uECC_word_t * X1,
+                        uECC_word_t * Y1,
+                        wordcount_t index,
+                        uECC_word_t negate,
+                        uECC_Curve curve) {
+    uECC_word_t tmp[uECC_MAX_WORDS];
+    wordcount_t num_words = curve->num_words;
+    const uECC_word_t *entry = curve->comb;
+    uECC_word_t mask;
+    wordcount_t i, j;
+
+    uECC_vli_clear(X1, num_words);
+    uECC_vli_clear(Y1, num_words);
+    for (i = 0; i < uECC_COMB_POINTS; ++i) {
+        mask = (uECC_word_t)0 - (uECC_word_t)(i == index);
+        for (j = 0; j < num_words; ++j) {
+            X1[j] |= entry[j] & mask;
+            Y1[j] |= entry[num_words + j] & mask;
+        }
+        entry += num_words * 2;
+    }
+
+    /* y of a point on the curve is never 0, so p - y is the canonical negation. */
+    uECC_vli_sub(tmp, curve->p, Y1, num_words);
+    mask = (uECC_word_t)0 - negate;
+    for (j = 0; j < num_words; ++j) {
+        Y1[j] = (tmp[j] & mask) | (Y1[j] & ~mask);
+    }
+}
+
+/* (X1, Y1, Z1) += (x2, y2) with the second point in affine coordinates.
+   Returns 0 if the points share x, which the comb only reaches with negligible probability. */
+static uECC_word_t comb_add(uECC_word_t * X1,
+                            uECC_word_t * Y1,
+                            uECC_word_t * Z1,
+                            const uECC_word_t * x2,
+                            const uECC_word_t * y2,
+                            uECC_Curve curve) {
+    uECC_word_t t1[uECC_MAX_WORDS];
+    uECC_word_t t2[uECC_MAX_WORDS];
+    uECC_word_t t3[uECC_MAX_WORDS];
+    wordcount_t num_words = curve->num_words;
+
+    uECC_vli_modSquare_fast(t1, Z1, curve);               /* t1 = z1^2 */
+    uECC_vli_modMult_fast(t2, x2, t1, curve);             /* t2 = x2*z1^2 */
+    uECC_vli_modMult_fast(t1, t1, Z1, curve);             /* t1 = z1^3 */
+    uECC_vli_modMult_fast(t1, t1, y2, curve);             /* t1 = y2*z1^3 */
+    uECC_vli_modSub(t2, t2, X1, curve->p, num_words);     /* t2 = x2*z1^2 - x1 = H */
+    uECC_vli_modSub(t1, t1, Y1, curve->p, num_words);     /* t1 = y2*z1^3 - y1 = R */
+    if (uECC_vli_isZero(t2, num_words)) {
+        return 0;
+    }
+
+    uECC_vli_modMult_fast(Z1, Z1, t2, curve);             /* z3 = z1*H */
+    uECC_vli_modSquare_fast(t3, t2, curve);               /* t3 = H^2 */
+    uECC_vli_modMult_fast(t2, t2, t3, curve);             /* t2 = H^3 */
+    uECC_vli_modMult_fast(t3, X1, t3, curve);             /* t3 = x1*H^2 */
+    uECC_vli_modSquare_fast(X1, t1, curve);               /* x1 = R^2 */
+    uECC_vli_modSub(X1, X1, t2, curve->p, num_words);     /* x1 = R^2 - H^3 */
+    uECC_vli_modSub(X1, X1, t3, curve->p, num_words);
+    uECC_vli_modSub(X1, X1, t3, curve->p, num_words);     /* x3 = R^2 - H^3 - 2*x1*H^2 */
+    uECC_vli_modSub(t3, t3, X1, curve->p, num_words);     /* t3 = x1*H^2 - x3 */
+    uECC_vli_modMult_fast(t3, t3, t1, curve);             /* t3 = R*(x1*H^2 - x3) */
+    uECC_vli_modMult_fast(t2, Y1, t2, curve);             /* t2 = y1*H^3 */
+    uECC_vli_modSub(Y1, t3, t2, curve->p, num_words);     /* y3 = R*(x1*H^2 - x3) - y1*H^3 */
+    return 1;
+}
+
+/* result = k * G for 0 < k < n using the curve's comb table.
+   The scalar is made odd (k or n - k) and written with digits +/-1 in every position, so each
+   comb column selects a non-zero entry and the sequence of operations does not depend on k. */
+static uECC_word_t EccPoint_mult_comb(uECC_word_t * result,
+                                      const uECC_word_t * k,
+                                      uECC_Curve curve) {
+    uECC_word_t k_odd[uECC_MAX_WORDS];
+    uECC_word_t X1[uECC_MAX_WORDS];
+    uECC_word_t Y1[uECC_MAX_WORDS];
+    uECC_word_t Z1[uECC_MAX_WORDS];
+    uECC_word_t x2[uECC_MAX_WORDS];
+    uECC_word_t y2[uECC_MAX_WORDS];
+    wordcount_t num_words = curve->num_words;
+    uECC_word_t even = (k[0] & 1) ^ 1;
+    uECC_word_t mask = (uECC_word_t)0 - even;
+    uECC_word_t top;
+    wordcount_t index;
+    bitcount_t column;
+    wordcount_t i;
+
+    /* k_odd = even ? n - k : k, and the result is negated back at the end. */
+    uECC_vli_sub(k_odd, curve->n, k, num_words);
+    for (i = 0; i < num_words; ++i) {
+        k_odd[i] = (k_odd[i] & mask) | (k[i] & ~mask);
+    }
+
+    uECC_vli_clear(Z1, num_words);
+    Z1[0] = 1;
+    for (column = uECC_COMB_SPACING; column-- > 0; ) {
+        top = comb_bit(k_odd, (uECC_COMB_TEETH - 1) * uECC_COMB_SPACING + column, curve);
+        index = 0;
+        for (i = 0; i < uECC_COMB_TEETH - 1; ++i) {
+            index |= (wordcount_t)((comb_bit(k_odd, i * uECC_COMB_SPACING + column, curve) ^ top ^ 1)
+                                   << i);
+        }
+
+        if (column == uECC_COMB_SPACING - 1) {
+            comb_select(X1, Y1, index, top ^ 1, curve);
+            continue;
+        }
+        curve->double_jacobian(X1, Y1, Z1, curve);
+        comb_select(x2, y2, index, top ^ 1, curve);
+        if (!comb_add(X1, Y1, Z1, x2, y2, curve)) {
+            return 0;
+        }
+    }
+
+    uECC_vli_modInv(Z1, Z1, curve->p, num_words);
+    apply_z(X1, Y1, Z1, curve);
+
+    uECC_vli_sub(Z1, curve->p, Y1, num_words);
+    for (i = 0; i < num_words; ++i) {
+        Y1[i] = (Z1[i] & mask) | (Y1[i] & ~mask);
+    }
+    uECC_vli_set(result, X1, num_words);
+    uECC_vli_set(result + num_words, Y1, num_words);
+    return 1;
+}
+
+#endif /* uECC_FIXED_BASE_COMB */
+
 static uECC_word_t regularize_k(const uECC_word_t * const k,
                                 uECC_word_t *k0,
                                 uECC_word_t *k1,
@@ -920,6 +1068,13 @@ static uECC_word_t EccPoint_compute_public_key(uECC_word_t *result,
     uECC_word_t *p2[2] = {tmp1, tmp2};
     uECC_word_t carry;
 
+#if uECC_FIXED_BASE_COMB
+    if (curve->comb) {
+        /* The callers already ensured 0 < private_key < n. */
+        return EccPoint_mult_comb(result, private_key, curve);
+    }
+#endif
+
     /* Regularize the bitcount for the private key so that attackers cannot use a side channel
        attack to learn the number of leading zeros. */
     carry = regularize_k(private_key, tmp1, tmp2, curve);
@@ -1254,8 +1409,17 @@ static int uECC_sign_with_k(const uint8_t *private_key,
         return 0;
     }
 
-    carry = regularize_k(k, tmp, s, curve);
-    EccPoint_mult(p, curve->G, k2[!carry], 0, num_n_bits + 1, curve);
+#if uECC_FIXED_BASE_COMB
+    if (curve->comb) {
+        if (!EccPoint_mult_comb(p, k, curve)) {
+            return 0;
+        }
+    } else
+#endif
+    {
+        carry = regularize_k(k, tmp, s, curve);
+        EccPoint_mult(p, curve->G, k2[!carry], 0, num_n_bits + 1, curve);
+    }
     if (uECC_vli_isZero(p, num_words)) {
         return 0;
     }
@@ -69,6 +69,14 @@ the same endianness. */
     #define uECC_SUPPORTS_secp256k1 1
 #endif
 
+/* uECC_FIXED_BASE_COMB - If enabled (defined as nonzero), key generation and signing on
+secp256k1 compute k*G with a precomputed comb table of the generator (2 KB of const data, see
+comb-secp256k1.inc) instead of the generic Montgomery ladder. Other curves and point
+multiplications with other points are not affected. */
+#ifndef uECC_FIXED_BASE_COMB
+    #define uECC_FIXED_BASE_COMB 0
+#endif
+
 /* Specifies whether compressed point format is supported.
    Set to 0 to disable point compression/decompression functions. */
 #ifndef uECC_SUPPORT_COMPRESSED_POINT
@@ -1811,12 +1811,23 @@
 
 // </e>
 
-// <q> CRC32_ENABLED  - crc32 - CRC32 calculation routines
- 
-
+// <e> CRC32_ENABLED - crc32 - CRC32 calculation routines
+//==========================================================
 #ifndef CRC32_ENABLED
 #define CRC32_ENABLED 1
 #endif
+// <o> CRC32_CONFIG_IMPL  - Implementation, trades flash for speed
+ 
+// <0=> Bit at a time, no table 
+// <1=> Nibble table, 64 bytes 
+// <2=> Byte table, 1 KB 
+// <3=> Slice-by-4, 4 KB 
+
+#ifndef CRC32_CONFIG_IMPL
+#define CRC32_CONFIG_IMPL 2
+#endif
+
+// </e>
 
 // <e> MEM_MANAGER_ENABLED - mem_manager - Dynamic memory allocator
 //==========================================================